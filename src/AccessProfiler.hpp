@@ -0,0 +1,436 @@
+/**
+ * @file AccessProfiler.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _ACCESSPROFILER_H_INCLUDED
+#define _ACCESSPROFILER_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+/*****************************************************************************
+ * AccessProfiler class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Records which register ranges masters access.
+ *
+ * An access is identified by slave address, function code, start address
+ * and count. Each thread serving requests counts accesses in its own
+ * count-min sketch, so recording takes no locks and no atomic
+ * read-modify-write operations. Counters have a single writer, which
+ * updates them with relaxed atomic loads and stores so merge() may read
+ * them at any time.
+ * Next to the sketch each thread keeps the TOP_CNT accesses with the
+ * highest estimated counts as candidates for the report.
+ *
+ * merge() sums the thread sketches and collects the overall top accesses.
+ * It may be called periodically from any thread. Counts are estimates
+ * which are never too low and exceed the true count by at most
+ * 2 / SKETCH_WIDTH of all accesses with high probability.
+ */
+class AccessProfiler
+{
+
+public:
+
+   enum
+   {
+      SKETCH_DEPTH = 4,    ///< Hash functions (rows) per sketch
+      SKETCH_WIDTH = 4096, ///< Counters per row, a power of 2
+      TOP_CNT = 64         ///< Accesses tracked per thread and reported
+   };
+
+
+   /**
+    * Constructs an empty profiler.
+    *
+    * @param maxThreads Max number of threads recording accesses
+    */
+   AccessProfiler(int maxThreads)
+   {
+      sketchPtrArr = (ThreadSketch **) calloc(maxThreads, sizeof(ThreadSketch *));
+      maxSketchCnt = sketchPtrArr != NULL ? maxThreads : 0;
+      sketchCnt = 0;
+      memset(mergedTopArr, 0, sizeof(mergedTopArr));
+      mergedTopCnt = 0;
+      mergedTotal = 0;
+      pthread_mutex_init(&mutex, NULL);
+      pthread_key_create(&sketchKey, NULL);
+   }
+
+
+   ~AccessProfiler()
+   {
+      int i;
+
+      for (i = 0; i < sketchCnt; i++)
+         free(sketchPtrArr[i]);
+      free(sketchPtrArr);
+      pthread_key_delete(sketchKey);
+      pthread_mutex_destroy(&mutex);
+   }
+
+
+   /**
+    * Records one access.
+    *
+    * @param slaveAddr Slave address
+    * @param fc Function code
+    * @param startAddr Start address, 0-based as on the wire
+    * @param refCnt Number of registers or coils
+    */
+   void record(int slaveAddr, int fc, int startAddr, int refCnt)
+   {
+      ThreadSketch *sketchPtr;
+      unsigned long long key;
+      unsigned long long hash;
+      unsigned int estimate = 0xFFFFFFFF;
+      unsigned int *counterPtr;
+      unsigned int count;
+      int row;
+
+      sketchPtr = (ThreadSketch *) pthread_getspecific(sketchKey);
+      if (sketchPtr == NULL)
+      {
+         sketchPtr = addThreadSketch();
+         if (sketchPtr == NULL)
+            return;
+      }
+      key = makeKey(slaveAddr, fc, startAddr, refCnt);
+      hash = hashKey(key);
+      for (row = 0; row < SKETCH_DEPTH; row++)
+      {
+         counterPtr = &sketchPtr->counterArr[row][(hash >> (row * 16)) & (SKETCH_WIDTH - 1)];
+         count = __atomic_load_n(counterPtr, __ATOMIC_RELAXED) + 1;
+         __atomic_store_n(counterPtr, count, __ATOMIC_RELAXED);
+         if (count < estimate)
+            estimate = count;
+      }
+      updateTop(sketchPtr->topArr, &sketchPtr->topCnt, key, estimate);
+      __atomic_store_n(&sketchPtr->total, sketchPtr->total + 1, __ATOMIC_RELAXED);
+   }
+
+
+   /**
+    * Sums the sketches of all threads and determines the overall top
+    * accesses. The counters are read while their threads may update
+    * them, so the result is a snapshot which may miss the latest
+    * accesses.
+    */
+   void merge()
+   {
+      TopEntry topArr[TOP_CNT];
+      int topCnt = 0;
+      unsigned long long total = 0;
+      int i;
+      int j;
+
+      pthread_mutex_lock(&mutex);
+      for (i = 0; i < sketchCnt; i++)
+      {
+         total += __atomic_load_n(&sketchPtrArr[i]->total, __ATOMIC_RELAXED);
+         for (j = 0; j < TOP_CNT; j++)
+         {
+            unsigned long long key;
+
+            key = __atomic_load_n(&sketchPtrArr[i]->topArr[j].key, __ATOMIC_RELAXED);
+            if (key != 0)
+               updateTop(topArr, &topCnt, key, estimateMerged(key));
+         }
+      }
+      qsort(topArr, topCnt, sizeof(TopEntry), compareTopEntries);
+      memcpy(mergedTopArr, topArr, topCnt * sizeof(TopEntry));
+      mergedTopCnt = topCnt;
+      mergedTotal = total;
+      pthread_mutex_unlock(&mutex);
+   }
+
+
+   /**
+    * Prints the most frequently accessed ranges of the last merge() on
+    * stdout.
+    *
+    * @param maxLines Maximum number of ranges to print
+    */
+   void printReport(int maxLines)
+   {
+      int i;
+
+      pthread_mutex_lock(&mutex);
+      printf("Access profile: %llu requests, hot ranges:\n", mergedTotal);
+      for (i = 0; (i < mergedTopCnt) && (i < maxLines); i++)
+      {
+         printf("  Slave %3d FC %2d address %5d count %4d: %10u requests (%.1f%%)\n",
+                getSlaveAddr(mergedTopArr[i].key), getFunctionCode(mergedTopArr[i].key),
+                getStartAddr(mergedTopArr[i].key), getRefCnt(mergedTopArr[i].key),
+                mergedTopArr[i].count,
+                mergedTotal ? 100.0 * mergedTopArr[i].count / mergedTotal : 0.0);
+      }
+      pthread_mutex_unlock(&mutex);
+   }
+
+
+   /**
+    * Writes the top accesses of the last merge() as a workload file. Each
+    * line holds slave address, function code, start address, count and
+    * the share of requests, so a master can replay the observed mix.
+    * Comment lines suggest a ProfileMbusDataTable instantiation covering
+    * the accessed ranges of each slave.
+    *
+    * @param fileName Name of the file to write
+    * @return 0 on success, -1 on error
+    */
+   int writeWorkload(const char *fileName)
+   {
+      FILE *filePtr;
+      int slaveAddr;
+      int i;
+
+      filePtr = fopen(fileName, "w");
+      if (filePtr == NULL)
+         return -1;
+      pthread_mutex_lock(&mutex);
+      fprintf(filePtr, "# diagslave access profile, %llu requests\n", mergedTotal);
+      for (slaveAddr = 0; slaveAddr < 256; slaveAddr++)
+         writeProfileSuggestion(filePtr, slaveAddr);
+      fprintf(filePtr, "slave,function,address,count,share\n");
+      for (i = 0; i < mergedTopCnt; i++)
+      {
+         fprintf(filePtr, "%d,%d,%d,%d,%.6f\n",
+                 getSlaveAddr(mergedTopArr[i].key), getFunctionCode(mergedTopArr[i].key),
+                 getStartAddr(mergedTopArr[i].key), getRefCnt(mergedTopArr[i].key),
+                 mergedTotal ? (double) mergedTopArr[i].count / mergedTotal : 0.0);
+      }
+      pthread_mutex_unlock(&mutex);
+      return fclose(filePtr) == 0 ? 0 : -1;
+   }
+
+
+  private:
+
+   struct TopEntry
+   {
+      unsigned long long key; ///< 0 if unused
+      unsigned int count;
+   };
+
+   struct ThreadSketch
+   {
+      unsigned int counterArr[SKETCH_DEPTH][SKETCH_WIDTH];
+      TopEntry topArr[TOP_CNT];
+      int topCnt;
+      unsigned long long total;
+   };
+
+   ThreadSketch **sketchPtrArr;
+   int maxSketchCnt;
+   int sketchCnt;
+   TopEntry mergedTopArr[TOP_CNT];
+   int mergedTopCnt;
+   unsigned long long mergedTotal;
+   pthread_mutex_t mutex;
+   pthread_key_t sketchKey;
+
+
+   /**
+    * Packs an access into a key. Bit 56 is set so no key is 0.
+    */
+   static unsigned long long makeKey(int slaveAddr, int fc, int startAddr, int refCnt)
+   {
+      return (1ULL << 56) | ((unsigned long long) (slaveAddr & 0xFF) << 48) |
+             ((unsigned long long) (fc & 0xFF) << 40) |
+             ((unsigned long long) (startAddr & 0xFFFF) << 16) |
+             (unsigned long long) (refCnt & 0xFFFF);
+   }
+
+   static int getSlaveAddr(unsigned long long key) { return (int) (key >> 48) & 0xFF; }
+   static int getFunctionCode(unsigned long long key) { return (int) (key >> 40) & 0xFF; }
+   static int getStartAddr(unsigned long long key) { return (int) (key >> 16) & 0xFFFF; }
+   static int getRefCnt(unsigned long long key) { return (int) key & 0xFFFF; }
+
+
+   /**
+    * Mixes a key into a hash, each row uses 16 bits of it (splitmix64).
+    */
+   static unsigned long long hashKey(unsigned long long key)
+   {
+      key += 0x9E3779B97F4A7C15ULL;
+      key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+      return key ^ (key >> 31);
+   }
+
+
+   static int compareTopEntries(const void *aPtr, const void *bPtr)
+   {
+      unsigned int a = ((const TopEntry *) aPtr)->count;
+      unsigned int b = ((const TopEntry *) bPtr)->count;
+
+      return a < b ? 1 : (a > b ? -1 : 0);
+   }
+
+
+   /**
+    * Updates the estimate of a key in a top list. A key which is not
+    * listed replaces the entry with the lowest count if its estimate is
+    * higher.
+    */
+   static void updateTop(TopEntry topArr[], int *topCntPtr, unsigned long long key,
+                         unsigned int estimate)
+   {
+      int minIdx = 0;
+      int i;
+
+      for (i = 0; i < *topCntPtr; i++)
+      {
+         if (topArr[i].key == key)
+         {
+            topArr[i].count = estimate;
+            return;
+         }
+         if (topArr[i].count < topArr[minIdx].count)
+            minIdx = i;
+      }
+      if (*topCntPtr < TOP_CNT)
+         minIdx = (*topCntPtr)++;
+      else
+         if (topArr[minIdx].count >= estimate)
+            return;
+      topArr[minIdx].count = estimate;
+      __atomic_store_n(&topArr[minIdx].key, key, __ATOMIC_RELAXED);
+   }
+
+
+   /**
+    * Estimates the count of a key from the sum of all thread sketches.
+    */
+   unsigned int estimateMerged(unsigned long long key)
+   {
+      unsigned long long hash = hashKey(key);
+      unsigned int estimate = 0xFFFFFFFF;
+      unsigned int sum;
+      int row;
+      int i;
+
+      for (row = 0; row < SKETCH_DEPTH; row++)
+      {
+         sum = 0;
+         for (i = 0; i < sketchCnt; i++)
+            sum += __atomic_load_n(&sketchPtrArr[i]->counterArr[row][
+                                      (hash >> (row * 16)) & (SKETCH_WIDTH - 1)],
+                                   __ATOMIC_RELAXED);
+         if (sum < estimate)
+            estimate = sum;
+      }
+      return estimate;
+   }
+
+
+   /**
+    * Allocates the sketch of the calling thread.
+    *
+    * @return Sketch or NULL if maxThreads is exceeded or out of memory
+    */
+   ThreadSketch *addThreadSketch()
+   {
+      ThreadSketch *sketchPtr = NULL;
+
+      pthread_mutex_lock(&mutex);
+      if (sketchCnt < maxSketchCnt)
+      {
+         sketchPtr = (ThreadSketch *) calloc(1, sizeof(ThreadSketch));
+         if (sketchPtr != NULL)
+         {
+            sketchPtrArr[sketchCnt++] = sketchPtr;
+            pthread_setspecific(sketchKey, sketchPtr);
+         }
+      }
+      pthread_mutex_unlock(&mutex);
+      return sketchPtr;
+   }
+
+
+   /**
+    * Writes a comment line suggesting a data table profile which covers
+    * all top accesses of a slave, nothing if the slave was not accessed.
+    */
+   void writeProfileSuggestion(FILE *filePtr, int slaveAddr)
+   {
+      int regCnt = 0;
+      int bitCnt = 0;
+      int accessMask = 0;
+      int endAddr;
+      int i;
+
+      for (i = 0; i < mergedTopCnt; i++)
+      {
+         if (getSlaveAddr(mergedTopArr[i].key) != slaveAddr)
+            continue;
+         endAddr = getStartAddr(mergedTopArr[i].key) + getRefCnt(mergedTopArr[i].key);
+         switch (getFunctionCode(mergedTopArr[i].key))
+         {
+            case 1: case 2:
+               accessMask |= 0x01; // PROFILE_READ_BITS
+               if (endAddr > bitCnt)
+                  bitCnt = endAddr;
+            break;
+            case 5: case 15:
+               accessMask |= 0x02; // PROFILE_WRITE_BITS
+               if (endAddr > bitCnt)
+                  bitCnt = endAddr;
+            break;
+            case 3: case 4:
+               accessMask |= 0x04; // PROFILE_READ_REGS
+               if (endAddr > regCnt)
+                  regCnt = endAddr;
+            break;
+            case 6: case 16:
+               accessMask |= 0x08; // PROFILE_WRITE_REGS
+               if (endAddr > regCnt)
+                  regCnt = endAddr;
+            break;
+            case 20: case 21:
+               accessMask |= 0x10; // PROFILE_FILE_RECORDS
+               if (endAddr > regCnt)
+                  regCnt = endAddr;
+            break;
+         }
+      }
+      if (accessMask != 0)
+         fprintf(filePtr, "# slave %d: ProfileMbusDataTable<%d, %d, 0x%02X, 0>\n",
+                 slaveAddr, regCnt > 0 ? regCnt : 1, bitCnt, accessMask);
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
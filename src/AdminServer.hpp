@@ -0,0 +1,355 @@
+/**
+ * @file AdminServer.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _ADMINSERVER_H_INCLUDED
+#define _ADMINSERVER_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+
+/*****************************************************************************
+ * AdminServer class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Serves a line based command protocol on a Unix domain socket.
+ *
+ * A request is one line of words separated by blanks. The words are passed
+ * to the command function, which writes response lines to a stream and
+ * returns an error message or NULL. The server then terminates the
+ * response with a line "OK" or "ERR message". A client may send further
+ * requests on the same connection.
+ *
+ * Requests are limited to MAX_REQUEST_SIZE bytes, enough for setting 64K
+ * registers in one request. Clients are served one at a time by a thread
+ * of its own. The socket is accessible by the owner only.
+ */
+class AdminServer
+{
+
+public:
+
+   enum
+   {
+      MAX_REQUEST_SIZE = 1024 * 1024 ///< Max length of a request line
+   };
+
+   /**
+    * Executes a request.
+    *
+    * @param argc Number of words
+    * @param argv Words
+    * @param rspFilePtr Stream for response lines
+    * @return NULL on success, else an error message
+    */
+   typedef const char *(*CommandFunc)(int argc, char *argv[], FILE *rspFilePtr);
+
+
+   AdminServer(CommandFunc commandFunc)
+   {
+      this->commandFunc = commandFunc;
+      listenFd = -1;
+      threadStarted = 0;
+      stopRequested = 0;
+      memset(&sockAddr, 0, sizeof(sockAddr));
+   }
+
+
+   ~AdminServer()
+   {
+      shutdown();
+   }
+
+
+   /**
+    * Creates the socket and starts serving it in a new thread. An existing
+    * socket file is replaced.
+    *
+    * @param pathName Path name of the socket
+    * @return 0 on success, -1 on error with errno set
+    */
+   int startup(const char *pathName)
+   {
+      sigset_t sigSet;
+      sigset_t oldSigSet;
+      int result;
+
+      if (strlen(pathName) >= sizeof(sockAddr.sun_path))
+      {
+         errno = ENAMETOOLONG;
+         return -1;
+      }
+      sockAddr.sun_family = AF_UNIX;
+      strcpy(sockAddr.sun_path, pathName);
+      listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listenFd < 0)
+         return -1;
+      unlink(pathName);
+      if ((bind(listenFd, (struct sockaddr *) &sockAddr, sizeof(sockAddr)) < 0) ||
+          (chmod(pathName, S_IRUSR | S_IWUSR) < 0) || (listen(listenFd, 4) < 0))
+      {
+         close(listenFd);
+         listenFd = -1;
+         return -1;
+      }
+
+      // The main thread shall receive the termination signals
+      sigemptyset(&sigSet);
+      sigaddset(&sigSet, SIGINT);
+      sigaddset(&sigSet, SIGTERM);
+      sigaddset(&sigSet, SIGUSR1);
+      pthread_sigmask(SIG_BLOCK, &sigSet, &oldSigSet);
+      result = pthread_create(&thread, NULL, threadFunc, this);
+      pthread_sigmask(SIG_SETMASK, &oldSigSet, NULL);
+      if (result != 0)
+      {
+         close(listenFd);
+         listenFd = -1;
+         errno = result;
+         return -1;
+      }
+      threadStarted = 1;
+      return 0;
+   }
+
+
+   /**
+    * Stops the thread and removes the socket.
+    */
+   void shutdown()
+   {
+      if (threadStarted)
+      {
+         __atomic_store_n(&stopRequested, 1, __ATOMIC_RELAXED);
+         pthread_join(thread, NULL);
+         threadStarted = 0;
+      }
+      if (listenFd >= 0)
+      {
+         close(listenFd);
+         listenFd = -1;
+         unlink(sockAddr.sun_path);
+      }
+   }
+
+
+   pthread_t getThread()
+   {
+      return thread;
+   }
+
+
+  private:
+
+   CommandFunc commandFunc;
+   struct sockaddr_un sockAddr;
+   int listenFd;
+   pthread_t thread;
+   int threadStarted;
+   int stopRequested;
+
+
+   static void *threadFunc(void *objPtr)
+   {
+      ((AdminServer *) objPtr)->run();
+      return NULL;
+   }
+
+
+   void run()
+   {
+      struct pollfd pollFd;
+      int fd;
+
+      pollFd.fd = listenFd;
+      pollFd.events = POLLIN;
+      while (!__atomic_load_n(&stopRequested, __ATOMIC_RELAXED))
+      {
+         if (poll(&pollFd, 1, 500) <= 0)
+            continue;
+         fd = accept(listenFd, NULL, NULL);
+         if (fd < 0)
+            continue;
+         serveConnection(fd);
+         close(fd);
+      }
+   }
+
+
+   /**
+    * Serves the requests of a connection until the client closes it.
+    * Responses are collected in memory and sent with MSG_NOSIGNAL, so a
+    * client going away mid-response only ends the connection.
+    */
+   void serveConnection(int fd)
+   {
+      struct pollfd pollFd;
+      char *bufPtr;
+      char *newBufPtr;
+      char *lineEndPtr;
+      char *scanPtr;
+      char *rspBufPtr;
+      size_t bufSize = 4096;
+      size_t len = 0;
+      size_t lineLen;
+      size_t rspLen;
+      ssize_t rxLen;
+      FILE *rspFilePtr;
+      int result;
+
+      bufPtr = (char *) malloc(bufSize);
+      if (bufPtr == NULL)
+         return;
+      pollFd.fd = fd;
+      pollFd.events = POLLIN;
+      while (!__atomic_load_n(&stopRequested, __ATOMIC_RELAXED))
+      {
+         if (poll(&pollFd, 1, 500) <= 0)
+            continue;
+         if (len + 1 >= bufSize)
+         {
+            if (bufSize >= MAX_REQUEST_SIZE)
+            {
+               sendAll(fd, "ERR Request too long\n", 21);
+               break;
+            }
+            newBufPtr = (char *) realloc(bufPtr, bufSize * 4);
+            if (newBufPtr == NULL)
+               break;
+            bufPtr = newBufPtr;
+            bufSize *= 4;
+         }
+         rxLen = read(fd, bufPtr + len, bufSize - len - 1);
+         if (rxLen <= 0)
+            break;
+         len += rxLen;
+         bufPtr[len] = '\0';
+
+         // Execute all complete lines, only the new data can end a line
+         rspFilePtr = open_memstream(&rspBufPtr, &rspLen);
+         if (rspFilePtr == NULL)
+            break;
+         scanPtr = bufPtr + len - rxLen;
+         while ((lineEndPtr = strchr(scanPtr, '\n')) != NULL)
+         {
+            *lineEndPtr = '\0';
+            executeRequest(bufPtr, rspFilePtr);
+            lineLen = lineEndPtr - bufPtr + 1;
+            len -= lineLen;
+            memmove(bufPtr, lineEndPtr + 1, len + 1);
+            scanPtr = bufPtr;
+         }
+         fclose(rspFilePtr);
+         result = sendAll(fd, rspBufPtr, rspLen);
+         free(rspBufPtr);
+         if (result != 0)
+            break;
+      }
+      free(bufPtr);
+   }
+
+
+   /**
+    * Sends a buffer completely.
+    *
+    * @return 0 on success, -1 if the client has gone
+    */
+   static int sendAll(int fd, const char *bufPtr, size_t len)
+   {
+      ssize_t txLen;
+
+      while (len > 0)
+      {
+         txLen = send(fd, bufPtr, len, MSG_NOSIGNAL);
+         if (txLen < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            return -1;
+         }
+         bufPtr += txLen;
+         len -= txLen;
+      }
+      return 0;
+   }
+
+
+   /**
+    * Splits a request into words and executes it.
+    */
+   void executeRequest(char *linePtr, FILE *rspFilePtr)
+   {
+      char **argv;
+      const char *errorPtr;
+      char *savePtr;
+      char *wordPtr;
+      int maxArgs = 1;
+      int argc = 0;
+      char *cPtr;
+
+      for (cPtr = linePtr; *cPtr != '\0'; cPtr++)
+      {
+         if ((*cPtr == ' ') || (*cPtr == '\t'))
+            maxArgs++;
+      }
+      argv = (char **) malloc((maxArgs + 1) * sizeof(char *));
+      if (argv == NULL)
+      {
+         fprintf(rspFilePtr, "ERR Out of memory\n");
+         return;
+      }
+      for (wordPtr = strtok_r(linePtr, " \t\r", &savePtr); wordPtr != NULL;
+           wordPtr = strtok_r(NULL, " \t\r", &savePtr))
+         argv[argc++] = wordPtr;
+      argv[argc] = NULL;
+      if (argc > 0)
+      {
+         errorPtr = commandFunc(argc, argv, rspFilePtr);
+         if (errorPtr == NULL)
+            fprintf(rspFilePtr, "OK\n");
+         else
+            fprintf(rspFilePtr, "ERR %s\n", errorPtr);
+      }
+      free(argv);
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
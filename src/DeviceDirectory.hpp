@@ -0,0 +1,664 @@
+/**
+ * @file DeviceDirectory.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _DEVICEDIRECTORY_H_INCLUDED
+#define _DEVICEDIRECTORY_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Package header
+#include "DiagnosticDataTable.hpp"
+
+
+/*****************************************************************************
+ * SparseMbusDataTable class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Data table of a virtual device which allocates memory only for
+ * data which has been written.
+ *
+ * The register space of 0x10000 registers is divided into pages of
+ * PAGE_REGS registers. A page is allocated on the first write to one of
+ * its registers, unallocated registers read as 0. Coils are bit packed and
+ * allocated on the first coil write. A device which has never been written
+ * to occupies sizeof(SparseMbusDataTable) bytes.
+ *
+ * Like DiagnosticMbusDataTable, input and holding registers share one bank
+ * and so do coils and discrete inputs. Accesses are not logged.
+ */
+class SparseMbusDataTable: public MbusDataTableInterface
+{
+
+public:
+
+   enum
+   {
+      REG_CNT = 0x10000, ///< Registers per device
+      BIT_CNT = 2000,    ///< Coils per device
+      PAGE_REGS = 64     ///< Registers per page
+   };
+
+
+   /**
+    * Constructs an empty table.
+    *
+    * @param slaveAddr Slave address, used for profiling and the exception
+    * status
+    */
+   SparseMbusDataTable(int slaveAddr)
+   {
+      this->slaveAddr = slaveAddr;
+      pageArr = NULL;
+      pageCnt = 0;
+      pageCap = 0;
+      coilArr = NULL;
+   }
+
+
+   ~SparseMbusDataTable()
+   {
+      int i;
+
+      for (i = 0; i < pageCnt; i++)
+         free(pageArr[i]);
+      free(pageArr);
+      free(coilArr);
+   }
+
+
+   /**
+    * Returns the memory occupied by this device in bytes.
+    */
+   size_t getMemoryUsage()
+   {
+      return sizeof(*this) + pageCap * sizeof(Page *) + pageCnt * sizeof(Page) +
+             (coilArr != NULL ? BIT_CNT / 8 : 0);
+   }
+
+
+   char readExceptionStatus()
+   {
+      MEASURE_SERVICE_TIME();
+      return (char) DiagnosticMbusDataTable::exceptionStatusArr[slaveAddr & 0xFF];
+   }
+
+
+   int readInputDiscretesTable(int startRef, char bitArr[], int refCnt)
+   {
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 2, startRef - 1, refCnt);
+      return readBits(startRef - 1, bitArr, refCnt);
+   }
+
+
+   int readCoilsTable(int startRef, char bitArr[], int refCnt)
+   {
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 1, startRef - 1, refCnt);
+      return readBits(startRef - 1, bitArr, refCnt);
+   }
+
+
+   int writeCoilsTable(int startRef, const char bitArr[], int refCnt)
+   {
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 15, startRef - 1, refCnt);
+      return writeBits(startRef - 1, bitArr, refCnt);
+   }
+
+
+   int readInputRegistersTable(int startRef, short regArr[], int refCnt)
+   {
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 4, startRef - 1, refCnt);
+      return readRegs(startRef - 1, regArr, refCnt);
+   }
+
+
+   int readHoldingRegistersTable(int startRef, short regArr[], int refCnt)
+   {
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 3, startRef - 1, refCnt);
+      return readRegs(startRef - 1, regArr, refCnt);
+   }
+
+
+   int writeHoldingRegistersTable(int startRef, const short regArr[], int refCnt)
+   {
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 16, startRef - 1, refCnt);
+      return writeRegs(startRef - 1, regArr, refCnt);
+   }
+
+
+   int readFileRecord(int refType, int fileNo, int startRef,
+                      short regArr[], int refCnt)
+   {
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 20, startRef, refCnt);
+      if ((refType != 6) || ((fileNo != 3) && (fileNo != 4)))
+         return 0;
+      return readRegs(startRef, regArr, refCnt);
+   }
+
+
+   int writeFileRecord(int refType, int fileNo, int startRef,
+                       short regArr[], int refCnt)
+   {
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 21, startRef, refCnt);
+      if ((refType != 6) || ((fileNo != 3) && (fileNo != 4)))
+         return 0;
+      return writeRegs(startRef, regArr, refCnt);
+   }
+
+
+   int getSlaveId(char bufferArr[], int maxBufSize)
+   {
+      strncpy(bufferArr, PRODUCT_NAME, maxBufSize);
+      return strlen(PRODUCT_NAME);
+   }
+
+
+   int getRunIndicatorStatus()
+   {
+      return 1; // 1 = running
+   }
+
+
+  private:
+
+   struct Page
+   {
+      int pageNo;
+      short regArr[PAGE_REGS];
+   };
+
+   int slaveAddr;
+   Page **pageArr;      ///< Allocated pages sorted by page number
+   int pageCnt;
+   int pageCap;
+   unsigned char *coilArr; ///< Bit packed coils or NULL if all 0
+
+
+   /**
+    * Looks up a page with binary search.
+    *
+    * @param pageNo Page number
+    * @return Index of the page or, if not allocated, -1 - index where it
+    * would have to be inserted
+    */
+   int findPage(int pageNo)
+   {
+      int lo = 0;
+      int hi = pageCnt - 1;
+      int mid;
+
+      while (lo <= hi)
+      {
+         mid = (lo + hi) / 2;
+         if (pageArr[mid]->pageNo == pageNo)
+            return mid;
+         if (pageArr[mid]->pageNo < pageNo)
+            lo = mid + 1;
+         else
+            hi = mid - 1;
+      }
+      return -1 - lo;
+   }
+
+
+   /**
+    * Returns a page, allocating it if required.
+    *
+    * @return Page or NULL if out of memory
+    */
+   Page *getPage(int pageNo)
+   {
+      Page *pagePtr;
+      Page **newArr;
+      int idx;
+
+      idx = findPage(pageNo);
+      if (idx >= 0)
+         return pageArr[idx];
+      idx = -1 - idx;
+      if (pageCnt == pageCap)
+      {
+         newArr = (Page **) realloc(pageArr, (pageCap + 4) * sizeof(Page *));
+         if (newArr == NULL)
+            return NULL;
+         pageArr = newArr;
+         pageCap += 4;
+      }
+      pagePtr = (Page *) calloc(1, sizeof(Page));
+      if (pagePtr == NULL)
+         return NULL;
+      pagePtr->pageNo = pageNo;
+      memmove(&pageArr[idx + 1], &pageArr[idx], (pageCnt - idx) * sizeof(Page *));
+      pageArr[idx] = pagePtr;
+      pageCnt++;
+      return pagePtr;
+   }
+
+
+   /**
+    * Reads registers, startRef is 0-based.
+    */
+   int readRegs(int startRef, short regArr[], int refCnt)
+   {
+      int pageNo;
+      int offs;
+      int cnt;
+      int idx;
+
+      if ((startRef < 0) || (startRef + refCnt > REG_CNT))
+         return 0;
+      while (refCnt > 0)
+      {
+         pageNo = startRef / PAGE_REGS;
+         offs = startRef % PAGE_REGS;
+         cnt = PAGE_REGS - offs;
+         if (cnt > refCnt)
+            cnt = refCnt;
+         idx = findPage(pageNo);
+         if (idx >= 0)
+            memcpy(regArr, &pageArr[idx]->regArr[offs], cnt * sizeof(short));
+         else
+            memset(regArr, 0, cnt * sizeof(short));
+         regArr += cnt;
+         startRef += cnt;
+         refCnt -= cnt;
+      }
+      return 1;
+   }
+
+
+   /**
+    * Writes registers, startRef is 0-based.
+    */
+   int writeRegs(int startRef, const short regArr[], int refCnt)
+   {
+      Page *pagePtr;
+      int offs;
+      int cnt;
+
+      if ((startRef < 0) || (startRef + refCnt > REG_CNT))
+         return 0;
+      while (refCnt > 0)
+      {
+         offs = startRef % PAGE_REGS;
+         cnt = PAGE_REGS - offs;
+         if (cnt > refCnt)
+            cnt = refCnt;
+         pagePtr = getPage(startRef / PAGE_REGS);
+         if (pagePtr == NULL)
+            return 0;
+         memcpy(&pagePtr->regArr[offs], regArr, cnt * sizeof(short));
+         regArr += cnt;
+         startRef += cnt;
+         refCnt -= cnt;
+      }
+      return 1;
+   }
+
+
+   /**
+    * Reads coils, startRef is 0-based.
+    */
+   int readBits(int startRef, char dstArr[], int refCnt)
+   {
+      int i;
+
+      if ((startRef < 0) || (startRef + refCnt > BIT_CNT))
+         return 0;
+      for (i = 0; i < refCnt; i++, startRef++)
+      {
+         if (coilArr != NULL)
+            dstArr[i] = (char) ((coilArr[startRef >> 3] >> (startRef & 7)) & 1);
+         else
+            dstArr[i] = 0;
+      }
+      return 1;
+   }
+
+
+   /**
+    * Writes coils, startRef is 0-based.
+    */
+   int writeBits(int startRef, const char srcArr[], int refCnt)
+   {
+      int i;
+
+      if ((startRef < 0) || (startRef + refCnt > BIT_CNT))
+         return 0;
+      if (coilArr == NULL)
+      {
+         coilArr = (unsigned char *) calloc(1, BIT_CNT / 8);
+         if (coilArr == NULL)
+            return 0;
+      }
+      for (i = 0; i < refCnt; i++, startRef++)
+      {
+         if (srcArr[i])
+            coilArr[startRef >> 3] |= (unsigned char) (1 << (startRef & 7));
+         else
+            coilArr[startRef >> 3] &= (unsigned char) ~(1 << (startRef & 7));
+      }
+      return 1;
+   }
+
+};
+
+
+/*****************************************************************************
+ * DeviceDirectory class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Directory of virtual devices keyed by port and unit ID.
+ *
+ * The directory is an open addressing hash table with linear probing.
+ * Devices are created on first access. If a maximum number of resident
+ * devices is set, the least recently used device is evicted when a new
+ * one is created. The victim is chosen with the clock algorithm: a sweep
+ * over the hash slots clears each device's referenced flag and evicts the
+ * first device found with the flag already clear. An evicted device loses
+ * its data, like a device which has been power cycled.
+ *
+ * The directory is not thread safe.
+ */
+class DeviceDirectory
+{
+
+public:
+
+   /**
+    * Constructs an empty directory.
+    *
+    * @param maxDevices Maximum number of resident devices, 0 = unlimited
+    */
+   DeviceDirectory(int maxDevices = 0)
+   {
+      this->maxDevices = maxDevices;
+      slotCnt = 0;
+      slotShift = 32;
+      slotArr = NULL;
+      deviceCnt = 0;
+      clockHand = 0;
+      memset(&stats, 0, sizeof(stats));
+      resize(1024);
+   }
+
+
+   ~DeviceDirectory()
+   {
+      unsigned int i;
+
+      for (i = 0; i < slotCnt; i++)
+         delete slotArr[i].devicePtr;
+      free(slotArr);
+   }
+
+
+   /**
+    * Returns the device of a port and unit ID, creating it if required.
+    *
+    * @param portIdx Index of the port the request was received on
+    * @param unitId Unit ID of the request
+    * @return Device or NULL if out of memory
+    */
+   SparseMbusDataTable *getDevice(int portIdx, int unitId)
+   {
+      unsigned int key = makeKey(portIdx, unitId);
+      unsigned int idx;
+
+      idx = findSlot(key);
+      if (slotArr[idx].devicePtr != NULL)
+      {
+         slotArr[idx].referenced = 1;
+         return slotArr[idx].devicePtr;
+      }
+
+      //
+      // Make room, then insert
+      //
+      if ((maxDevices > 0) && (deviceCnt >= maxDevices))
+      {
+         evictDevice();
+         idx = findSlot(key);
+      }
+      if ((unsigned int) (deviceCnt + 1) * 4 > slotCnt * 3)
+      {
+         if (!resize(slotCnt * 2))
+            return NULL;
+         idx = findSlot(key);
+      }
+      slotArr[idx].devicePtr = new SparseMbusDataTable(unitId);
+      slotArr[idx].key = key;
+      slotArr[idx].referenced = 1;
+      deviceCnt++;
+      stats.created++;
+      return slotArr[idx].devicePtr;
+   }
+
+
+   /**
+    * Returns the device of a port and unit ID if it is resident.
+    *
+    * @return Device or NULL if not resident
+    */
+   SparseMbusDataTable *findDevice(int portIdx, int unitId)
+   {
+      return slotArr[findSlot(makeKey(portIdx, unitId))].devicePtr;
+   }
+
+
+   /**
+    * Prints directory statistics on stdout.
+    */
+   void printStatistics()
+   {
+      size_t memUsage = slotCnt * sizeof(Slot);
+      unsigned int maxProbe = 0;
+      unsigned int probe;
+      unsigned int i;
+
+      for (i = 0; i < slotCnt; i++)
+      {
+         if (slotArr[i].devicePtr != NULL)
+         {
+            memUsage += slotArr[i].devicePtr->getMemoryUsage();
+            probe = ((i - hashKey(slotArr[i].key)) & (slotCnt - 1)) + 1;
+            if (probe > maxProbe)
+               maxProbe = probe;
+         }
+      }
+      printf("Device directory statistics: %d resident devices, %lu created, "
+             "%lu evicted, %u slots, max probe %u, %lu bytes",
+             deviceCnt, stats.created, stats.evicted, slotCnt, maxProbe,
+             (unsigned long) memUsage);
+      if (deviceCnt > 0)
+         printf(" (%lu per device)", (unsigned long) (memUsage / deviceCnt));
+      printf("\n");
+   }
+
+
+  private:
+
+   struct Slot
+   {
+      unsigned int key;
+      int referenced;
+      SparseMbusDataTable *devicePtr; ///< NULL if the slot is empty
+   };
+
+   struct Statistics
+   {
+      unsigned long created;
+      unsigned long evicted;
+   };
+
+   int maxDevices;
+   unsigned int slotCnt;   ///< Always a power of 2
+   int slotShift;          ///< 32 - log2(slotCnt)
+   Slot *slotArr;
+   int deviceCnt;
+   unsigned int clockHand;
+   Statistics stats;
+
+
+   static unsigned int makeKey(int portIdx, int unitId)
+   {
+      return ((unsigned int) portIdx << 8) | (unsigned int) (unitId & 0xFF);
+   }
+
+
+   /**
+    * Fibonacci hashing. The high bits of the product are taken because
+    * its low bits only depend on the low bits of the key, keys of one
+    * unit ID on many ports would otherwise share few home slots.
+    */
+   unsigned int hashKey(unsigned int key)
+   {
+      return (key * 2654435761U) >> slotShift;
+   }
+
+
+   /**
+    * Returns the slot holding a key or the empty slot ending its probe
+    * sequence.
+    */
+   unsigned int findSlot(unsigned int key)
+   {
+      unsigned int idx = hashKey(key);
+
+      while ((slotArr[idx].devicePtr != NULL) && (slotArr[idx].key != key))
+         idx = (idx + 1) & (slotCnt - 1);
+      return idx;
+   }
+
+
+   /**
+    * Rehashes all devices into a new slot array.
+    *
+    * @return 1 on success, 0 if out of memory
+    */
+   int resize(unsigned int newSlotCnt)
+   {
+      Slot *oldArr = slotArr;
+      unsigned int oldCnt = slotCnt;
+      unsigned int i;
+      unsigned int idx;
+
+      slotArr = (Slot *) calloc(newSlotCnt, sizeof(Slot));
+      if (slotArr == NULL)
+      {
+         slotArr = oldArr;
+         return 0;
+      }
+      slotCnt = newSlotCnt;
+      for (slotShift = 32; (1U << (32 - slotShift)) < slotCnt; slotShift--)
+         ;
+      for (i = 0; i < oldCnt; i++)
+      {
+         if (oldArr[i].devicePtr != NULL)
+         {
+            idx = findSlot(oldArr[i].key);
+            slotArr[idx] = oldArr[i];
+         }
+      }
+      free(oldArr);
+      clockHand = 0;
+      return 1;
+   }
+
+
+   /**
+    * Evicts the least recently used device, approximated by the clock
+    * algorithm.
+    */
+   void evictDevice()
+   {
+      for (;;)
+      {
+         clockHand = (clockHand + 1) & (slotCnt - 1);
+         if (slotArr[clockHand].devicePtr == NULL)
+            continue;
+         if (slotArr[clockHand].referenced)
+         {
+            slotArr[clockHand].referenced = 0;
+            continue;
+         }
+         removeSlot(clockHand);
+         stats.evicted++;
+         return;
+      }
+   }
+
+
+   /**
+    * Deletes the device of a slot. Following entries of the probe
+    * sequence are shifted back so that no tombstones are needed.
+    */
+   void removeSlot(unsigned int idx)
+   {
+      unsigned int nextIdx = idx;
+      unsigned int homeIdx;
+
+      delete slotArr[idx].devicePtr;
+      slotArr[idx].devicePtr = NULL;
+      deviceCnt--;
+      for (;;)
+      {
+         nextIdx = (nextIdx + 1) & (slotCnt - 1);
+         if (slotArr[nextIdx].devicePtr == NULL)
+            return;
+         homeIdx = hashKey(slotArr[nextIdx].key);
+
+         //
+         // The entry may move to the hole if its home slot is not
+         // cyclically within (idx, nextIdx]
+         //
+         if (((nextIdx - homeIdx) & (slotCnt - 1)) >= ((nextIdx - idx) & (slotCnt - 1)))
+         {
+            slotArr[idx] = slotArr[nextIdx];
+            slotArr[nextIdx].devicePtr = NULL;
+            idx = nextIdx;
+         }
+      }
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
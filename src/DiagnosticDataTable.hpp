@@ -38,6 +38,34 @@
 
 // Package header
 #include "MbusDataTableInterface.hpp"
+#include "DiagslaveShm.h"
+#ifndef _WIN32
+#  include "LatencyHistogram.hpp"
+#  include "AccessProfiler.hpp"
+#  include "RegisterHistory.hpp"
+#  include "DirtyRegisterMap.hpp"
+#  define MEASURE_SERVICE_TIME() \
+      LatencyTimer latencyTimer(DiagnosticMbusDataTable::serviceTimeHistPtr)
+#  define PROFILE_ACCESS(slaveAddr, fc, startAddr, refCnt) \
+      do { \
+         if (DiagnosticMbusDataTable::accessProfilerPtr != NULL) \
+            DiagnosticMbusDataTable::accessProfilerPtr->record(slaveAddr, fc, \
+                                                               startAddr, refCnt); \
+      } while (0)
+#  define RECORD_HISTORY(slaveAddr, startAddr, regArr, refCnt) \
+      do { \
+         if (DiagnosticMbusDataTable::dirtyRegisterMapPtr != NULL) \
+            DiagnosticMbusDataTable::dirtyRegisterMapPtr->markDirty(slaveAddr, startAddr, \
+                                                                    refCnt); \
+         else if (DiagnosticMbusDataTable::registerHistoryPtr != NULL) \
+            DiagnosticMbusDataTable::registerHistoryPtr->record(slaveAddr, startAddr, \
+                                                                regArr, refCnt); \
+      } while (0)
+#else
+#  define MEASURE_SERVICE_TIME()
+#  define PROFILE_ACCESS(slaveAddr, fc, startAddr, refCnt)
+#  define RECORD_HISTORY(slaveAddr, startAddr, regArr, refCnt)
+#endif
 
 
 /*****************************************************************************
@@ -53,6 +81,46 @@ char *USER_APPLICATION_NAME = "diagslave";
 char CUSTOM_OBJECT[100] = "Custom data 123";
 
 
+/*****************************************************************************
+ * AdminMbusDataTable class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Data table whose contents the admin interface can inspect and
+ * modify directly.
+ *
+ * Unlike the Modbus callbacks these methods apply no access restrictions
+ * and do not log, so input registers of a read-only table can be set.
+ * Addresses are 0-based. All methods return 1 on success and 0 if the
+ * range exceeds the table.
+ */
+class AdminMbusDataTable: public MbusDataTableInterface
+{
+
+public:
+
+   virtual ~AdminMbusDataTable() {}
+
+   virtual int getRegisterCount() = 0;
+
+   virtual int getCoilCount() = 0;
+
+   virtual int getRegisters(int startAddr, short regArr[], int refCnt) = 0;
+
+   virtual int setRegisters(int startAddr, const short regArr[], int refCnt) = 0;
+
+   virtual int getCoils(int startAddr, char bitArr[], int refCnt) = 0;
+
+   virtual int setCoils(int startAddr, const char bitArr[], int refCnt) = 0;
+
+   /**
+    * Sets all registers and coils to 0.
+    */
+   virtual void clear() = 0;
+
+};
+
+
 /*****************************************************************************
  * DiagnosticMbusDataTable class declaration
  *****************************************************************************/
@@ -73,28 +141,178 @@ char CUSTOM_OBJECT[100] = "Custom data 123";
  * @see MbusSlaveServer
  * @see mbusslave
  */
-class DiagnosticMbusDataTable: public MbusDataTableInterface
+class DiagnosticMbusDataTable: public AdminMbusDataTable
 {
 
 public:
 
-   DiagnosticMbusDataTable(int slaveAddr)
+   /**
+    * Constructs a data table.
+    *
+    * @param slaveAddr Slave address, used for logging
+    * @param slaveDataPtr Record in a shared memory segment holding the
+    * data or NULL to allocate private memory
+    */
+   DiagnosticMbusDataTable(int slaveAddr, DiagShmSlave *slaveDataPtr = NULL)
    {
       this->slaveAddr = slaveAddr;
-      memset(regData, 0, sizeof(regData));
-      memset(bitData, 0, sizeof(bitData));
+      if (slaveDataPtr == NULL)
+      {
+         dataPtr = new DiagShmSlave;
+         memset(dataPtr, 0, sizeof(*dataPtr));
+         ownsData = 1;
+      }
+      else
+      {
+         dataPtr = slaveDataPtr;
+         ownsData = 0;
+      }
    }
 
 
    ~DiagnosticMbusDataTable()
    {
+      if (ownsData)
+         delete dataPtr;
+   }
+
+
+   /**
+    * Copies a consistent image of the table's data, e.g. for a snapshot.
+    * The sequence counter of the copy is 0.
+    *
+    * @param dstPtr Destination record
+    */
+   void copyData(DiagShmSlave *dstPtr)
+   {
+      readData(dstPtr, dataPtr, sizeof(*dstPtr));
+      dstPtr->seq = 0;
+   }
+
+
+   /**
+    * Logs every data access on stdout if set, the default.
+    */
+   static volatile int logging;
+
+
+   /**
+    * Exception status returned by function 7, per slave address. Set to
+    * 0x55 for all slaves on start-up unless configured otherwise.
+    */
+   static unsigned char exceptionStatusArr[256];
+
+
+   int getRegisterCount()
+   {
+      return DIAG_SHM_REG_CNT;
+   }
+
+
+   int getCoilCount()
+   {
+      return DIAG_SHM_BIT_CNT;
+   }
+
+
+   int getRegisters(int startAddr, short regArr[], int refCnt)
+   {
+      if ((startAddr < 0) || (refCnt < 0) || (startAddr + refCnt > DIAG_SHM_REG_CNT))
+         return 0;
+      readData(regArr, &dataPtr->regData[startAddr], refCnt * sizeof(short));
+      return 1;
+   }
+
+
+   int setRegisters(int startAddr, const short regArr[], int refCnt)
+   {
+      if ((startAddr < 0) || (refCnt < 0) || (startAddr + refCnt > DIAG_SHM_REG_CNT))
+         return 0;
+      writeData(&dataPtr->regData[startAddr], regArr, refCnt * sizeof(short));
+      RECORD_HISTORY(slaveAddr, startAddr, regArr, refCnt);
+      return 1;
    }
 
 
+   int getCoils(int startAddr, char bitArr[], int refCnt)
+   {
+      if ((startAddr < 0) || (refCnt < 0) || (startAddr + refCnt > DIAG_SHM_BIT_CNT))
+         return 0;
+      readData(bitArr, &dataPtr->bitData[startAddr], refCnt);
+      return 1;
+   }
+
+
+   int setCoils(int startAddr, const char bitArr[], int refCnt)
+   {
+      if ((startAddr < 0) || (refCnt < 0) || (startAddr + refCnt > DIAG_SHM_BIT_CNT))
+         return 0;
+      writeData(&dataPtr->bitData[startAddr], bitArr, refCnt);
+      return 1;
+   }
+
+
+   void clear()
+   {
+      diagShmWriteBegin(dataPtr);
+      memset(dataPtr->regData, 0, sizeof(dataPtr->regData));
+      memset(dataPtr->bitData, 0, sizeof(dataPtr->bitData));
+      diagShmWriteEnd(dataPtr);
+   }
+
+
+#ifndef _WIN32
+   /**
+    * Histogram receiving the service time of every data access callback
+    * of all tables or NULL to not measure.
+    */
+   static LatencyHistogram *serviceTimeHistPtr;
+
+
+   /**
+    * Profiler receiving every data access of all tables or NULL to not
+    * profile.
+    */
+   static AccessProfiler *accessProfilerPtr;
+
+
+   /**
+    * History receiving every register write of all tables or NULL to not
+    * record.
+    */
+   static RegisterHistory *registerHistoryPtr;
+
+
+   /**
+    * Map receiving every register write of all tables or NULL to pass
+    * writes to the history one by one. The history is then fed with the
+    * coalesced writes when the map is flushed.
+    */
+   static DirtyRegisterMap *dirtyRegisterMapPtr;
+
+
+   /**
+    * Touches every page of the table's data with a write access, so
+    * serving a request never takes a page fault. Uses an atomic add of 0
+    * to not disturb a writer in another process.
+    */
+   void prefault()
+   {
+      char *bytePtr;
+
+      for (bytePtr = (char *) dataPtr; bytePtr < (char *) (dataPtr + 1);
+           bytePtr += 4096)
+         __sync_fetch_and_add(bytePtr, 0);
+   }
+#endif
+
+
    char readExceptionStatus()
    {
-      printf("\rSlave %3d: readExceptionStatus\n", slaveAddr);
-      return 0x55;
+      MEASURE_SERVICE_TIME();
+      if (logging)
+         printf("\rSlave %3d: readExceptionStatus\n", slaveAddr);
+      return (char) exceptionStatusArr[slaveAddr & 0xFF];
    }
 
 
@@ -102,8 +320,11 @@ public:
                                char bitArr[],
                                int refCnt)
    {
-      printf("\rSlave %3d: readInputDiscretes from %d, %d references\n",
-             slaveAddr, startRef, refCnt);
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 2, startRef - 1, refCnt);
+      if (logging)
+         printf("\rSlave %3d: readInputDiscretes from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
 
       // Adjust Modbus reference counting
       startRef--;
@@ -111,13 +332,13 @@ public:
       //
       // Validate range
       //
-      if (startRef + refCnt > int(sizeof(bitData) / sizeof(char)))
+      if (startRef + refCnt > int(sizeof(dataPtr->bitData)))
          return 0;
 
       //
       // Copy data
       //
-      memcpy(bitArr, &bitData[startRef], refCnt * sizeof(char));
+      readData(bitArr, &dataPtr->bitData[startRef], refCnt * sizeof(char));
       return 1;
    }
 
@@ -126,8 +347,11 @@ public:
                       char bitArr[],
                       int refCnt)
    {
-      printf("\rSlave %3d: readCoils from %d, %d references\n",
-             slaveAddr, startRef, refCnt);
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 1, startRef - 1, refCnt);
+      if (logging)
+         printf("\rSlave %3d: readCoils from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
 
       // Adjust Modbus reference counting
       startRef--;
@@ -135,13 +359,13 @@ public:
       //
       // Validate range
       //
-      if (startRef + refCnt > int(sizeof(bitData) / sizeof(char)))
+      if (startRef + refCnt > int(sizeof(dataPtr->bitData)))
          return 0;
 
       //
       // Copy data
       //
-      memcpy(bitArr, &bitData[startRef], refCnt * sizeof(char));
+      readData(bitArr, &dataPtr->bitData[startRef], refCnt * sizeof(char));
       return 1;
    }
 
@@ -150,8 +374,11 @@ public:
                        const char bitArr[],
                        int refCnt)
    {
-      printf("\rSlave %3d: writeCoils from %d, %d references\n",
-             slaveAddr, startRef, refCnt);
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 15, startRef - 1, refCnt);
+      if (logging)
+         printf("\rSlave %3d: writeCoils from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
 
       // Adjust Modbus reference counting
       startRef--;
@@ -159,13 +386,13 @@ public:
       //
       // Validate range
       //
-      if (startRef + refCnt > int(sizeof(bitData) / sizeof(char)))
+      if (startRef + refCnt > int(sizeof(dataPtr->bitData)))
          return 0;
 
       //
       // Copy data
       //
-      memcpy(&bitData[startRef], bitArr, refCnt * sizeof(char));
+      writeData(&dataPtr->bitData[startRef], bitArr, refCnt * sizeof(char));
       return 1;
    }
 
@@ -174,8 +401,11 @@ public:
                                short regArr[],
                                int refCnt)
    {
-      printf("\rSlave %3d: readInputRegisters from %d, %d references\n",
-             slaveAddr, startRef, refCnt);
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 4, startRef - 1, refCnt);
+      if (logging)
+         printf("\rSlave %3d: readInputRegisters from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
 
       // Adjust Modbus reference counting
       startRef--;
@@ -183,13 +413,13 @@ public:
       //
       // Validate range
       //
-      if (startRef + refCnt > int(sizeof(regData) / sizeof(short)))
+      if (startRef + refCnt > int(sizeof(dataPtr->regData) / sizeof(short)))
          return 0;
 
       //
       // Copy data
       //
-      memcpy(regArr, &regData[startRef], refCnt * sizeof(short));
+      readData(regArr, &dataPtr->regData[startRef], refCnt * sizeof(short));
       return 1;
    }
 
@@ -198,8 +428,11 @@ public:
                                  short regArr[],
                                  int refCnt)
    {
-      printf("\rSlave %3d: readHoldingRegisters from %d, %d references\n",
-             slaveAddr, startRef, refCnt);
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 3, startRef - 1, refCnt);
+      if (logging)
+         printf("\rSlave %3d: readHoldingRegisters from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
 
       // Adjust Modbus reference counting
       startRef--;
@@ -207,13 +440,13 @@ public:
       //
       // Validate range
       //
-      if (startRef + refCnt > int(sizeof(regData) / sizeof(short)))
+      if (startRef + refCnt > int(sizeof(dataPtr->regData) / sizeof(short)))
          return 0;
 
       //
       // Copy data
       //
-      memcpy(regArr, &regData[startRef], refCnt * sizeof(short));
+      readData(regArr, &dataPtr->regData[startRef], refCnt * sizeof(short));
       return 1;
    }
 
@@ -222,8 +455,11 @@ public:
                                   const short regArr[],
                                   int refCnt)
    {
-      printf("\rSlave %3d: writeHoldingRegisters from %d, %d references\n",
-             slaveAddr, startRef, refCnt);
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 16, startRef - 1, refCnt);
+      if (logging)
+         printf("\rSlave %3d: writeHoldingRegisters from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
 
       // Adjust Modbus reference counting
       startRef--;
@@ -231,13 +467,14 @@ public:
       //
       // Validate range
       //
-      if (startRef + refCnt > int(sizeof(regData) / sizeof(short)))
+      if (startRef + refCnt > int(sizeof(dataPtr->regData) / sizeof(short)))
          return 0;
 
       //
       // Copy data
       //
-      memcpy(&regData[startRef], regArr, refCnt * sizeof(short));
+      writeData(&dataPtr->regData[startRef], regArr, refCnt * sizeof(short));
+      RECORD_HISTORY(slaveAddr, startRef, regArr, refCnt);
       return 1;
    }
 
@@ -245,8 +482,11 @@ public:
    int readFileRecord(int refType, int fileNo, int startRef,
                       short regArr[], int refCnt)
    {
-      printf("\rSlave %3d: readFileRecord type %d, file %d from %d, %d references\n",
-             slaveAddr, refType, fileNo, startRef, refCnt);
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 20, startRef, refCnt);
+      if (logging)
+         printf("\rSlave %3d: readFileRecord type %d, file %d from %d, %d references\n",
+                slaveAddr, refType, fileNo, startRef, refCnt);
 
       //
       // Only reference type 6 is supported in this example. Please note
@@ -266,13 +506,13 @@ public:
       //
       // Validate range
       //
-      if (startRef + refCnt > int(sizeof(regData) / sizeof(short)))
+      if (startRef + refCnt > int(sizeof(dataPtr->regData) / sizeof(short)))
          return 0;
 
       //
       // Copy data
       //
-      memcpy(regArr, &regData[startRef], refCnt * sizeof(short));
+      readData(regArr, &dataPtr->regData[startRef], refCnt * sizeof(short));
       return 1;
    }
 
@@ -280,8 +520,11 @@ public:
    int writeFileRecord(int refType, int fileNo, int startRef,
                        short regArr[], int refCnt)
    {
-      printf("\rSlave %3d: writeFileRecord type %d, file %d from %d, %d references\n",
-             slaveAddr, refType, fileNo, startRef, refCnt);
+      MEASURE_SERVICE_TIME();
+      PROFILE_ACCESS(slaveAddr, 21, startRef, refCnt);
+      if (logging)
+         printf("\rSlave %3d: writeFileRecord type %d, file %d from %d, %d references\n",
+                slaveAddr, refType, fileNo, startRef, refCnt);
 
       //
       // Only reference type 6 is supported in this example. Please note
@@ -301,13 +544,14 @@ public:
       //
       // Validate range
       //
-      if (startRef + refCnt > int(sizeof(regData) / sizeof(short)))
+      if (startRef + refCnt > int(sizeof(dataPtr->regData) / sizeof(short)))
          return 0;
 
       //
       // Copy data
       //
-      memcpy(&regData[startRef], regArr, refCnt * sizeof(short));
+      writeData(&dataPtr->regData[startRef], regArr, refCnt * sizeof(short));
+      RECORD_HISTORY(slaveAddr, startRef, regArr, refCnt);
       return 1;
    }
 
@@ -325,7 +569,8 @@ public:
 
    int getRunIndicatorStatus()
    {
-      printf("\rSlave %3d: reportSlaveId\n", slaveAddr);
+      if (logging)
+         printf("\rSlave %3d: reportSlaveId\n", slaveAddr);
       return 1; // 1 = running
    }
 
@@ -340,7 +585,8 @@ public:
          case 0:
             if (bufferArr)
             {
-               printf("\rSlave %3d: getDeviceIdObject VendorName\n", slaveAddr);
+               if (logging)
+                  printf("\rSlave %3d: getDeviceIdObject VendorName\n", slaveAddr);
 #ifdef HAS_STRNCPY
                strncpy(bufferArr, VENDOR_NAME, maxBufSize);
 #else
@@ -355,7 +601,8 @@ public:
          case 1:
             if (bufferArr)
             {
-               printf("\rSlave %3d: getDeviceIdObject ProductCode\n", slaveAddr);
+               if (logging)
+                  printf("\rSlave %3d: getDeviceIdObject ProductCode\n", slaveAddr);
 #ifdef HAS_STRNCPY
                strncpy(bufferArr, PRODUCT_CODE, maxBufSize);
 #else
@@ -370,7 +617,8 @@ public:
          case 2:
             if (bufferArr)
             {
-               printf("\rSlave %3d: getDeviceIdObject MajorMinorRevision\n", slaveAddr);
+               if (logging)
+                  printf("\rSlave %3d: getDeviceIdObject MajorMinorRevision\n", slaveAddr);
 #ifdef HAS_STRNCPY
                strncpy(bufferArr, MbusSlaveServer::getPackageVersion(), maxBufSize);
 #else
@@ -385,7 +633,8 @@ public:
          case 3:
             if (bufferArr)
             {
-               printf("\rSlave %3d: getDeviceIdObject VendorUrl\n", slaveAddr);
+               if (logging)
+                  printf("\rSlave %3d: getDeviceIdObject VendorUrl\n", slaveAddr);
 #ifdef HAS_STRNCPY
                strncpy(bufferArr, VENDOR_URL, maxBufSize);
 #else
@@ -400,7 +649,8 @@ public:
          case 4:
             if (bufferArr)
             {
-               printf("\rSlave %3d: getDeviceIdObject ProductName\n", slaveAddr);
+               if (logging)
+                  printf("\rSlave %3d: getDeviceIdObject ProductName\n", slaveAddr);
 #ifdef HAS_STRNCPY
                strncpy(bufferArr, PRODUCT_NAME, maxBufSize);
 #else
@@ -415,7 +665,8 @@ public:
          case 5:
             if (bufferArr)
             {
-               printf("\rSlave %3d: getDeviceIdObject ModelName\n", slaveAddr);
+               if (logging)
+                  printf("\rSlave %3d: getDeviceIdObject ModelName\n", slaveAddr);
 #ifdef HAS_STRNCPY
                strncpy(bufferArr, MODEL_NAME, maxBufSize);
 #else
@@ -430,7 +681,8 @@ public:
          case 6:
             if (bufferArr)
             {
-               printf("\rSlave %3d: getDeviceIdObject UserApplicationName\n", slaveAddr);
+               if (logging)
+                  printf("\rSlave %3d: getDeviceIdObject UserApplicationName\n", slaveAddr);
 #ifdef HAS_STRNCPY
                strncpy(bufferArr, USER_APPLICATION_NAME, maxBufSize);
 #else
@@ -445,7 +697,8 @@ public:
          case 128:
             if (bufferArr)
             {
-               printf("\rSlave %3d: getDeviceIdObject CustomObject 128\n", slaveAddr);
+               if (logging)
+                  printf("\rSlave %3d: getDeviceIdObject CustomObject 128\n", slaveAddr);
                memcpy(bufferArr, CUSTOM_OBJECT, sizeof(CUSTOM_OBJECT));
             }
          return sizeof(CUSTOM_OBJECT);
@@ -457,10 +710,48 @@ public:
   private:
 
    int slaveAddr;
-   short regData[0x10000];
-   char bitData[2000];
+   DiagShmSlave *dataPtr;
+   int ownsData;
+
+
+   /**
+    * Copies data out of the table under the slave's sequence lock, so a
+    * concurrent writer in another thread or process is never observed
+    * half way.
+    */
+   void readData(void *dstPtr, const void *srcPtr, size_t len)
+   {
+      uint32_t seq;
+
+      do
+      {
+         seq = diagShmReadBegin(dataPtr);
+         memcpy(dstPtr, srcPtr, len);
+      } while (diagShmReadRetry(dataPtr, seq));
+   }
+
+
+   /**
+    * Copies data into the table under the slave's sequence lock.
+    */
+   void writeData(void *dstPtr, const void *srcPtr, size_t len)
+   {
+      diagShmWriteBegin(dataPtr);
+      memcpy(dstPtr, srcPtr, len);
+      diagShmWriteEnd(dataPtr);
+   }
 
 };
 
 
+volatile int DiagnosticMbusDataTable::logging = 1;
+unsigned char DiagnosticMbusDataTable::exceptionStatusArr[256];
+#ifndef _WIN32
+LatencyHistogram *DiagnosticMbusDataTable::serviceTimeHistPtr = NULL;
+AccessProfiler *DiagnosticMbusDataTable::accessProfilerPtr = NULL;
+RegisterHistory *DiagnosticMbusDataTable::registerHistoryPtr = NULL;
+DirtyRegisterMap *DiagnosticMbusDataTable::dirtyRegisterMapPtr = NULL;
+#endif
+
+
 #endif // ifdef ..._H_INCLUDED
@@ -0,0 +1,253 @@
+/**
+ * @file DiagslaveShm.h
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _DIAGSLAVESHM_H_INCLUDED
+#define _DIAGSLAVESHM_H_INCLUDED
+
+
+/**
+ * @page shmlayout Shared memory data table layout
+ *
+ * With the -M option diagslave places the data tables of all 256 slave
+ * addresses in a named POSIX shared memory segment (see shm_open()). Other
+ * processes may map the segment and read or write registers and coils
+ * directly while diagslave serves masters from the same memory. This
+ * header is plain C so it can be used by such processes.
+ *
+ * The segment consists of a DiagShmHeader followed by 256 DiagShmSlave
+ * records, indexed by slave address. All structures are aligned to
+ * 64 byte cache lines. Register values are stored in host byte order.
+ *
+ * Each slave record is guarded by a sequence lock:
+ *
+ * - The sequence counter is even while the record is stable and odd while
+ *   a writer is modifying it.
+ * - A writer makes the counter odd with a compare-and-swap from an even
+ *   value, which also excludes other writers, modifies the data and then
+ *   increments the counter to the next even value. Use
+ *   diagShmWriteBegin() and diagShmWriteEnd().
+ * - A reader never blocks a writer. It samples the counter, copies the
+ *   data and retries if the counter was odd or has changed. Use
+ *   diagShmReadBegin() and diagShmReadRetry().
+ *
+ * A process which terminates between diagShmWriteBegin() and
+ * diagShmWriteEnd() leaves the record locked. Keep write sections short
+ * and free of calls which may fail.
+ *
+ * diagslave does not remove the segment on exit, so register values
+ * survive a restart. Remove it with shm_unlink() or by deleting the file
+ * in /dev/shm on Linux.
+ */
+
+
+// Platform header
+#include <stdint.h>
+
+
+/*****************************************************************************
+ * Layout constants
+ *****************************************************************************/
+
+#define DIAG_SHM_MAGIC     0x444C5344UL ///< "DSLD" in host byte order
+#define DIAG_SHM_VERSION   1            ///< Incremented on layout changes
+#define DIAG_SHM_SLAVE_CNT 256          ///< Slave records in the segment
+#define DIAG_SHM_REG_CNT   0x10000      ///< Registers per slave
+#define DIAG_SHM_BIT_CNT   2000         ///< Coils per slave
+
+
+/*****************************************************************************
+ * Layout structures
+ *****************************************************************************/
+
+/**
+ * Segment header, located at offset 0. All size fields allow a consumer to
+ * verify that it was compiled against the same layout.
+ */
+typedef struct
+{
+   uint32_t magic;       ///< DIAG_SHM_MAGIC once initialised
+   uint32_t version;     ///< DIAG_SHM_VERSION
+   uint32_t headerSize;  ///< sizeof(DiagShmHeader)
+   uint32_t slaveSize;   ///< sizeof(DiagShmSlave)
+   uint32_t slaveCnt;    ///< DIAG_SHM_SLAVE_CNT
+   uint32_t regCnt;      ///< DIAG_SHM_REG_CNT
+   uint32_t bitCnt;      ///< DIAG_SHM_BIT_CNT
+   uint32_t serverPid;   ///< Process ID of the diagslave which created it
+   uint32_t reserved[8];
+} DiagShmHeader;
+
+
+/**
+ * Data of one slave address. Register and coil arrays are shared by all
+ * function codes, like the private data tables of diagslave: input and
+ * holding registers map to regData, coils and discrete inputs to bitData.
+ * Element 0 corresponds to Modbus reference 1.
+ */
+typedef struct
+{
+   volatile uint32_t seq;             ///< Sequence lock counter
+   uint32_t reserved1[15];
+   int16_t regData[DIAG_SHM_REG_CNT]; ///< Registers
+   uint8_t bitData[DIAG_SHM_BIT_CNT]; ///< Coils, one byte per coil (0 or 1)
+   uint8_t reserved2[48];
+} DiagShmSlave;
+
+
+/**
+ * Returns the size of a complete segment in bytes.
+ */
+#define DIAG_SHM_SIZE \
+   (sizeof(DiagShmHeader) + DIAG_SHM_SLAVE_CNT * sizeof(DiagShmSlave))
+
+
+/**
+ * Returns a pointer to the record of a slave address.
+ */
+#define DIAG_SHM_SLAVE(headerPtr, slaveAddr) \
+   ((DiagShmSlave *) ((char *) (headerPtr) + sizeof(DiagShmHeader)) + (slaveAddr))
+
+
+/*****************************************************************************
+ * Sequence lock
+ *****************************************************************************/
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+   // MSVC gives volatile accesses acquire and release semantics
+#  define DIAG_SHM_LOAD_ACQUIRE(p)  (*(p))
+#  define DIAG_SHM_STORE_RELEASE(p, v) (*(p) = (v))
+#  define DIAG_SHM_CAS(p, o, n) \
+      (_InterlockedCompareExchange((volatile long *) (p), (long) (n), (long) (o)) == (long) (o))
+#  define DIAG_SHM_FENCE_ACQUIRE() _ReadWriteBarrier()
+#  define DIAG_SHM_FENCE_RELEASE() _ReadWriteBarrier()
+#else
+#  define DIAG_SHM_LOAD_ACQUIRE(p)  __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#  define DIAG_SHM_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#  define DIAG_SHM_CAS(p, o, n) \
+      __sync_bool_compare_and_swap((p), (o), (n))
+#  define DIAG_SHM_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#  define DIAG_SHM_FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+
+/**
+ * Acquires a sequence lock for writing. Spins while another writer holds
+ * the lock. The slave record functions below are built on these, tables
+ * with private memory use them for their own counter.
+ */
+static inline void diagShmSeqWriteBegin(volatile uint32_t *seqPtr)
+{
+   uint32_t seq;
+
+   for (;;)
+   {
+      seq = *seqPtr;
+      if (!(seq & 1) && DIAG_SHM_CAS(seqPtr, seq, seq + 1))
+         break;
+   }
+   DIAG_SHM_FENCE_RELEASE();
+}
+
+
+/**
+ * Releases a sequence lock acquired with diagShmSeqWriteBegin().
+ */
+static inline void diagShmSeqWriteEnd(volatile uint32_t *seqPtr)
+{
+   DIAG_SHM_STORE_RELEASE(seqPtr, *seqPtr + 1);
+}
+
+
+/**
+ * Starts a read under a sequence lock.
+ *
+ * @return Sequence value to be passed to diagShmSeqReadRetry()
+ */
+static inline uint32_t diagShmSeqReadBegin(const volatile uint32_t *seqPtr)
+{
+   uint32_t seq;
+
+   while ((seq = DIAG_SHM_LOAD_ACQUIRE(seqPtr)) & 1)
+      ;
+   return seq;
+}
+
+
+/**
+ * Checks if data read since diagShmSeqReadBegin() may be inconsistent.
+ *
+ * @return Non-zero if the read must be repeated
+ */
+static inline int diagShmSeqReadRetry(const volatile uint32_t *seqPtr, uint32_t seq)
+{
+   DIAG_SHM_FENCE_ACQUIRE();
+   return *seqPtr != seq;
+}
+
+
+/**
+ * Acquires a slave record for writing. Spins while another writer holds
+ * the record.
+ */
+static inline void diagShmWriteBegin(DiagShmSlave *slavePtr)
+{
+   diagShmSeqWriteBegin(&slavePtr->seq);
+}
+
+
+/**
+ * Releases a slave record acquired with diagShmWriteBegin().
+ */
+static inline void diagShmWriteEnd(DiagShmSlave *slavePtr)
+{
+   diagShmSeqWriteEnd(&slavePtr->seq);
+}
+
+
+/**
+ * Starts a read of a slave record.
+ *
+ * @return Sequence value to be passed to diagShmReadRetry()
+ */
+static inline uint32_t diagShmReadBegin(const DiagShmSlave *slavePtr)
+{
+   return diagShmSeqReadBegin(&slavePtr->seq);
+}
+
+
+/**
+ * Checks if data read since diagShmReadBegin() may be inconsistent.
+ *
+ * @return Non-zero if the read must be repeated
+ */
+static inline int diagShmReadRetry(const DiagShmSlave *slavePtr, uint32_t seq)
+{
+   return diagShmSeqReadRetry(&slavePtr->seq, seq);
+}
+
+
+#endif // ifdef ..._H_INCLUDED
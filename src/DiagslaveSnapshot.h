@@ -0,0 +1,106 @@
+/**
+ * @file DiagslaveSnapshot.h
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _DIAGSLAVESNAPSHOT_H_INCLUDED
+#define _DIAGSLAVESNAPSHOT_H_INCLUDED
+
+
+/**
+ * @page snapshotlayout Snapshot file layout
+ *
+ * A snapshot holds the complete state of a diagslave instance. It starts
+ * with an image of the shared memory segment described in @ref shmlayout,
+ * so the data tables of a snapshot can be used in place after mapping the
+ * file. A DiagSnapshotInfo record with the identification objects and the
+ * configuration follows at offset DIAG_SHM_SIZE.
+ *
+ * diagslave maps a snapshot with MAP_PRIVATE: pages are shared with the
+ * page cache and with forked clones until a master writes to them.
+ */
+
+
+// Package header
+#include "DiagslaveShm.h"
+
+
+/*****************************************************************************
+ * Layout constants
+ *****************************************************************************/
+
+#define DIAG_SNAP_MAGIC    0x504E5344UL ///< "DSNP" in host byte order
+#define DIAG_SNAP_VERSION  1            ///< Incremented on layout changes
+
+
+/*****************************************************************************
+ * Layout structures
+ *****************************************************************************/
+
+/**
+ * Identification and configuration, located at offset DIAG_SHM_SIZE.
+ * Strings are NUL terminated.
+ */
+typedef struct
+{
+   uint32_t magic;        ///< DIAG_SNAP_MAGIC
+   uint32_t version;      ///< DIAG_SNAP_VERSION
+   uint32_t infoSize;     ///< sizeof(DiagSnapshotInfo)
+   int32_t protocol;      ///< Protocol as selected with -m
+   int32_t address;       ///< Slave address, -1 for all
+   int32_t port;          ///< TCP or UDP port
+   int32_t timeOut;       ///< Master activity time-out in ms
+   int32_t connectionTo;  ///< Connection time-out in ms
+   int32_t baudRate;
+   int32_t dataBits;
+   int32_t stopBits;
+   int32_t parity;
+   uint32_t reserved[4];
+   char portName[64];            ///< Serial port, empty for network protocols
+   char vendorName[64];          ///< Device identification object 0
+   char productCode[64];         ///< Device identification object 1
+   char vendorUrl[128];          ///< Device identification object 3
+   char productName[64];         ///< Device identification object 4
+   char modelName[64];           ///< Device identification object 5
+   char userApplicationName[64]; ///< Device identification object 6
+   char customObject[100];       ///< Device identification object 128
+   char reserved2[28];
+} DiagSnapshotInfo;
+
+
+/**
+ * Returns the size of a snapshot file in bytes.
+ */
+#define DIAG_SNAP_SIZE (DIAG_SHM_SIZE + sizeof(DiagSnapshotInfo))
+
+
+/**
+ * Returns a pointer to the info record of a mapped snapshot.
+ */
+#define DIAG_SNAP_INFO(headerPtr) \
+   ((DiagSnapshotInfo *) ((char *) (headerPtr) + DIAG_SHM_SIZE))
+
+
+#endif // ifdef ..._H_INCLUDED
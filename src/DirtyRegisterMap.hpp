@@ -0,0 +1,279 @@
+/**
+ * @file DirtyRegisterMap.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _DIRTYREGISTERMAP_H_INCLUDED
+#define _DIRTYREGISTERMAP_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+/*****************************************************************************
+ * DirtyRegisterMap class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Records which holding registers were written since the last
+ * flush, so consumers of writes work on merged ranges rather than on
+ * every single write.
+ *
+ * Each slave has a bitmap with one bit per register and two levels of
+ * summary words above it, bit n of a summary word being set if word n of
+ * the level below is non-zero. A write sets the bits of its registers,
+ * repeated writes to the same range between two flushes are so coalesced
+ * for free. flush() starts a new epoch: it takes the bits set so far and
+ * passes runs of adjacent dirty registers to the consumer, which reads
+ * their current values from the table. The bitmaps are allocated zeroed
+ * in one block, pages of slaves never written are not touched.
+ *
+ * Any number of threads may mark writes, flush() must only be called by
+ * one thread at a time. A write racing with a flush is reported in the
+ * current or the next epoch, never lost.
+ */
+class DirtyRegisterMap
+{
+
+public:
+
+   enum
+   {
+      WORD_CNT = 0x10000 / 64,          ///< Bitmap words per slave
+      SUMMARY_CNT = WORD_CNT / 64       ///< Summary words per slave
+   };
+
+
+   /**
+    * Consumer of a dirty range, addresses are 0-based.
+    */
+   typedef void (*FlushFunc)(int slaveAddr, int startAddr, int regCnt);
+
+
+   DirtyRegisterMap()
+   {
+      slaveArr = (Slave *) calloc(256, sizeof(Slave));
+      memset(slaveMaskArr, 0, sizeof(slaveMaskArr));
+      epoch = 0;
+      rangeCnt = 0;
+      regCnt = 0;
+   }
+
+
+   ~DirtyRegisterMap()
+   {
+      free(slaveArr);
+   }
+
+
+   /**
+    * Returns 1 if the bitmaps could be allocated, 0 if out of memory.
+    */
+   int isValid()
+   {
+      return slaveArr != NULL;
+   }
+
+
+   /**
+    * Marks a range of registers as written. Must be called after the new
+    * values are stored in the table.
+    *
+    * @param slaveAddr Slave address
+    * @param startAddr Start address, 0-based as on the wire
+    * @param refCnt Number of registers
+    */
+   void markDirty(int slaveAddr, int startAddr, int refCnt)
+   {
+      Slave *slavePtr = &slaveArr[slaveAddr & 0xFF];
+      int endAddr = startAddr + refCnt - 1;
+      int word;
+      uint64_t bits;
+
+      if ((refCnt <= 0) || (startAddr < 0) || (endAddr > 0xFFFF))
+         return;
+      for (word = startAddr / 64; word <= endAddr / 64; word++)
+      {
+         bits = ~(uint64_t) 0;
+         if (word == startAddr / 64)
+            bits &= ~(uint64_t) 0 << (startAddr % 64);
+         if (word == endAddr / 64)
+            bits &= ~(uint64_t) 0 >> (63 - endAddr % 64);
+         // The register bits always take an atomic OR, it orders the data
+         // before the flush which clears them
+         __atomic_fetch_or(&slavePtr->wordArr[word], bits, __ATOMIC_SEQ_CST);
+         setSummaryBit(&slavePtr->summaryArr[word / 64], word % 64);
+         setSummaryBit(&slavePtr->top, word / 64);
+      }
+      setSummaryBit(&slaveMaskArr[(slaveAddr & 0xFF) / 64], slaveAddr % 64);
+   }
+
+
+   /**
+    * Ends the current epoch and passes the dirty ranges of all slaves in
+    * ascending order to a consumer. Adjacent dirty registers are merged
+    * into one range.
+    *
+    * @param flushFunc Consumer of the ranges
+    * @return Number of ranges flushed
+    */
+   int flush(FlushFunc flushFunc)
+   {
+      uint64_t mask;
+      int cnt = 0;
+      int i;
+
+      for (i = 0; i < 4; i++)
+      {
+         mask = __atomic_exchange_n(&slaveMaskArr[i], 0, __ATOMIC_SEQ_CST);
+         while (mask != 0)
+         {
+            cnt += flushSlave(i * 64 + __builtin_ctzll(mask), flushFunc);
+            mask &= mask - 1;
+         }
+      }
+      epoch++;
+      return cnt;
+   }
+
+
+   /**
+    * Returns the number of completed flushes.
+    */
+   unsigned long getEpoch()
+   {
+      return epoch;
+   }
+
+
+   void printStatistics()
+   {
+      printf("Write coalescing: %lu flush epochs, %lu ranges of %lu registers flushed\n",
+             epoch, rangeCnt, regCnt);
+   }
+
+
+  private:
+
+   struct Slave
+   {
+      uint64_t top;                     ///< Bit n set if summaryArr[n] is non-zero
+      uint64_t summaryArr[SUMMARY_CNT]; ///< Bit n set if word 64 * i + n is non-zero
+      uint64_t wordArr[WORD_CNT];       ///< One bit per register
+   };
+
+   Slave *slaveArr;
+   uint64_t slaveMaskArr[4];            ///< One bit per slave with dirty registers
+   unsigned long epoch;
+   unsigned long rangeCnt;
+   unsigned long regCnt;
+
+
+   /**
+    * Sets a summary bit unless set already. Summary bits are written far
+    * more rarely than they are tested, so a steady writer only reads them.
+    */
+   static void setSummaryBit(uint64_t *wordPtr, int bit)
+   {
+      uint64_t bits = (uint64_t) 1 << bit;
+
+      if (!(__atomic_load_n(wordPtr, __ATOMIC_SEQ_CST) & bits))
+         __atomic_fetch_or(wordPtr, bits, __ATOMIC_SEQ_CST);
+   }
+
+
+   /**
+    * Flushes the dirty registers of one slave. Each summary level is
+    * cleared before the level below, so a concurrent writer sets it again
+    * for the next epoch.
+    *
+    * @return Number of ranges flushed
+    */
+   int flushSlave(int slaveAddr, FlushFunc flushFunc)
+   {
+      Slave *slavePtr = &slaveArr[slaveAddr];
+      uint64_t top;
+      uint64_t summary;
+      uint64_t bits;
+      int startAddr = -1;
+      int endAddr = -1;
+      int addr;
+      int word;
+      int cnt = 0;
+
+      top = __atomic_exchange_n(&slavePtr->top, 0, __ATOMIC_SEQ_CST);
+      while (top != 0)
+      {
+         word = __builtin_ctzll(top) * 64;
+         top &= top - 1;
+         summary = __atomic_exchange_n(&slavePtr->summaryArr[word / 64], 0,
+                                       __ATOMIC_SEQ_CST);
+         while (summary != 0)
+         {
+            word = (word & ~63) + __builtin_ctzll(summary);
+            summary &= summary - 1;
+            bits = __atomic_exchange_n(&slavePtr->wordArr[word], 0, __ATOMIC_SEQ_CST);
+            while (bits != 0)
+            {
+               addr = word * 64 + __builtin_ctzll(bits);
+               bits &= bits - 1;
+               if ((startAddr >= 0) && (addr == endAddr + 1))
+               {
+                  endAddr = addr;
+                  continue;
+               }
+               if (startAddr >= 0)
+               {
+                  flushRange(slaveAddr, startAddr, endAddr, flushFunc);
+                  cnt++;
+               }
+               startAddr = endAddr = addr;
+            }
+         }
+      }
+      if (startAddr >= 0)
+      {
+         flushRange(slaveAddr, startAddr, endAddr, flushFunc);
+         cnt++;
+      }
+      return cnt;
+   }
+
+
+   void flushRange(int slaveAddr, int startAddr, int endAddr, FlushFunc flushFunc)
+   {
+      flushFunc(slaveAddr, startAddr, endAddr - startAddr + 1);
+      rangeCnt++;
+      regCnt += endAddr - startAddr + 1;
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
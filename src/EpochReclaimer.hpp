@@ -0,0 +1,226 @@
+/**
+ * @file EpochReclaimer.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _EPOCHRECLAIMER_H_INCLUDED
+#define _EPOCHRECLAIMER_H_INCLUDED
+
+
+// Platform header
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+/*****************************************************************************
+ * EpochReclaimer class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Defers deleting objects, e.g. data tables, until no server thread
+ * can still use them.
+ *
+ * Server threads read object pointers without locks. A thread which
+ * replaces a pointer hands the old object to retire(), which tags it with
+ * the current global epoch and advances the epoch. Each server thread
+ * registers with registerThread() and calls quiescent() between requests,
+ * at a point where it holds no object pointers, which publishes the global
+ * epoch it observed. An object is deleted once every registered thread has
+ * published a later epoch than the object's tag.
+ *
+ * Readers thus pay one atomic load and one atomic store per server loop
+ * and nothing per request.
+ */
+class EpochReclaimer
+{
+
+public:
+
+   enum
+   {
+      MAX_THREADS = 8,   ///< Max number of registered server threads
+      MAX_RETIRED = 512  ///< Max number of objects awaiting deletion
+   };
+
+
+   EpochReclaimer()
+   {
+      globalEpoch = 1;
+      threadCnt = 0;
+      retiredCnt = 0;
+      memset(slotArr, 0, sizeof(slotArr));
+      pthread_mutex_init(&mutex, NULL);
+   }
+
+
+   /**
+    * Deletes all retired objects. Server threads must have stopped.
+    */
+   ~EpochReclaimer()
+   {
+      int i;
+
+      for (i = 0; i < retiredCnt; i++)
+         retiredArr[i].deleteFunc(retiredArr[i].objPtr);
+      pthread_mutex_destroy(&mutex);
+   }
+
+
+   /**
+    * Registers the calling thread as reader.
+    *
+    * @return Slot to be passed to quiescent(), -1 if MAX_THREADS is
+    * exceeded
+    */
+   int registerThread()
+   {
+      int slot = -1;
+
+      pthread_mutex_lock(&mutex);
+      if (threadCnt < MAX_THREADS)
+      {
+         slot = threadCnt;
+         __atomic_store_n(&slotArr[slot].epoch,
+                          __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+         __atomic_store_n(&threadCnt, threadCnt + 1, __ATOMIC_RELEASE);
+      }
+      pthread_mutex_unlock(&mutex);
+      return slot;
+   }
+
+
+   /**
+    * Announces that the calling thread holds no object pointers.
+    *
+    * @param slot Slot returned by registerThread()
+    */
+   void quiescent(int slot)
+   {
+      if (slot >= 0)
+         __atomic_store_n(&slotArr[slot].epoch,
+                          __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+   }
+
+
+   /**
+    * Hands over an object which has been unlinked from all servers. The
+    * object is deleted by a later call of retire() or reclaim().
+    *
+    * @param objPtr Object, may be NULL
+    * @param deleteFunc Function deleting the object
+    * @return 0 on success, -1 if too many objects await deletion; the
+    * object is not retired then
+    */
+   int retire(void *objPtr, void (*deleteFunc)(void *objPtr))
+   {
+      int result = 0;
+
+      if (objPtr == NULL)
+         return 0;
+      pthread_mutex_lock(&mutex);
+      reclaimLocked();
+      if (retiredCnt < MAX_RETIRED)
+      {
+         retiredArr[retiredCnt].objPtr = objPtr;
+         retiredArr[retiredCnt].deleteFunc = deleteFunc;
+         retiredArr[retiredCnt].epoch = __atomic_fetch_add(&globalEpoch, 1, __ATOMIC_SEQ_CST);
+         retiredCnt++;
+      }
+      else
+         result = -1;
+      pthread_mutex_unlock(&mutex);
+      return result;
+   }
+
+
+   /**
+    * Deletes the retired objects which no thread can use anymore.
+    *
+    * @return Number of objects still awaiting deletion
+    */
+   int reclaim()
+   {
+      int cnt;
+
+      pthread_mutex_lock(&mutex);
+      reclaimLocked();
+      cnt = retiredCnt;
+      pthread_mutex_unlock(&mutex);
+      return cnt;
+   }
+
+
+  private:
+
+   struct Slot
+   {
+      unsigned long long epoch;
+      char pad[56]; ///< Keeps the slots of different threads apart
+   };
+
+   struct Retired
+   {
+      void *objPtr;
+      void (*deleteFunc)(void *objPtr);
+      unsigned long long epoch;
+   };
+
+   unsigned long long globalEpoch;
+   Slot slotArr[MAX_THREADS];
+   int threadCnt;
+   Retired retiredArr[MAX_RETIRED];
+   int retiredCnt;
+   pthread_mutex_t mutex;
+
+
+   void reclaimLocked()
+   {
+      unsigned long long minEpoch = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+      unsigned long long epoch;
+      int i;
+
+      for (i = 0; i < threadCnt; i++)
+      {
+         epoch = __atomic_load_n(&slotArr[i].epoch, __ATOMIC_SEQ_CST);
+         if (epoch < minEpoch)
+            minEpoch = epoch;
+      }
+      for (i = 0; i < retiredCnt; )
+      {
+         if (retiredArr[i].epoch < minEpoch)
+         {
+            retiredArr[i].deleteFunc(retiredArr[i].objPtr);
+            retiredArr[i] = retiredArr[--retiredCnt];
+         }
+         else
+            i++;
+      }
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
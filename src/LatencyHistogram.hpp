@@ -0,0 +1,201 @@
+/**
+ * @file LatencyHistogram.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _LATENCYHISTOGRAM_H_INCLUDED
+#define _LATENCYHISTOGRAM_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+/*****************************************************************************
+ * LatencyHistogram class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Histogram of latencies with power-of-two buckets.
+ *
+ * Bucket n counts latencies from 2^(n-1) to 2^n - 1 microseconds, bucket 0
+ * counts latencies below one microsecond. Samples may be recorded from
+ * several threads, counters are updated with atomic operations.
+ */
+class LatencyHistogram
+{
+
+public:
+
+   enum
+   {
+      BUCKET_CNT = 32 ///< Covers latencies up to 2^31 us
+   };
+
+
+   LatencyHistogram()
+   {
+      reset();
+   }
+
+
+   void reset()
+   {
+      memset(bucketArr, 0, sizeof(bucketArr));
+      sampleCnt = 0;
+      sumNsec = 0;
+      minNsec = 0x7FFFFFFFFFFFFFFFLL;
+      maxNsec = 0;
+   }
+
+
+   /**
+    * Records one sample.
+    *
+    * @param nsec Latency in nanoseconds
+    */
+   void record(long long nsec)
+   {
+      unsigned long long usec;
+      long long oldNsec;
+      int bucket = 0;
+
+      if (nsec < 0)
+         nsec = 0;
+      for (usec = (unsigned long long) nsec / 1000; usec != 0; usec >>= 1)
+         bucket++;
+      if (bucket >= BUCKET_CNT)
+         bucket = BUCKET_CNT - 1;
+      __sync_fetch_and_add(&bucketArr[bucket], 1);
+      __sync_fetch_and_add(&sampleCnt, 1);
+      __sync_fetch_and_add(&sumNsec, nsec);
+      while (nsec < (oldNsec = minNsec))
+      {
+         if (__sync_bool_compare_and_swap(&minNsec, oldNsec, nsec))
+            break;
+      }
+      while (nsec > (oldNsec = maxNsec))
+      {
+         if (__sync_bool_compare_and_swap(&maxNsec, oldNsec, nsec))
+            break;
+      }
+   }
+
+
+   /**
+    * Prints a summary line with min, average, median, 99th percentile and
+    * max latency and the jitter, the difference between max and min.
+    * Percentiles are upper bucket bounds.
+    *
+    * @param title Line prefix
+    */
+   void print(const char *title)
+   {
+      if (sampleCnt == 0)
+      {
+         printf("%s: no samples\n", title);
+         return;
+      }
+      printf("%s: %llu samples, min/avg/max = %.1f/%.1f/%.1f us, "
+             "p50 < %llu us, p99 < %llu us, jitter = %.1f us\n",
+             title, sampleCnt, minNsec / 1000.0,
+             (double) sumNsec / sampleCnt / 1000.0, maxNsec / 1000.0,
+             getPercentileUsec(50), getPercentileUsec(99),
+             (maxNsec - minNsec) / 1000.0);
+   }
+
+
+  private:
+
+   unsigned long long bucketArr[BUCKET_CNT];
+   unsigned long long sampleCnt;
+   long long sumNsec;
+   long long minNsec;
+   long long maxNsec;
+
+
+   unsigned long long getPercentileUsec(int percent)
+   {
+      unsigned long long cnt = 0;
+      int i;
+
+      for (i = 0; i < BUCKET_CNT - 1; i++)
+      {
+         cnt += bucketArr[i];
+         if (cnt * 100 >= sampleCnt * percent)
+            break;
+      }
+      return 1ULL << i;
+   }
+
+};
+
+
+/*****************************************************************************
+ * LatencyTimer class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Records the lifetime of a scope in a LatencyHistogram.
+ *
+ * Does nothing if constructed with a NULL histogram.
+ */
+class LatencyTimer
+{
+
+public:
+
+   LatencyTimer(LatencyHistogram *histPtr)
+   {
+      this->histPtr = histPtr;
+      if (histPtr != NULL)
+         clock_gettime(CLOCK_MONOTONIC, &startTime);
+   }
+
+
+   ~LatencyTimer()
+   {
+      struct timespec endTime;
+
+      if (histPtr != NULL)
+      {
+         clock_gettime(CLOCK_MONOTONIC, &endTime);
+         histPtr->record((endTime.tv_sec - startTime.tv_sec) * 1000000000LL +
+                         (endTime.tv_nsec - startTime.tv_nsec));
+      }
+   }
+
+
+  private:
+
+   LatencyHistogram *histPtr;
+   struct timespec startTime;
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
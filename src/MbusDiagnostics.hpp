@@ -0,0 +1,517 @@
+/**
+ * @file MbusDiagnostics.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _MBUSDIAGNOSTICS_H_INCLUDED
+#define _MBUSDIAGNOSTICS_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <string.h>
+
+
+class MbusDiagnostics;
+
+
+/*****************************************************************************
+ * SlaveDiagnostics class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Serial line diagnostics state of one slave: the counters of
+ * function 8, the communication event counter and the 64 entry event log
+ * of functions 11 and 12, and the listen only mode.
+ *
+ * Counters are updated with relaxed atomic increments, so several server
+ * threads can serve the same slave. Readers may see a counter or event a
+ * request later, which Modbus diagnostics tolerate.
+ */
+class SlaveDiagnostics
+{
+
+public:
+
+   enum
+   {
+      EVENT_LOG_SIZE = 64 ///< Events kept for function 12
+   };
+
+   enum
+   {
+      // Receive event bits
+      EV_RECEIVE = 0x80,
+      EV_RX_LISTEN_ONLY = 0x20,
+      EV_RX_BROADCAST = 0x40,
+      // Send event bits
+      EV_SEND = 0x40,
+      EV_TX_READ_EXCEPTION = 0x01,
+      EV_TX_ABORT_EXCEPTION = 0x02,
+      EV_TX_BUSY_EXCEPTION = 0x04,
+      EV_TX_NAK_EXCEPTION = 0x08,
+      EV_TX_LISTEN_ONLY = 0x20,
+      // Other events
+      EV_LISTEN_ONLY_ENTERED = 0x04,
+      EV_RESTART = 0x00
+   };
+
+
+   SlaveDiagnostics()
+   {
+      busPtr = NULL;
+      clearSlaveCounters();
+      eventIdx = 0;
+      listenOnly = 0;
+   }
+
+
+   /**
+    * Counts a request addressed to this slave and logs its receive event.
+    * Called before the request is executed.
+    *
+    * @param broadcast 1 if received as broadcast
+    */
+   void requestReceived(int broadcast)
+   {
+      int event = EV_RECEIVE;
+
+      increment(&slaveMessageCnt);
+      if (isListenOnly())
+         event |= EV_RX_LISTEN_ONLY;
+      if (broadcast)
+         event |= EV_RX_BROADCAST;
+      logEvent(event);
+   }
+
+
+   /**
+    * Counts the outcome of a request and logs its send event.
+    *
+    * @param functionCode Function code of the request
+    * @param rspArr Response PDU
+    * @param rspLen Length of response PDU, 0 if no response is sent
+    */
+   void requestCompleted(int functionCode, const unsigned char rspArr[], int rspLen)
+   {
+      int event = EV_SEND;
+
+      if (isListenOnly())
+         event |= EV_TX_LISTEN_ONLY;
+      if (rspLen == 0)
+         increment(&noResponseCnt);
+      else if (rspArr[0] & 0x80)
+      {
+         increment(&exceptionCnt);
+         switch (rspArr[1])
+         {
+            case 1: case 2: case 3:
+               event |= EV_TX_READ_EXCEPTION;
+            break;
+            case 4:
+               event |= EV_TX_ABORT_EXCEPTION;
+            break;
+            case 5: case 6:
+               increment(&busyCnt);
+               event |= EV_TX_BUSY_EXCEPTION;
+            break;
+            case 7:
+               increment(&nakCnt);
+               event |= EV_TX_NAK_EXCEPTION;
+            break;
+         }
+      }
+      else if ((functionCode != 8) && (functionCode != 11) && (functionCode != 12))
+         increment(&commEventCnt); // Polls and event fetches are not counted
+      logEvent(event);
+   }
+
+
+   int isListenOnly()
+   {
+      return __atomic_load_n(&listenOnly, __ATOMIC_RELAXED);
+   }
+
+
+   /**
+    * Executes a Diagnostics (function 8) request.
+    *
+    * @param reqArr Request PDU
+    * @param reqLen Length of request PDU
+    * @param rspArr Buffer for the response PDU
+    * @return Length of response PDU, 0 for no response or -1 if the
+    * sub-function is not supported
+    */
+   int processDiagnostics(const unsigned char reqArr[], int reqLen,
+                          unsigned char rspArr[])
+   {
+      int subFunction;
+      int data;
+
+      if (reqLen < 3)
+         return -1;
+      subFunction = (reqArr[1] << 8) | reqArr[2];
+      if (subFunction == 0x00) // Return Query Data
+      {
+         memcpy(rspArr, reqArr, reqLen);
+         return reqLen;
+      }
+      if (reqLen != 5)
+         return -1;
+      data = (reqArr[3] << 8) | reqArr[4];
+      switch (subFunction)
+      {
+         case 0x01: // Restart Communications Option
+            if ((data != 0x0000) && (data != 0xFF00))
+               return -1;
+            restart(data == 0xFF00);
+         break;
+         case 0x04: // Force Listen Only Mode
+            __atomic_store_n(&listenOnly, 1, __ATOMIC_RELAXED);
+            logEvent(EV_LISTEN_ONLY_ENTERED);
+         return 0;
+         case 0x02: // Return Diagnostic Register
+            data = 0;
+         break;
+         case 0x03: // Change ASCII Input Delimiter, ASCII is not served here
+         break;
+         case 0x0A: // Clear Counters and Diagnostic Register
+            clearCounters();
+            data = 0;
+         break;
+         case 0x0B: data = getBusMessageCount(); break;
+         case 0x0C: data = getBusErrorCount(); break;
+         case 0x0D: data = getCounter(&exceptionCnt); break;
+         case 0x0E: data = getCounter(&slaveMessageCnt); break;
+         case 0x0F: data = getCounter(&noResponseCnt); break;
+         case 0x10: data = getCounter(&nakCnt); break;
+         case 0x11: data = getCounter(&busyCnt); break;
+         case 0x12: data = getBusOverrunCount(); break;
+         case 0x14: // Clear Overrun Counter and Flag
+            clearBusOverrunCount();
+            data = 0;
+         break;
+         default:
+         return -1;
+      }
+      memcpy(rspArr, reqArr, 3);
+      rspArr[3] = (unsigned char) (data >> 8);
+      rspArr[4] = (unsigned char) data;
+      return 5;
+   }
+
+
+   /**
+    * Encodes the response to Get Comm Event Counter (function 11).
+    */
+   int getCommEventCounter(unsigned char rspArr[])
+   {
+      int cnt = getCounter(&commEventCnt);
+
+      rspArr[0] = 11;
+      rspArr[1] = 0; // Status: never busy
+      rspArr[2] = 0;
+      rspArr[3] = (unsigned char) (cnt >> 8);
+      rspArr[4] = (unsigned char) cnt;
+      return 5;
+   }
+
+
+   /**
+    * Encodes the response to Get Comm Event Log (function 12), most recent
+    * event first.
+    */
+   int getCommEventLog(unsigned char rspArr[])
+   {
+      unsigned int idx = __atomic_load_n(&eventIdx, __ATOMIC_ACQUIRE);
+      int cnt = idx < EVENT_LOG_SIZE ? (int) idx : (int) EVENT_LOG_SIZE;
+      int eventCnt = getCounter(&commEventCnt);
+      int msgCnt = getBusMessageCount();
+      int i;
+
+      rspArr[0] = 12;
+      rspArr[1] = (unsigned char) (6 + cnt);
+      rspArr[2] = 0; // Status: never busy
+      rspArr[3] = 0;
+      rspArr[4] = (unsigned char) (eventCnt >> 8);
+      rspArr[5] = (unsigned char) eventCnt;
+      rspArr[6] = (unsigned char) (msgCnt >> 8);
+      rspArr[7] = (unsigned char) msgCnt;
+      for (i = 0; i < cnt; i++)
+         rspArr[8 + i] = eventArr[(idx - 1 - i) % EVENT_LOG_SIZE];
+      return 8 + cnt;
+   }
+
+
+   /**
+    * Prints the counters as the admin interface shows them.
+    */
+   void printCounters(FILE *filePtr)
+   {
+      fprintf(filePtr, "bus messages %d\nbus errors %d\nbus overruns %d\n"
+              "slave messages %d\nexceptions %d\nno responses %d\nnaks %d\nbusy %d\n"
+              "comm events %d\nlisten only %d\n",
+              getBusMessageCount(), getBusErrorCount(), getBusOverrunCount(),
+              getCounter(&slaveMessageCnt), getCounter(&exceptionCnt),
+              getCounter(&noResponseCnt), getCounter(&nakCnt), getCounter(&busyCnt),
+              getCounter(&commEventCnt), isListenOnly());
+   }
+
+
+   /**
+    * Clears the slave counters and the bus counters as seen by this slave,
+    * like sub-function 0x0A. Listen only mode and the event log are kept.
+    */
+   void clearCounters()
+   {
+      clearSlaveCounters();
+      clearBusCounters();
+   }
+
+
+   /**
+    * Executes a communication restart: leaves listen only mode and clears
+    * the counters and optionally the event log.
+    */
+   void restart(int clearLog)
+   {
+      __atomic_store_n(&listenOnly, 0, __ATOMIC_RELAXED);
+      clearCounters();
+      if (clearLog)
+         __atomic_store_n(&eventIdx, 0, __ATOMIC_RELEASE);
+      logEvent(EV_RESTART);
+   }
+
+
+  private:
+
+   friend class MbusDiagnostics;
+
+   MbusDiagnostics *busPtr;
+   unsigned int slaveMessageCnt;
+   unsigned int exceptionCnt;
+   unsigned int noResponseCnt;
+   unsigned int nakCnt;
+   unsigned int busyCnt;
+   unsigned int commEventCnt;
+   unsigned int eventIdx;
+   int listenOnly;
+   unsigned char eventArr[EVENT_LOG_SIZE];
+
+
+   static void increment(unsigned int *cntPtr)
+   {
+      __atomic_fetch_add(cntPtr, 1, __ATOMIC_RELAXED);
+   }
+
+
+   /**
+    * Returns a counter as 16-bit Modbus value.
+    */
+   static int getCounter(unsigned int *cntPtr)
+   {
+      return (int) (__atomic_load_n(cntPtr, __ATOMIC_RELAXED) & 0xFFFF);
+   }
+
+
+   void clearSlaveCounters()
+   {
+      __atomic_store_n(&slaveMessageCnt, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&exceptionCnt, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&noResponseCnt, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&nakCnt, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&busyCnt, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&commEventCnt, 0, __ATOMIC_RELAXED);
+   }
+
+
+   void logEvent(int event)
+   {
+      unsigned int idx = __atomic_fetch_add(&eventIdx, 1, __ATOMIC_RELAXED);
+
+      eventArr[idx % EVENT_LOG_SIZE] = (unsigned char) event;
+   }
+
+
+   inline int getBusMessageCount();
+   inline int getBusErrorCount();
+   inline int getBusOverrunCount();
+   inline void clearBusOverrunCount();
+   inline void clearBusCounters();
+
+};
+
+
+/*****************************************************************************
+ * MbusDiagnostics class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Diagnostics of a simulated bus: the bus counters the transports
+ * maintain per received frame and the SlaveDiagnostics of all 256 slave
+ * addresses on it.
+ *
+ * The bus counters are shared by all slaves of the bus. Sub-functions
+ * 0x0B, 0x0C and 0x12 return them relative to a base, which a clear of
+ * any slave moves to the current count, so a master clearing its slave
+ * sees them start from 0 as with a device of its own. The totals
+ * returned by getMessageCount() and getErrorCount() are never cleared.
+ */
+class MbusDiagnostics
+{
+
+public:
+
+   MbusDiagnostics()
+   {
+      int i;
+
+      busMessageCnt = 0;
+      busErrorCnt = 0;
+      busOverrunCnt = 0;
+      busMessageBase = 0;
+      busErrorBase = 0;
+      busOverrunBase = 0;
+      for (i = 0; i < 256; i++)
+         slaveArr[i].busPtr = this;
+   }
+
+
+   /**
+    * Counts a frame received from the bus, whether valid or not.
+    */
+   void busMessage()
+   {
+      __atomic_fetch_add(&busMessageCnt, 1, __ATOMIC_RELAXED);
+   }
+
+
+   /**
+    * Counts a frame with a CRC or framing error.
+    */
+   void busError()
+   {
+      __atomic_fetch_add(&busErrorCnt, 1, __ATOMIC_RELAXED);
+   }
+
+
+   /**
+    * Counts a frame exceeding the maximum frame size.
+    */
+   void busOverrun()
+   {
+      __atomic_fetch_add(&busOverrunCnt, 1, __ATOMIC_RELAXED);
+   }
+
+
+   SlaveDiagnostics *getSlave(int slaveAddr)
+   {
+      return &slaveArr[slaveAddr & 0xFF];
+   }
+
+
+   /**
+    * Returns the number of frames received, not truncated to 16 bits.
+    */
+   unsigned int getMessageCount()
+   {
+      return __atomic_load_n(&busMessageCnt, __ATOMIC_RELAXED);
+   }
+
+
+   /**
+    * Returns the number of frames with errors, not truncated to 16 bits.
+    */
+   unsigned int getErrorCount()
+   {
+      return __atomic_load_n(&busErrorCnt, __ATOMIC_RELAXED);
+   }
+
+
+  private:
+
+   friend class SlaveDiagnostics;
+
+   unsigned int busMessageCnt;
+   unsigned int busErrorCnt;
+   unsigned int busOverrunCnt;
+   unsigned int busMessageBase;  ///< busMessageCnt at the last clear
+   unsigned int busErrorBase;    ///< busErrorCnt at the last clear
+   unsigned int busOverrunBase;  ///< busOverrunCnt at the last clear
+   SlaveDiagnostics slaveArr[256];
+
+
+   /**
+    * Returns a counter relative to its base as 16-bit Modbus value.
+    */
+   static int getCounterSince(unsigned int *cntPtr, unsigned int *basePtr)
+   {
+      return (int) ((__atomic_load_n(cntPtr, __ATOMIC_RELAXED) -
+                     __atomic_load_n(basePtr, __ATOMIC_RELAXED)) & 0xFFFF);
+   }
+
+
+   static void clearCounter(unsigned int *cntPtr, unsigned int *basePtr)
+   {
+      __atomic_store_n(basePtr, __atomic_load_n(cntPtr, __ATOMIC_RELAXED),
+                       __ATOMIC_RELAXED);
+   }
+
+};
+
+
+int SlaveDiagnostics::getBusMessageCount()
+{
+   return MbusDiagnostics::getCounterSince(&busPtr->busMessageCnt, &busPtr->busMessageBase);
+}
+
+
+int SlaveDiagnostics::getBusErrorCount()
+{
+   return MbusDiagnostics::getCounterSince(&busPtr->busErrorCnt, &busPtr->busErrorBase);
+}
+
+
+int SlaveDiagnostics::getBusOverrunCount()
+{
+   return MbusDiagnostics::getCounterSince(&busPtr->busOverrunCnt, &busPtr->busOverrunBase);
+}
+
+
+void SlaveDiagnostics::clearBusOverrunCount()
+{
+   MbusDiagnostics::clearCounter(&busPtr->busOverrunCnt, &busPtr->busOverrunBase);
+}
+
+
+void SlaveDiagnostics::clearBusCounters()
+{
+   MbusDiagnostics::clearCounter(&busPtr->busMessageCnt, &busPtr->busMessageBase);
+   MbusDiagnostics::clearCounter(&busPtr->busErrorCnt, &busPtr->busErrorBase);
+   MbusDiagnostics::clearCounter(&busPtr->busOverrunCnt, &busPtr->busOverrunBase);
+}
+
+
+#endif // ifdef ..._H_INCLUDED
@@ -0,0 +1,586 @@
+/**
+ * @file MbusPduProcessor.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _MBUSPDUPROCESSOR_H_INCLUDED
+#define _MBUSPDUPROCESSOR_H_INCLUDED
+
+
+// Platform header
+#include <string.h>
+
+// Package header
+#include "MbusDataTableInterface.hpp"
+#include "MbusDiagnostics.hpp"
+
+
+/*****************************************************************************
+ * MbusPduProcessor class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Decodes a Modbus request PDU, dispatches it to a data table
+ * and encodes the response PDU.
+ *
+ * The FieldTalk protocol classes do their own dispatching. This class is
+ * used by the transports diagslave implements itself, so they serve the
+ * same data tables with the same semantics. A PDU is the function code
+ * followed by the function's data, without address or checksum.
+ *
+ * Function codes 1 to 7, 15 to 17, 20 to 23 and Read Device Identification
+ * (43/14) are served through the data table callbacks. Mask Write Register
+ * (22) and Read/Write Multiple Registers (23) have no callbacks of their
+ * own, they are executed as a holding register read followed by a write
+ * respectively a write followed by a read. All other function codes are
+ * answered with an Illegal Function exception.
+ *
+ * An optional function code mask restricts the function codes a caller
+ * may execute. Function codes not in the mask are answered with an
+ * Illegal Function exception.
+ *
+ * With the SlaveDiagnostics of the addressed slave every request is
+ * counted and logged, and the serial line diagnostics functions 8, 11 and
+ * 12 are served. Without, these functions are not supported.
+ */
+class MbusPduProcessor
+{
+
+public:
+
+   enum
+   {
+      MAX_PDU_SIZE = 253 ///< Max size of a Modbus PDU in bytes
+   };
+
+   enum
+   {
+      ILLEGAL_FUNCTION = 0x01,       ///< Function code not supported
+      ILLEGAL_DATA_ADDRESS = 0x02,   ///< Reference range not valid
+      ILLEGAL_DATA_VALUE = 0x03,     ///< Value in request not valid
+      GATEWAY_TARGET_FAILED = 0x0B   ///< No data table for unit ID
+   };
+
+
+   /**
+    * Allows a function code in a function code mask.
+    *
+    * @param fcMaskArr Mask of 256 bits, one per function code
+    * @param functionCode Function code to allow
+    */
+   static void allowFunction(unsigned char fcMaskArr[32], int functionCode)
+   {
+      fcMaskArr[(functionCode >> 3) & 0x1F] |= (unsigned char) (1 << (functionCode & 7));
+   }
+
+
+   /**
+    * Checks if a function code mask allows a function code.
+    *
+    * @param fcMaskArr Mask of 256 bits or NULL to allow all
+    * @param functionCode Function code to check
+    * @return 1 if allowed, 0 if not
+    */
+   static int isFunctionAllowed(const unsigned char *fcMaskArr,
+                                int functionCode)
+   {
+      if (fcMaskArr == NULL)
+         return 1;
+      return (fcMaskArr[(functionCode >> 3) & 0x1F] >> (functionCode & 7)) & 1;
+   }
+
+
+   /**
+    * Processes a request PDU.
+    *
+    * @param dataTablePtr Data table to dispatch to or NULL if there is
+    * no data table for the addressed unit
+    * @param reqArr Request PDU
+    * @param reqLen Length of request PDU
+    * @param rspArr Buffer for the response PDU, must hold MAX_PDU_SIZE bytes
+    * @param fcMaskArr Mask of allowed function codes or NULL to allow all
+    * @param diagPtr Diagnostics of the addressed slave or NULL
+    * @param broadcast 1 if the request was received as broadcast, its
+    * response is discarded then
+    * @return Length of response PDU or 0 if no response shall be sent
+    */
+   static int processPdu(MbusDataTableInterface *dataTablePtr,
+                         const unsigned char reqArr[], int reqLen,
+                         unsigned char rspArr[],
+                         const unsigned char *fcMaskArr = NULL,
+                         SlaveDiagnostics *diagPtr = NULL, int broadcast = 0)
+   {
+      int wasListenOnly;
+      int rspLen;
+
+      if ((diagPtr == NULL) || (dataTablePtr == NULL) || (reqLen < 1) ||
+          (reqArr[0] & 0x80))
+         return dispatchPdu(dataTablePtr, reqArr, reqLen, rspArr, fcMaskArr, NULL);
+      diagPtr->requestReceived(broadcast);
+      wasListenOnly = diagPtr->isListenOnly();
+      if (wasListenOnly && !((reqLen == 5) && (reqArr[0] == 8) &&
+                             (reqArr[1] == 0) && (reqArr[2] == 1)))
+         rspLen = 0; // Only a restart leaves listen only mode
+      else
+      {
+         rspLen = dispatchPdu(dataTablePtr, reqArr, reqLen, rspArr, fcMaskArr, diagPtr);
+         if (wasListenOnly || broadcast)
+            rspLen = 0;
+      }
+      diagPtr->requestCompleted(reqArr[0], rspArr, rspLen);
+      return rspLen;
+   }
+
+
+  private:
+
+   static int dispatchPdu(MbusDataTableInterface *dataTablePtr,
+                          const unsigned char reqArr[], int reqLen,
+                          unsigned char rspArr[],
+                          const unsigned char *fcMaskArr,
+                          SlaveDiagnostics *diagPtr)
+   {
+      int functionCode;
+      int startRef;
+      int refCnt;
+      int i;
+      short regArr[125];
+      char bitArr[2000];
+
+      if (reqLen < 1)
+         return 0;
+      functionCode = reqArr[0];
+      if (functionCode & 0x80)
+         return 0;
+      if (dataTablePtr == NULL)
+         return exceptionRsp(rspArr, functionCode, GATEWAY_TARGET_FAILED);
+      if (!isFunctionAllowed(fcMaskArr, functionCode))
+         return exceptionRsp(rspArr, functionCode, ILLEGAL_FUNCTION);
+
+      switch (functionCode)
+      {
+         //
+         // Read Coils, Read Discrete Inputs
+         //
+         case 1:
+         case 2:
+            if (reqLen != 5)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            startRef = getWord(&reqArr[1]);
+            refCnt = getWord(&reqArr[3]);
+            if ((refCnt < 1) || (refCnt > 2000))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            if (functionCode == 1)
+               i = dataTablePtr->readCoilsTable(startRef + 1, bitArr, refCnt);
+            else
+               i = dataTablePtr->readInputDiscretesTable(startRef + 1, bitArr, refCnt);
+            if (!i)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            rspArr[0] = (unsigned char) functionCode;
+            rspArr[1] = (unsigned char) ((refCnt + 7) / 8);
+            memset(&rspArr[2], 0, rspArr[1]);
+            for (i = 0; i < refCnt; i++)
+            {
+               if (bitArr[i])
+                  rspArr[2 + i / 8] |= (unsigned char) (1 << (i % 8));
+            }
+         return 2 + rspArr[1];
+
+         //
+         // Read Holding Registers, Read Input Registers
+         //
+         case 3:
+         case 4:
+            if (reqLen != 5)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            startRef = getWord(&reqArr[1]);
+            refCnt = getWord(&reqArr[3]);
+            if ((refCnt < 1) || (refCnt > 125))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            if (functionCode == 3)
+               i = dataTablePtr->readHoldingRegistersTable(startRef + 1, regArr, refCnt);
+            else
+               i = dataTablePtr->readInputRegistersTable(startRef + 1, regArr, refCnt);
+            if (!i)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            rspArr[0] = (unsigned char) functionCode;
+            rspArr[1] = (unsigned char) (refCnt * 2);
+            for (i = 0; i < refCnt; i++)
+               putWord(&rspArr[2 + i * 2], regArr[i]);
+         return 2 + refCnt * 2;
+
+         //
+         // Write Single Coil
+         //
+         case 5:
+            if (reqLen != 5)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            startRef = getWord(&reqArr[1]);
+            i = getWord(&reqArr[3]);
+            if ((i != 0xFF00) && (i != 0x0000))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            bitArr[0] = (char) (i ? 1 : 0);
+            if (!dataTablePtr->writeCoilsTable(startRef + 1, bitArr, 1))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            memcpy(rspArr, reqArr, 5);
+         return 5;
+
+         //
+         // Write Single Register
+         //
+         case 6:
+            if (reqLen != 5)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            startRef = getWord(&reqArr[1]);
+            regArr[0] = (short) getWord(&reqArr[3]);
+            if (!dataTablePtr->writeHoldingRegistersTable(startRef + 1, regArr, 1))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            memcpy(rspArr, reqArr, 5);
+         return 5;
+
+         //
+         // Read Exception Status
+         //
+         case 7:
+            if (reqLen != 1)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            rspArr[0] = (unsigned char) functionCode;
+            rspArr[1] = (unsigned char) dataTablePtr->readExceptionStatus();
+         return 2;
+
+         //
+         // Diagnostics
+         //
+         case 8:
+            if (diagPtr == NULL)
+               break;
+            i = diagPtr->processDiagnostics(reqArr, reqLen, rspArr);
+            if (i < 0)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_FUNCTION);
+         return i;
+
+         //
+         // Get Comm Event Counter, Get Comm Event Log
+         //
+         case 11:
+         case 12:
+            if (diagPtr == NULL)
+               break;
+            if (reqLen != 1)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            if (functionCode == 11)
+               return diagPtr->getCommEventCounter(rspArr);
+         return diagPtr->getCommEventLog(rspArr);
+
+         //
+         // Write Multiple Coils
+         //
+         case 15:
+            if (reqLen < 6)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            startRef = getWord(&reqArr[1]);
+            refCnt = getWord(&reqArr[3]);
+            if ((refCnt < 1) || (refCnt > 1968) ||
+                (reqArr[5] != (refCnt + 7) / 8) || (reqLen != 6 + reqArr[5]))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            for (i = 0; i < refCnt; i++)
+               bitArr[i] = (char) ((reqArr[6 + i / 8] >> (i % 8)) & 1);
+            if (!dataTablePtr->writeCoilsTable(startRef + 1, bitArr, refCnt))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            memcpy(rspArr, reqArr, 5);
+         return 5;
+
+         //
+         // Write Multiple Registers
+         //
+         case 16:
+            if (reqLen < 6)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            startRef = getWord(&reqArr[1]);
+            refCnt = getWord(&reqArr[3]);
+            if ((refCnt < 1) || (refCnt > 123) ||
+                (reqArr[5] != refCnt * 2) || (reqLen != 6 + reqArr[5]))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            for (i = 0; i < refCnt; i++)
+               regArr[i] = (short) getWord(&reqArr[6 + i * 2]);
+            if (!dataTablePtr->writeHoldingRegistersTable(startRef + 1, regArr, refCnt))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            memcpy(rspArr, reqArr, 5);
+         return 5;
+
+         //
+         // Report Slave ID
+         //
+         case 17:
+            if (reqLen != 1)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            i = dataTablePtr->getSlaveId((char *) &rspArr[2], MAX_PDU_SIZE - 3);
+            if (i > MAX_PDU_SIZE - 3)
+               i = MAX_PDU_SIZE - 3;
+            rspArr[0] = (unsigned char) functionCode;
+            rspArr[1] = (unsigned char) (i + 1);
+            rspArr[2 + i] = (unsigned char) (dataTablePtr->getRunIndicatorStatus() ? 0xFF : 0x00);
+         return 3 + i;
+
+         //
+         // Read File Record
+         //
+         case 20:
+            return readFileRecord(dataTablePtr, reqArr, reqLen, rspArr);
+
+         //
+         // Write File Record
+         //
+         case 21:
+            return writeFileRecord(dataTablePtr, reqArr, reqLen, rspArr);
+
+         //
+         // Mask Write Register, executed as read-modify-write
+         //
+         case 22:
+            if (reqLen != 7)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            startRef = getWord(&reqArr[1]);
+            if (!dataTablePtr->readHoldingRegistersTable(startRef + 1, regArr, 1))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            regArr[0] = (short) ((regArr[0] & getWord(&reqArr[3])) |
+                                 (getWord(&reqArr[5]) & ~getWord(&reqArr[3])));
+            if (!dataTablePtr->writeHoldingRegistersTable(startRef + 1, regArr, 1))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            memcpy(rspArr, reqArr, 7);
+         return 7;
+
+         //
+         // Read/Write Multiple Registers, the write is executed first
+         //
+         case 23:
+            if (reqLen < 10)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            startRef = getWord(&reqArr[5]);
+            refCnt = getWord(&reqArr[7]);
+            if ((refCnt < 1) || (refCnt > 121) ||
+                (reqArr[9] != refCnt * 2) || (reqLen != 10 + reqArr[9]))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            i = getWord(&reqArr[3]);
+            if ((i < 1) || (i > 125))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+            for (i = 0; i < refCnt; i++)
+               regArr[i] = (short) getWord(&reqArr[10 + i * 2]);
+            if (!dataTablePtr->writeHoldingRegistersTable(startRef + 1, regArr, refCnt))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            startRef = getWord(&reqArr[1]);
+            refCnt = getWord(&reqArr[3]);
+            if (!dataTablePtr->readHoldingRegistersTable(startRef + 1, regArr, refCnt))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_ADDRESS);
+            rspArr[0] = (unsigned char) functionCode;
+            rspArr[1] = (unsigned char) (refCnt * 2);
+            for (i = 0; i < refCnt; i++)
+               putWord(&rspArr[2 + i * 2], regArr[i]);
+         return 2 + refCnt * 2;
+
+         //
+         // Encapsulated Interface Transport, only Read Device Identification
+         //
+         case 43:
+            if ((reqLen < 2) || (reqArr[1] != 14))
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_FUNCTION);
+            if (reqLen != 4)
+               return exceptionRsp(rspArr, functionCode, ILLEGAL_DATA_VALUE);
+         return readDeviceId(dataTablePtr, reqArr, rspArr);
+      }
+      return exceptionRsp(rspArr, functionCode, ILLEGAL_FUNCTION);
+   }
+
+
+   static int readFileRecord(MbusDataTableInterface *dataTablePtr,
+                             const unsigned char reqArr[], int reqLen,
+                             unsigned char rspArr[])
+   {
+      int rspLen;
+      int refCnt;
+      int i;
+      int j;
+      short regArr[125];
+
+      //
+      // Each 7 byte sub-request is answered by a length byte, the
+      // reference type and the record data
+      //
+      if ((reqLen < 9) || (reqArr[1] != reqLen - 2) || ((reqLen - 2) % 7))
+         return exceptionRsp(rspArr, 20, ILLEGAL_DATA_VALUE);
+      rspLen = 2;
+      for (i = 2; i < reqLen; i += 7)
+      {
+         if (reqArr[i] != 6)
+            return exceptionRsp(rspArr, 20, ILLEGAL_DATA_ADDRESS);
+         refCnt = getWord(&reqArr[i + 5]);
+         if ((refCnt < 1) || (rspLen + 2 + refCnt * 2 > MAX_PDU_SIZE))
+            return exceptionRsp(rspArr, 20, ILLEGAL_DATA_VALUE);
+         if (!dataTablePtr->readFileRecord(6, getWord(&reqArr[i + 1]),
+                                           getWord(&reqArr[i + 3]),
+                                           regArr, refCnt))
+            return exceptionRsp(rspArr, 20, ILLEGAL_DATA_ADDRESS);
+         rspArr[rspLen] = (unsigned char) (1 + refCnt * 2);
+         rspArr[rspLen + 1] = 6;
+         for (j = 0; j < refCnt; j++)
+            putWord(&rspArr[rspLen + 2 + j * 2], regArr[j]);
+         rspLen += 2 + refCnt * 2;
+      }
+      rspArr[0] = 20;
+      rspArr[1] = (unsigned char) (rspLen - 2);
+      return rspLen;
+   }
+
+
+   static int writeFileRecord(MbusDataTableInterface *dataTablePtr,
+                              const unsigned char reqArr[], int reqLen,
+                              unsigned char rspArr[])
+   {
+      int refCnt = 0;
+      int i;
+      int j;
+      short regArr[125];
+
+      //
+      // Each sub-request carries its data, the response echoes the request
+      //
+      if ((reqLen < 11) || (reqLen > MAX_PDU_SIZE) || (reqArr[1] != reqLen - 2))
+         return exceptionRsp(rspArr, 21, ILLEGAL_DATA_VALUE);
+      for (i = 2; i < reqLen; i += 7 + refCnt * 2)
+      {
+         if (i + 7 > reqLen)
+            return exceptionRsp(rspArr, 21, ILLEGAL_DATA_VALUE);
+         refCnt = getWord(&reqArr[i + 5]);
+         if ((refCnt < 1) || (i + 7 + refCnt * 2 > reqLen))
+            return exceptionRsp(rspArr, 21, ILLEGAL_DATA_VALUE);
+         if (reqArr[i] != 6)
+            return exceptionRsp(rspArr, 21, ILLEGAL_DATA_ADDRESS);
+         for (j = 0; j < refCnt; j++)
+            regArr[j] = (short) getWord(&reqArr[i + 7 + j * 2]);
+         if (!dataTablePtr->writeFileRecord(6, getWord(&reqArr[i + 1]),
+                                            getWord(&reqArr[i + 3]),
+                                            regArr, refCnt))
+            return exceptionRsp(rspArr, 21, ILLEGAL_DATA_ADDRESS);
+      }
+      memcpy(rspArr, reqArr, reqLen);
+      return reqLen;
+   }
+
+
+   static int readDeviceId(MbusDataTableInterface *dataTablePtr,
+                           const unsigned char reqArr[],
+                           unsigned char rspArr[])
+   {
+      int readDevIdCode;
+      int firstObjId;
+      int lastObjId;
+      int objId;
+      int objCnt;
+      int objLen;
+      int rspLen;
+      char objArr[256];
+
+      //
+      // Codes 1 to 3 stream the basic, regular and extended objects from
+      // the requested object on, code 4 reads one object. Objects the data
+      // table reports with length 0 are skipped.
+      //
+      readDevIdCode = reqArr[2];
+      objId = reqArr[3];
+      switch (readDevIdCode)
+      {
+         case 1: firstObjId = 0x00; lastObjId = 0x02; break;
+         case 2: firstObjId = 0x00; lastObjId = 0x06; break;
+         case 3: firstObjId = 0x80; lastObjId = 0xFF; break;
+         case 4: firstObjId = objId; lastObjId = objId; break;
+         default:
+         return exceptionRsp(rspArr, 43, ILLEGAL_DATA_VALUE);
+      }
+      if (readDevIdCode == 4)
+      {
+         if (dataTablePtr->getDeviceIdObject(objId, NULL, 0) <= 0)
+            return exceptionRsp(rspArr, 43, ILLEGAL_DATA_ADDRESS);
+      }
+      else if ((objId < firstObjId) || (objId > lastObjId))
+         objId = firstObjId;
+      rspArr[0] = 43;
+      rspArr[1] = 14;
+      rspArr[2] = (unsigned char) readDevIdCode;
+      rspArr[3] = 0x83; // Basic, regular and extended, stream and individual
+      rspArr[4] = 0x00; // No more follows
+      rspArr[5] = 0x00; // Next object ID
+      rspLen = 7;
+      objCnt = 0;
+      for (; objId <= lastObjId; objId++)
+      {
+         objLen = dataTablePtr->getDeviceIdObject(objId, NULL, 0);
+         if (objLen <= 0)
+            continue;
+         if (objLen > MAX_PDU_SIZE - 9)
+            objLen = MAX_PDU_SIZE - 9;
+         if (rspLen + 2 + objLen > MAX_PDU_SIZE)
+         {
+            rspArr[4] = 0xFF;
+            rspArr[5] = (unsigned char) objId;
+            break;
+         }
+         memset(objArr, 0, sizeof(objArr));
+         dataTablePtr->getDeviceIdObject(objId, objArr, sizeof(objArr));
+         rspArr[rspLen] = (unsigned char) objId;
+         rspArr[rspLen + 1] = (unsigned char) objLen;
+         memcpy(&rspArr[rspLen + 2], objArr, objLen);
+         rspLen += 2 + objLen;
+         objCnt++;
+      }
+      rspArr[6] = (unsigned char) objCnt;
+      return rspLen;
+   }
+
+
+   static int getWord(const unsigned char *bufPtr)
+   {
+      return (bufPtr[0] << 8) | bufPtr[1];
+   }
+
+
+   static void putWord(unsigned char *bufPtr, int value)
+   {
+      bufPtr[0] = (unsigned char) (value >> 8);
+      bufPtr[1] = (unsigned char) value;
+   }
+
+
+   static int exceptionRsp(unsigned char rspArr[], int functionCode,
+                           int exceptionCode)
+   {
+      rspArr[0] = (unsigned char) (functionCode | 0x80);
+      rspArr[1] = (unsigned char) exceptionCode;
+      return 2;
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
@@ -0,0 +1,395 @@
+/**
+ * @file MbusRtuOverTcpServer.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _MBUSRTUOVERTCPSERVER_H_INCLUDED
+#define _MBUSRTUOVERTCPSERVER_H_INCLUDED
+
+
+// Platform header
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+// Package header
+#include "MbusSocketServer.hpp"
+
+
+/*****************************************************************************
+ * MbusRtuOverTcpServer class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Modbus RTU over TCP server (encapsulated RTU).
+ *
+ * Serves raw RTU frames, slave address, PDU and CRC, tunnelled through a
+ * TCP connection as done by serial-to-Ethernet converters. Frame
+ * boundaries are derived from the function code because RTU has no length
+ * field. Frames with a bad CRC are discarded together with the rest of the
+ * received data, so the receiver re-synchronises with the next segment.
+ *
+ * As on a serial line, requests to unknown addresses are not answered and
+ * broadcasts to address 0 are executed without a response. Frames with a
+ * bad CRC count as bus communication errors, data overflowing the frame
+ * buffer as character overruns.
+ */
+class MbusRtuOverTcpServer: public MbusSocketServer
+{
+
+public:
+
+   enum
+   {
+      MAX_CONNECTIONS = 32, ///< Max number of simultaneous connections
+      MAX_FRAME_SIZE = 1 + MbusPduProcessor::MAX_PDU_SIZE + 2 ///< RTU ADU
+   };
+
+
+   MbusRtuOverTcpServer()
+   {
+      int i;
+
+      memset(connArr, 0, sizeof(connArr));
+      for (i = 0; i < MAX_CONNECTIONS; i++)
+         connArr[i].fd = -1;
+   }
+
+
+   ~MbusRtuOverTcpServer()
+   {
+      shutdownServer();
+   }
+
+
+   /**
+    * Opens the listening socket.
+    *
+    * @return FTALK_SUCCESS or an FTALK error code
+    */
+   int startupServer()
+   {
+      return openListenSocket(SOCK_STREAM);
+   }
+
+
+   int preparePoll(struct pollfd pollArr[])
+   {
+      int pollCnt = 0;
+      int i;
+
+      for (i = 0; i < portCnt; i++)
+      {
+         pollArr[pollCnt].fd = listenFdArr[i];
+         pollArr[pollCnt].events = POLLIN;
+         connIdxArr[pollCnt++] = -1;
+      }
+      for (i = 0; i < MAX_CONNECTIONS; i++)
+      {
+         if (connArr[i].fd >= 0)
+         {
+            pollArr[pollCnt].fd = connArr[i].fd;
+            pollArr[pollCnt].events = POLLIN;
+            connIdxArr[pollCnt++] = i;
+         }
+      }
+      return pollCnt;
+   }
+
+
+   void servePoll(const struct pollfd pollArr[], int pollCnt)
+   {
+      int i;
+      long now;
+
+      now = getTimeMsec();
+      for (i = portCnt; i < pollCnt; i++)
+      {
+         Connection *connPtr = &connArr[connIdxArr[i]];
+
+         if (pollArr[i].revents != 0)
+         {
+            connPtr->lastActivity = now;
+            serveConnection(connPtr);
+         }
+         else
+            if (now - connPtr->lastActivity > connectionTimeOut)
+               closeConnection(connPtr);
+      }
+      for (i = 0; i < portCnt; i++)
+      {
+         if (pollArr[i].revents & POLLIN)
+            acceptConnection(i, now);
+      }
+   }
+
+
+   void shutdownServer()
+   {
+      int i;
+
+      for (i = 0; i < MAX_CONNECTIONS; i++)
+      {
+         if (connArr[i].fd >= 0)
+            closeConnection(&connArr[i]);
+      }
+      MbusSocketServer::shutdownServer();
+   }
+
+
+   /**
+    * Calculates the Modbus RTU CRC16 of a buffer.
+    *
+    * @param bufPtr Data
+    * @param len Length of data
+    * @return CRC, to be transmitted low byte first
+    */
+   static unsigned int crc16(const unsigned char *bufPtr, int len)
+   {
+      unsigned int crc = 0xFFFF;
+      int i;
+
+      while (len-- > 0)
+      {
+         crc ^= *bufPtr++;
+         for (i = 0; i < 8; i++)
+         {
+            if (crc & 1)
+               crc = (crc >> 1) ^ 0xA001;
+            else
+               crc >>= 1;
+         }
+      }
+      return crc;
+   }
+
+
+  private:
+
+   struct Connection
+   {
+      int fd;
+      int portIdx;
+      long lastActivity;
+      int rxLen;
+      unsigned char rxBuf[MAX_FRAME_SIZE];
+   };
+
+   Connection connArr[MAX_CONNECTIONS];
+   int connIdxArr[MAX_PORTS + MAX_CONNECTIONS]; ///< Connection of a poll entry
+
+
+   /**
+    * Determines the length of an RTU request frame from its header.
+    *
+    * @return Frame length including CRC, 0 if more data is needed to tell
+    * or -1 if the function code has no known request format
+    */
+   static int getRequestLen(const unsigned char *bufPtr, int len)
+   {
+      if (len < 2)
+         return 0;
+      switch (bufPtr[1])
+      {
+         case 1: case 2: case 3: case 4: case 5: case 6: case 8:
+         return 8;
+         case 7: case 11: case 12: case 17:
+         return 4;
+         case 15: case 16:
+         return len < 7 ? 0 : 9 + bufPtr[6];
+         case 20: case 21:
+         return len < 3 ? 0 : 5 + bufPtr[2];
+         case 22:
+         return 10;
+         case 23:
+         return len < 11 ? 0 : 13 + bufPtr[10];
+         case 24:
+         return 6;
+         case 43:
+         return 7;
+      }
+      return -1;
+   }
+
+
+   void acceptConnection(int portIdx, long now)
+   {
+      int fd;
+      int i;
+
+      fd = accept(listenFdArr[portIdx], NULL, NULL);
+      if (fd < 0)
+         return;
+      for (i = 0; i < MAX_CONNECTIONS; i++)
+      {
+         if (connArr[i].fd < 0)
+            break;
+      }
+      if (i == MAX_CONNECTIONS)
+      {
+         close(fd);
+         return;
+      }
+      configureSocket(fd, SOCK_STREAM);
+      connArr[i].fd = fd;
+      connArr[i].portIdx = portIdx;
+      connArr[i].lastActivity = now;
+      connArr[i].rxLen = 0;
+   }
+
+
+   void closeConnection(Connection *connPtr)
+   {
+      close(connPtr->fd);
+      connPtr->fd = -1;
+   }
+
+
+   /**
+    * Executes a broadcast request on all data tables of a port. Broadcasts
+    * are never answered. With a device directory only resident devices
+    * receive the broadcast.
+    */
+   void processBroadcast(int portIdx, const unsigned char *pduPtr, int pduLen)
+   {
+      unsigned char rspBuf[MbusPduProcessor::MAX_PDU_SIZE];
+      MbusDataTableInterface *tablePtr;
+      int i;
+
+      for (i = 1; i < 256; i++)
+      {
+         if (deviceDirPtr != NULL)
+            tablePtr = deviceDirPtr->findDevice(portIdx, i);
+         else
+            tablePtr = getDataTable(0, i);
+         if (tablePtr != NULL)
+            MbusPduProcessor::processPdu(tablePtr, pduPtr, pduLen, rspBuf, NULL,
+                                         getDiagnostics(i), 1);
+      }
+   }
+
+
+   void serveConnection(Connection *connPtr)
+   {
+      unsigned char txBuf[MAX_FRAME_SIZE];
+      char ctrlBuf[64];
+      struct msghdr msg;
+      struct iovec iov;
+      MbusDataTableInterface *tablePtr;
+      long long rxTimeNsec;
+      unsigned int crc;
+      int frameLen;
+      int rspLen;
+      int result;
+
+      iov.iov_base = &connPtr->rxBuf[connPtr->rxLen];
+      iov.iov_len = sizeof(connPtr->rxBuf) - connPtr->rxLen;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = ctrlBuf;
+      msg.msg_controllen = sizeof(ctrlBuf);
+      result = (int) recvmsg(connPtr->fd, &msg, 0);
+      if (result <= 0)
+      {
+         if ((result == 0) || ((errno != EAGAIN) && (errno != EINTR)))
+            closeConnection(connPtr);
+         return;
+      }
+      connPtr->rxLen += result;
+      rxTimeNsec = getRxTimestamp(&msg);
+      if (rxTimeNsec == 0)
+         rxTimeNsec = getRealTimeNsec();
+
+      for (;;)
+      {
+         frameLen = getRequestLen(connPtr->rxBuf, connPtr->rxLen);
+         if (frameLen < 0)
+            frameLen = connPtr->rxLen;
+         if ((frameLen == 0) || (frameLen > connPtr->rxLen))
+         {
+            if (connPtr->rxLen == (int) sizeof(connPtr->rxBuf))
+            {
+               connPtr->rxLen = 0;
+               if (diagnosticsPtr != NULL)
+                  diagnosticsPtr->busOverrun();
+            }
+            return;
+         }
+         if (diagnosticsPtr != NULL)
+            diagnosticsPtr->busMessage();
+         if ((frameLen < 4) || (frameLen > (int) sizeof(connPtr->rxBuf)))
+         {
+            connPtr->rxLen = 0;
+            if (diagnosticsPtr != NULL)
+               diagnosticsPtr->busOverrun();
+            return;
+         }
+         crc = crc16(connPtr->rxBuf, frameLen - 2);
+         if ((connPtr->rxBuf[frameLen - 2] != (crc & 0xFF)) ||
+             (connPtr->rxBuf[frameLen - 1] != (crc >> 8)))
+         {
+            connPtr->rxLen = 0;
+            if (diagnosticsPtr != NULL)
+               diagnosticsPtr->busError();
+            return;
+         }
+         if (connPtr->rxBuf[0] == 0)
+            processBroadcast(connPtr->portIdx, &connPtr->rxBuf[1], frameLen - 3);
+         else
+         {
+            rspLen = 0;
+            tablePtr = getDataTable(connPtr->portIdx, connPtr->rxBuf[0]);
+            if (tablePtr != NULL)
+               rspLen = MbusPduProcessor::processPdu(tablePtr, &connPtr->rxBuf[1],
+                                                     frameLen - 3, &txBuf[1], NULL,
+                                                     getDiagnostics(connPtr->rxBuf[0]));
+            if (rspLen > 0)
+            {
+               txBuf[0] = connPtr->rxBuf[0];
+               crc = crc16(txBuf, rspLen + 1);
+               txBuf[rspLen + 1] = (unsigned char) (crc & 0xFF);
+               txBuf[rspLen + 2] = (unsigned char) (crc >> 8);
+               recordLatency(rxTimeNsec);
+               if (send(connPtr->fd, txBuf, rspLen + 3, MSG_NOSIGNAL) < 0)
+               {
+                  closeConnection(connPtr);
+                  return;
+               }
+            }
+         }
+         connPtr->rxLen -= frameLen;
+         memmove(connPtr->rxBuf, &connPtr->rxBuf[frameLen], connPtr->rxLen);
+      }
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
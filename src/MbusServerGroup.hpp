@@ -0,0 +1,184 @@
+/**
+ * @file MbusServerGroup.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _MBUSSERVERGROUP_H_INCLUDED
+#define _MBUSSERVERGROUP_H_INCLUDED
+
+
+// Platform header
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+
+// Package header
+#include "MbusSocketServer.hpp"
+
+
+/*****************************************************************************
+ * MbusServerGroup class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Event loop serving several socket servers from one thread with
+ * a single poll() call.
+ *
+ * Only servers with events are served, idle servers are visited once a
+ * second to close timed out connections. Each wakeup still collects and
+ * polls the descriptors of all servers of the group, so its cost grows
+ * with the group size. What the group saves is a thread and a wakeup per
+ * server.
+ *
+ * The servers must have been started up and must not be served by any
+ * other thread.
+ */
+class MbusServerGroup
+{
+
+public:
+
+   MbusServerGroup()
+   {
+      serverArr = NULL;
+      pollArr = NULL;
+      serverCnt = 0;
+      lastSweepTime = 0;
+   }
+
+
+   ~MbusServerGroup()
+   {
+      free(serverArr);
+      free(pollArr);
+   }
+
+
+   /**
+    * Adds a server to the group.
+    *
+    * @return 0 on success, -1 if out of memory
+    */
+   int addServer(MbusSocketServer *serverPtr)
+   {
+      Member *newServerArr;
+      struct pollfd *newPollArr;
+
+      newServerArr = (Member *) realloc(serverArr, (serverCnt + 1) * sizeof(Member));
+      if (newServerArr == NULL)
+         return -1;
+      serverArr = newServerArr;
+      newPollArr = (struct pollfd *) realloc(pollArr, (serverCnt + 1) *
+                                             MbusSocketServer::MAX_POLL_FDS *
+                                             sizeof(struct pollfd));
+      if (newPollArr == NULL)
+         return -1;
+      pollArr = newPollArr;
+      serverArr[serverCnt].serverPtr = serverPtr;
+      serverCnt++;
+      return 0;
+   }
+
+
+   int getServerCount()
+   {
+      return serverCnt;
+   }
+
+
+   /**
+    * Waits up to one second for network activity on any server of the
+    * group and serves it.
+    *
+    * @return FTALK_SUCCESS or an FTALK error code
+    */
+   int serverLoop()
+   {
+      int pollCnt = 0;
+      int sweep;
+      int i;
+      int j;
+      long now;
+
+      for (i = 0; i < serverCnt; i++)
+      {
+         serverArr[i].pollIdx = pollCnt;
+         serverArr[i].pollCnt = serverArr[i].serverPtr->preparePoll(&pollArr[pollCnt]);
+         pollCnt += serverArr[i].pollCnt;
+      }
+      if (poll(pollArr, pollCnt, 1000) < 0)
+      {
+         if (errno == EINTR)
+            return FTALK_SUCCESS;
+         return FTALK_IO_ERROR;
+      }
+      now = getTimeMsec();
+      sweep = now - lastSweepTime >= 1000;
+      if (sweep)
+         lastSweepTime = now;
+      for (i = 0; i < serverCnt; i++)
+      {
+         struct pollfd *serverPollArr = &pollArr[serverArr[i].pollIdx];
+
+         for (j = 0; !sweep && (j < serverArr[i].pollCnt); j++)
+         {
+            if (serverPollArr[j].revents != 0)
+               break;
+         }
+         if (sweep || (j < serverArr[i].pollCnt))
+            serverArr[i].serverPtr->servePoll(serverPollArr, serverArr[i].pollCnt);
+      }
+      return FTALK_SUCCESS;
+   }
+
+
+  private:
+
+   struct Member
+   {
+      MbusSocketServer *serverPtr;
+      int pollIdx; ///< First entry of the server in pollArr
+      int pollCnt; ///< Number of entries of the server in pollArr
+   };
+
+   Member *serverArr;
+   struct pollfd *pollArr;
+   int serverCnt;
+   long lastSweepTime;
+
+
+   static long getTimeMsec()
+   {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
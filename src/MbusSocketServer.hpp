@@ -0,0 +1,445 @@
+/**
+ * @file MbusSocketServer.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _MBUSSOCKETSERVER_H_INCLUDED
+#define _MBUSSOCKETSERVER_H_INCLUDED
+
+
+// Platform header
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Package header
+#include "MbusSlaveServer.hpp"
+#include "MbusPduProcessor.hpp"
+#include "LatencyHistogram.hpp"
+#include "DeviceDirectory.hpp"
+
+
+/*****************************************************************************
+ * MbusSocketServer class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Base class for the socket based transports implemented by
+ * diagslave rather than by the FieldTalk library.
+ *
+ * The interface mirrors MbusSlaveServer: data tables are added per unit ID,
+ * the server is started up once and then serverLoop() is called
+ * repeatedly. Requests are dispatched with MbusPduProcessor, so all
+ * transports derived from this class serve the same function codes,
+ * including the file record, mask write, read/write multiple and device
+ * identification functions the FieldTalk transports serve. Instead of
+ * calling serverLoop(), an event loop serving several servers, see
+ * MbusServerGroup, waits on the descriptors of preparePoll() and passes
+ * their events to servePoll().
+ *
+ * Alternatively a DeviceDirectory supplies the data tables. The server
+ * then listens on a range of consecutive ports and each port exposes its
+ * own 255 unit IDs.
+ *
+ * With diagnostics set, the server counts received frames and maintains
+ * the serial line diagnostics of the addressed unit IDs, which masters
+ * query with functions 8, 11 and 12. Device directories are served
+ * without diagnostics.
+ *
+ * With the latency report enabled the time from reception of a request to
+ * sending its response is recorded. Where the platform supports it the
+ * kernel's receive timestamp is used, so the figure includes the time
+ * until the server thread was scheduled.
+ */
+class MbusSocketServer
+{
+
+public:
+
+   enum
+   {
+      MAX_PORTS = 256, ///< Max number of ports served with a device directory
+      MAX_POLL_FDS = MAX_PORTS + 32 ///< Max descriptors of preparePoll()
+   };
+
+
+   MbusSocketServer()
+   {
+      int i;
+
+      memset(dataTablePtrArr, 0, sizeof(dataTablePtrArr));
+      deviceDirPtr = NULL;
+      port = 502;
+      portCnt = 1;
+      connectionTimeOut = 60000;
+      for (i = 0; i < MAX_PORTS; i++)
+         listenFdArr[i] = -1;
+      busyPollUsec = 0;
+      latencyReportEnabled = 0;
+      diagnosticsPtr = NULL;
+   }
+
+
+   virtual ~MbusSocketServer()
+   {
+      MbusSocketServer::shutdownServer();
+   }
+
+
+   /**
+    * Associates a data table with a unit ID. May be called from another
+    * thread while the server runs, NULL removes the unit ID. A replaced
+    * table may still be in use until the server thread returns from
+    * serverLoop().
+    */
+   void addDataTable(int slaveAddr, MbusDataTableInterface *dataTablePtr)
+   {
+      if ((slaveAddr >= 0) && (slaveAddr <= 255))
+         __atomic_store_n(&dataTablePtrArr[slaveAddr], dataTablePtr, __ATOMIC_RELEASE);
+   }
+
+
+   /**
+    * Serves the data tables of a device directory instead of the tables
+    * added with addDataTable().
+    *
+    * @param dirPtr Directory, must stay valid while the server runs
+    * @param portCnt Number of consecutive ports, starting with the port set
+    * with setPort(), to listen on
+    */
+   void setDeviceDirectory(DeviceDirectory *dirPtr, int portCnt)
+   {
+      deviceDirPtr = dirPtr;
+      if ((portCnt >= 1) && (portCnt <= MAX_PORTS))
+         this->portCnt = portCnt;
+   }
+
+
+   void setPort(unsigned short portNo)
+   {
+      port = portNo;
+   }
+
+
+   void setConnectionTimeOut(long timeOut)
+   {
+      connectionTimeOut = timeOut;
+   }
+
+
+   /**
+    * Sets the busy poll time for the server's sockets (SO_BUSY_POLL),
+    * effective on Linux only.
+    *
+    * @param usec Time to busy poll the device queue in microseconds
+    */
+   void setBusyPoll(int usec)
+   {
+      busyPollUsec = usec;
+   }
+
+
+   /**
+    * Sets the diagnostics to maintain, may be shared with other servers.
+    *
+    * @param diagPtr Diagnostics, must stay valid while the server runs
+    */
+   void setDiagnostics(MbusDiagnostics *diagPtr)
+   {
+      diagnosticsPtr = diagPtr;
+   }
+
+
+   /**
+    * Enables recording of request latencies for printStatistics().
+    */
+   void enableLatencyReport()
+   {
+      latencyReportEnabled = 1;
+   }
+
+
+   /**
+    * Waits up to one second for network activity and serves it.
+    *
+    * @return FTALK_SUCCESS or an FTALK error code
+    */
+   int serverLoop()
+   {
+      struct pollfd pollArr[MAX_POLL_FDS];
+      int pollCnt;
+
+      if (listenFdArr[0] < 0)
+         return FTALK_ILLEGAL_STATE_ERROR;
+      pollCnt = preparePoll(pollArr);
+      if (poll(pollArr, pollCnt, 1000) < 0)
+      {
+         if (errno == EINTR)
+            return FTALK_SUCCESS;
+         return FTALK_IO_ERROR;
+      }
+      servePoll(pollArr, pollCnt);
+      return FTALK_SUCCESS;
+   }
+
+
+   /**
+    * Fills a poll array with the descriptors the server waits on.
+    *
+    * @param pollArr Poll array with room for MAX_POLL_FDS entries
+    * @return Number of entries filled
+    */
+   virtual int preparePoll(struct pollfd pollArr[]) = 0;
+
+
+   /**
+    * Serves the events returned for the descriptors of the preceding
+    * preparePoll() and closes idle connections.
+    *
+    * @param pollArr Poll array as filled by preparePoll()
+    * @param pollCnt Number of entries
+    */
+   virtual void servePoll(const struct pollfd pollArr[], int pollCnt) = 0;
+
+
+   int isStarted()
+   {
+      return listenFdArr[0] >= 0;
+   }
+
+
+   /**
+    * Closes all sockets.
+    */
+   virtual void shutdownServer()
+   {
+      int i;
+
+      for (i = 0; i < MAX_PORTS; i++)
+      {
+         if (listenFdArr[i] >= 0)
+            close(listenFdArr[i]);
+         listenFdArr[i] = -1;
+      }
+   }
+
+
+   /**
+    * Prints transport statistics on stdout.
+    */
+   virtual void printStatistics()
+   {
+      if (latencyReportEnabled)
+         latencyHist.print("Response latency");
+      if (deviceDirPtr != NULL)
+         deviceDirPtr->printStatistics();
+   }
+
+
+  protected:
+
+   unsigned short port;
+   int portCnt;
+   long connectionTimeOut;
+   int listenFdArr[MAX_PORTS];
+   int busyPollUsec;
+   int latencyReportEnabled;
+   LatencyHistogram latencyHist;
+   MbusDataTableInterface *dataTablePtrArr[256];
+   DeviceDirectory *deviceDirPtr;
+   MbusDiagnostics *diagnosticsPtr;
+
+
+   /**
+    * Returns the data table addressed by a request.
+    *
+    * @param portIdx Index of the port the request was received on
+    * @param unitId Unit ID of the request
+    * @return Data table or NULL if the unit ID is not served
+    */
+   MbusDataTableInterface *getDataTable(int portIdx, int unitId)
+   {
+      if (deviceDirPtr != NULL)
+         return deviceDirPtr->getDevice(portIdx, unitId);
+      return __atomic_load_n(&dataTablePtrArr[unitId], __ATOMIC_ACQUIRE);
+   }
+
+
+   /**
+    * Returns the diagnostics of a unit ID or NULL if none are maintained.
+    */
+   SlaveDiagnostics *getDiagnostics(int unitId)
+   {
+      if ((diagnosticsPtr == NULL) || (deviceDirPtr != NULL))
+         return NULL;
+      return diagnosticsPtr->getSlave(unitId);
+   }
+
+
+   /**
+    * Applies the configured socket options to a listening or an accepted
+    * socket and makes it non-blocking.
+    */
+   void configureSocket(int fd, int sockType)
+   {
+      int opt = 1;
+
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      if (sockType == SOCK_STREAM)
+         setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+#ifdef SO_TIMESTAMPNS
+      if (latencyReportEnabled)
+         setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &opt, sizeof(opt));
+#endif
+#ifdef SO_BUSY_POLL
+      if (busyPollUsec > 0)
+         setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUsec, sizeof(busyPollUsec));
+#endif
+   }
+
+
+   /**
+    * Extracts the kernel receive timestamp from a received message.
+    *
+    * @param msgPtr Message header as filled in by recvmsg()
+    * @return Receive time (CLOCK_REALTIME) in ns or 0 if not available
+    */
+   static long long getRxTimestamp(struct msghdr *msgPtr)
+   {
+#ifdef SO_TIMESTAMPNS
+      struct cmsghdr *cmsgPtr;
+      struct timespec ts;
+
+      for (cmsgPtr = CMSG_FIRSTHDR(msgPtr); cmsgPtr != NULL;
+           cmsgPtr = CMSG_NXTHDR(msgPtr, cmsgPtr))
+      {
+         if ((cmsgPtr->cmsg_level == SOL_SOCKET) &&
+             (cmsgPtr->cmsg_type == SCM_TIMESTAMPNS))
+         {
+            memcpy(&ts, CMSG_DATA(cmsgPtr), sizeof(ts));
+            return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+         }
+      }
+#endif
+      return 0;
+   }
+
+
+   /**
+    * Records the latency of a response which is about to be sent.
+    *
+    * @param rxTimeNsec Receive time (CLOCK_REALTIME) of the request in ns
+    */
+   void recordLatency(long long rxTimeNsec)
+   {
+      if (latencyReportEnabled && (rxTimeNsec != 0))
+         latencyHist.record(getRealTimeNsec() - rxTimeNsec);
+   }
+
+
+   /**
+    * Opens, binds and, for stream sockets, listens on the server ports.
+    *
+    * @param sockType SOCK_STREAM or SOCK_DGRAM
+    * @return FTALK_SUCCESS or an FTALK error code
+    */
+   int openListenSocket(int sockType)
+   {
+      struct sockaddr_in addr;
+      int opt = 1;
+      int fd;
+      int i;
+
+      if ((int) port + portCnt - 1 > 0xFFFF)
+         return FTALK_ILLEGAL_ARGUMENT_ERROR;
+      for (i = 0; i < portCnt; i++)
+      {
+         fd = socket(AF_INET, sockType, 0);
+         if (fd < 0)
+         {
+            shutdownServer();
+            return FTALK_OPEN_ERR;
+         }
+         listenFdArr[i] = fd;
+         setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+         memset(&addr, 0, sizeof(addr));
+         addr.sin_family = AF_INET;
+         addr.sin_addr.s_addr = htonl(INADDR_ANY);
+         addr.sin_port = htons((unsigned short) (port + i));
+         if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+         {
+            shutdownServer();
+            return FTALK_PORT_ALREADY_BOUND;
+         }
+         if ((sockType == SOCK_STREAM) && (listen(fd, 16) < 0))
+         {
+            shutdownServer();
+            return FTALK_LISTEN_FAILED;
+         }
+         if (sockType == SOCK_STREAM)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+         else
+            configureSocket(fd, sockType);
+      }
+      return FTALK_SUCCESS;
+   }
+
+
+   static long getTimeMsec()
+   {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+   }
+
+
+   static long long getRealTimeNsec()
+   {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+   }
+
+
+   static unsigned long long getTimeUsec()
+   {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
@@ -0,0 +1,593 @@
+/**
+ * @file MbusTlsServer.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _MBUSTLSSERVER_H_INCLUDED
+#define _MBUSTLSSERVER_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+// Package header
+#include "MbusSocketServer.hpp"
+
+
+/*****************************************************************************
+ * MbusTlsServer class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Modbus/TCP Security server (Modbus/TCP over TLS).
+ *
+ * Implements the server side of the MODBUS/TCP Security Protocol
+ * Specification: TLS 1.2 or later on port 802, mutual authentication with
+ * X.509 certificates and role based authorization. The role is taken from
+ * the client certificate's Modbus Role extension (OID
+ * 1.3.6.1.4.1.50316.802.1) and looked up in a table which maps role names to
+ * allowed function codes. If no roles are configured, every authenticated
+ * client may execute every function code.
+ *
+ * The server keeps a session cache and issues session tickets so
+ * reconnecting masters resume their session with an abbreviated handshake.
+ *
+ * All connections are served from one thread by calling serverLoop()
+ * repeatedly or from an event loop. Responses are buffered per connection
+ * and written when the socket is writable, so a master that does not read
+ * its responses never blocks the thread. Such a master's requests are only
+ * read once its pending output has been taken.
+ */
+class MbusTlsServer: public MbusSocketServer
+{
+
+public:
+
+   enum
+   {
+      MAX_CONNECTIONS = 32, ///< Max number of simultaneous connections
+      MAX_ROLES = 16,       ///< Max number of configured roles
+      TX_BUF_SIZE = 4 * (7 + MbusPduProcessor::MAX_PDU_SIZE) ///< Output per connection
+   };
+
+
+   MbusTlsServer()
+   {
+      memset(connArr, 0, sizeof(connArr));
+      memset(roleArr, 0, sizeof(roleArr));
+      memset(&stats, 0, sizeof(stats));
+      roleCnt = 0;
+      port = 802;
+      sslCtxPtr = NULL;
+   }
+
+
+   ~MbusTlsServer()
+   {
+      shutdownServer();
+   }
+
+
+   /**
+    * Adds a role and the function codes it authorizes.
+    *
+    * @param roleSpec Role specification in the form NAME=FC,FC,...
+    * @return FTALK_SUCCESS or FTALK_ILLEGAL_ARGUMENT_ERROR
+    */
+   int addRole(const char *roleSpec)
+   {
+      const char *eqPtr = strchr(roleSpec, '=');
+      char *endPtr;
+      long functionCode;
+      Role *rolePtr;
+
+      if ((eqPtr == NULL) || (eqPtr == roleSpec) ||
+          (eqPtr - roleSpec >= (int) sizeof(rolePtr->name)) ||
+          (roleCnt >= MAX_ROLES))
+         return FTALK_ILLEGAL_ARGUMENT_ERROR;
+      rolePtr = &roleArr[roleCnt];
+      memcpy(rolePtr->name, roleSpec, eqPtr - roleSpec);
+      rolePtr->name[eqPtr - roleSpec] = '\0';
+      endPtr = (char *) eqPtr;
+      do
+      {
+         functionCode = strtol(endPtr + 1, &endPtr, 0);
+         if ((functionCode < 1) || (functionCode > 127))
+            return FTALK_ILLEGAL_ARGUMENT_ERROR;
+         MbusPduProcessor::allowFunction(rolePtr->fcMaskArr, (int) functionCode);
+      } while (*endPtr == ',');
+      if (*endPtr != '\0')
+         return FTALK_ILLEGAL_ARGUMENT_ERROR;
+      roleCnt++;
+      return FTALK_SUCCESS;
+   }
+
+
+   /**
+    * Creates the TLS context and opens the listening socket.
+    *
+    * @param certFileName PEM file with server certificate chain
+    * @param keyFileName PEM file with server private key
+    * @param caFileName PEM file with CA certificates used to verify
+    * clients or NULL to not request a client certificate
+    * @return FTALK_SUCCESS or an FTALK error code
+    */
+   int startupServer(const char *certFileName, const char *keyFileName,
+                     const char *caFileName)
+   {
+      if ((certFileName == NULL) || (keyFileName == NULL))
+         return FTALK_ILLEGAL_ARGUMENT_ERROR;
+      if (sslCtxPtr != NULL)
+         return FTALK_ILLEGAL_STATE_ERROR;
+
+      SSL_library_init();
+      SSL_load_error_strings();
+      sslCtxPtr = SSL_CTX_new(SSLv23_server_method());
+      if (sslCtxPtr == NULL)
+         return tlsError();
+      SSL_CTX_set_options(sslCtxPtr, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 |
+                                     SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1 |
+                                     SSL_OP_NO_COMPRESSION);
+#ifdef SSL_OP_NO_RENEGOTIATION
+      SSL_CTX_set_options(sslCtxPtr, SSL_OP_NO_RENEGOTIATION);
+#endif
+      // Responses are appended to the output buffer while a write is pending
+      SSL_CTX_set_mode(sslCtxPtr, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+      if (SSL_CTX_use_certificate_chain_file(sslCtxPtr, certFileName) != 1)
+         return tlsError();
+      if (SSL_CTX_use_PrivateKey_file(sslCtxPtr, keyFileName, SSL_FILETYPE_PEM) != 1)
+         return tlsError();
+      if (caFileName != NULL)
+      {
+         if (SSL_CTX_load_verify_locations(sslCtxPtr, caFileName, NULL) != 1)
+            return tlsError();
+         SSL_CTX_set_verify(sslCtxPtr, SSL_VERIFY_PEER |
+                                       SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+      }
+
+      //
+      // Session resumption: a server side cache for session IDs and
+      // stateless session tickets. A session ID context is mandatory
+      // when client certificates are verified, otherwise OpenSSL refuses
+      // to resume.
+      //
+      SSL_CTX_set_session_cache_mode(sslCtxPtr, SSL_SESS_CACHE_SERVER);
+      SSL_CTX_set_session_id_context(sslCtxPtr,
+                                     (const unsigned char *) "diagslave", 9);
+      SSL_CTX_sess_set_cache_size(sslCtxPtr, 1024);
+      SSL_CTX_set_timeout(sslCtxPtr, 7200);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+      SSL_CTX_set_num_tickets(sslCtxPtr, 1);
+#endif
+
+      return openListenSocket(SOCK_STREAM);
+   }
+
+
+   int preparePoll(struct pollfd pollArr[])
+   {
+      int pollCnt = 0;
+      int i;
+
+      pollArr[pollCnt].fd = listenFdArr[0];
+      pollArr[pollCnt].events = POLLIN;
+      connIdxArr[pollCnt++] = -1;
+      for (i = 0; i < MAX_CONNECTIONS; i++)
+      {
+         if (connArr[i].sslPtr != NULL)
+         {
+            pollArr[pollCnt].fd = connArr[i].fd;
+            if (connArr[i].txLen > 0)
+               pollArr[pollCnt].events = connArr[i].txEvents;
+            else
+               pollArr[pollCnt].events = POLLIN;
+            connIdxArr[pollCnt++] = i;
+         }
+      }
+      return pollCnt;
+   }
+
+
+   void servePoll(const struct pollfd pollArr[], int pollCnt)
+   {
+      int i;
+      long now;
+
+      now = getTimeMsec();
+      for (i = 1; i < pollCnt; i++)
+      {
+         Connection *connPtr = &connArr[connIdxArr[i]];
+
+         if (pollArr[i].revents != 0)
+         {
+            connPtr->lastActivity = now;
+            serveConnection(connPtr);
+         }
+         else
+            if (now - connPtr->lastActivity > connectionTimeOut)
+               closeConnection(connPtr);
+      }
+      if (pollArr[0].revents & POLLIN)
+         acceptConnection(now);
+   }
+
+
+   void shutdownServer()
+   {
+      int i;
+
+      for (i = 0; i < MAX_CONNECTIONS; i++)
+      {
+         if (connArr[i].sslPtr != NULL)
+            closeConnection(&connArr[i]);
+      }
+      MbusSocketServer::shutdownServer();
+      if (sslCtxPtr != NULL)
+         SSL_CTX_free(sslCtxPtr);
+      sslCtxPtr = NULL;
+   }
+
+
+   void printStatistics()
+   {
+      printf("TLS statistics: ");
+      printf("%lu full handshakes", stats.fullHandshakes);
+      if (stats.fullHandshakes)
+         printf(" (%.1f us avg)", (double) stats.fullHandshakeUsec / stats.fullHandshakes);
+      printf(", %lu resumed", stats.resumedHandshakes);
+      if (stats.resumedHandshakes)
+         printf(" (%.1f us avg)", (double) stats.resumedHandshakeUsec / stats.resumedHandshakes);
+      printf(", %lu failed, ", stats.failedHandshakes);
+      printf("%lu records", stats.records);
+      if (stats.records)
+         printf(" (%.1f us avg)", (double) stats.recordUsec / stats.records);
+      printf(", %lu unauthorized\n", stats.unauthorized);
+      MbusSocketServer::printStatistics();
+   }
+
+
+  private:
+
+   struct Role
+   {
+      char name[64];
+      unsigned char fcMaskArr[32];
+   };
+
+   struct Connection
+   {
+      int fd;
+      SSL *sslPtr;
+      int handshakeDone;
+      long lastActivity;
+      const unsigned char *fcMaskPtr;
+      int rxLen;
+      unsigned char rxBuf[7 + MbusPduProcessor::MAX_PDU_SIZE];
+      int txLen;
+      short txEvents; ///< Poll events the pending output waits for
+      unsigned char txBuf[TX_BUF_SIZE];
+   };
+
+   struct Statistics
+   {
+      unsigned long fullHandshakes;
+      unsigned long resumedHandshakes;
+      unsigned long failedHandshakes;
+      unsigned long records;
+      unsigned long unauthorized;
+      unsigned long long fullHandshakeUsec;
+      unsigned long long resumedHandshakeUsec;
+      unsigned long long recordUsec;
+   };
+
+   SSL_CTX *sslCtxPtr;
+   Connection connArr[MAX_CONNECTIONS];
+   int connIdxArr[MAX_CONNECTIONS + 1]; ///< Connection of a poll entry
+   Role roleArr[MAX_ROLES];
+   int roleCnt;
+   Statistics stats;
+   unsigned long long handshakeUsecArr[MAX_CONNECTIONS];
+
+
+   static int tlsError()
+   {
+      ERR_print_errors_fp(stderr);
+      return FTALK_ILLEGAL_ARGUMENT_ERROR;
+   }
+
+
+   void acceptConnection(long now)
+   {
+      int fd;
+      int i;
+
+      fd = accept(listenFdArr[0], NULL, NULL);
+      if (fd < 0)
+         return;
+      for (i = 0; i < MAX_CONNECTIONS; i++)
+      {
+         if (connArr[i].sslPtr == NULL)
+            break;
+      }
+      if (i == MAX_CONNECTIONS)
+      {
+         close(fd);
+         return;
+      }
+      configureSocket(fd, SOCK_STREAM);
+      connArr[i].sslPtr = SSL_new(sslCtxPtr);
+      if (connArr[i].sslPtr == NULL)
+      {
+         close(fd);
+         return;
+      }
+      SSL_set_fd(connArr[i].sslPtr, fd);
+      SSL_set_accept_state(connArr[i].sslPtr);
+      connArr[i].fd = fd;
+      connArr[i].handshakeDone = 0;
+      connArr[i].lastActivity = now;
+      connArr[i].fcMaskPtr = NULL;
+      connArr[i].rxLen = 0;
+      connArr[i].txLen = 0;
+      handshakeUsecArr[i] = 0;
+   }
+
+
+   void closeConnection(Connection *connPtr)
+   {
+      if (connPtr->handshakeDone)
+         SSL_shutdown(connPtr->sslPtr);
+      SSL_free(connPtr->sslPtr);
+      close(connPtr->fd);
+      connPtr->sslPtr = NULL;
+      connPtr->fd = -1;
+   }
+
+
+   /**
+    * Looks up the role of the client certificate in the role table.
+    *
+    * @return Function code mask of the role, NULL if all function codes
+    * are allowed
+    */
+   const unsigned char *lookupRole(SSL *sslPtr)
+   {
+      static const unsigned char denyAllArr[32] = { 0 };
+      const unsigned char *fcMaskPtr = denyAllArr;
+      X509 *certPtr;
+      ASN1_OBJECT *oidPtr;
+      int extIdx;
+      int i;
+
+      if (roleCnt == 0)
+         return NULL;
+      certPtr = SSL_get_peer_certificate(sslPtr);
+      if (certPtr == NULL)
+         return denyAllArr;
+      oidPtr = OBJ_txt2obj("1.3.6.1.4.1.50316.802.1", 1);
+      extIdx = X509_get_ext_by_OBJ(certPtr, oidPtr, -1);
+      if (extIdx >= 0)
+      {
+         ASN1_OCTET_STRING *extDataPtr =
+            X509_EXTENSION_get_data(X509_get_ext(certPtr, extIdx));
+         const unsigned char *derPtr = ASN1_STRING_get0_data(extDataPtr);
+         ASN1_UTF8STRING *roleStrPtr =
+            d2i_ASN1_UTF8STRING(NULL, &derPtr, ASN1_STRING_length(extDataPtr));
+
+         if (roleStrPtr != NULL)
+         {
+            for (i = 0; i < roleCnt; i++)
+            {
+               if ((ASN1_STRING_length(roleStrPtr) == (int) strlen(roleArr[i].name)) &&
+                   (memcmp(ASN1_STRING_get0_data(roleStrPtr), roleArr[i].name,
+                           strlen(roleArr[i].name)) == 0))
+               {
+                  fcMaskPtr = roleArr[i].fcMaskArr;
+                  break;
+               }
+            }
+            ASN1_UTF8STRING_free(roleStrPtr);
+         }
+      }
+      ASN1_OBJECT_free(oidPtr);
+      X509_free(certPtr);
+      return fcMaskPtr;
+   }
+
+
+   int doHandshake(Connection *connPtr)
+   {
+      int connIdx = (int) (connPtr - connArr);
+      unsigned long long startTime = getTimeUsec();
+      int result;
+
+      result = SSL_do_handshake(connPtr->sslPtr);
+      handshakeUsecArr[connIdx] += getTimeUsec() - startTime;
+      if (result == 1)
+      {
+         connPtr->handshakeDone = 1;
+         connPtr->fcMaskPtr = lookupRole(connPtr->sslPtr);
+         if (SSL_session_reused(connPtr->sslPtr))
+         {
+            stats.resumedHandshakes++;
+            stats.resumedHandshakeUsec += handshakeUsecArr[connIdx];
+         }
+         else
+         {
+            stats.fullHandshakes++;
+            stats.fullHandshakeUsec += handshakeUsecArr[connIdx];
+         }
+         return 1;
+      }
+      result = SSL_get_error(connPtr->sslPtr, result);
+      if ((result == SSL_ERROR_WANT_READ) || (result == SSL_ERROR_WANT_WRITE))
+         return 0;
+      stats.failedHandshakes++;
+      ERR_clear_error();
+      closeConnection(connPtr);
+      return -1;
+   }
+
+
+   /**
+    * Writes as much pending output as the socket accepts without blocking.
+    * What is left is written when the socket reports txEvents.
+    *
+    * @return 0 on success, -1 if the connection failed
+    */
+   int flushOutput(Connection *connPtr)
+   {
+      int result;
+
+      while (connPtr->txLen > 0)
+      {
+         result = SSL_write(connPtr->sslPtr, connPtr->txBuf, connPtr->txLen);
+         if (result > 0)
+         {
+            connPtr->txLen -= result;
+            memmove(connPtr->txBuf, &connPtr->txBuf[result], connPtr->txLen);
+            continue;
+         }
+         result = SSL_get_error(connPtr->sslPtr, result);
+         if ((result != SSL_ERROR_WANT_WRITE) && (result != SSL_ERROR_WANT_READ))
+         {
+            // Includes EPIPE of a master gone away, the caller closes
+            ERR_clear_error();
+            return -1;
+         }
+         connPtr->txEvents = (short) (result == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN);
+         return 0;
+      }
+      return 0;
+   }
+
+
+   void serveConnection(Connection *connPtr)
+   {
+      unsigned char *txPtr;
+      unsigned long long startTime;
+      long long rxTimeNsec = getRealTimeNsec();
+      int frameLen;
+      int rspLen;
+      int result;
+
+      if (!connPtr->handshakeDone)
+      {
+         if (doHandshake(connPtr) <= 0)
+            return;
+      }
+      startTime = getTimeUsec();
+      for (;;)
+      {
+         //
+         // Process all complete MBAP frames in the buffer. While the output
+         // buffer has no room for another response, the remaining frames
+         // wait until the socket takes the pending output.
+         //
+         while (connPtr->rxLen >= 7)
+         {
+            frameLen = 6 + ((connPtr->rxBuf[4] << 8) | connPtr->rxBuf[5]);
+            if ((connPtr->rxBuf[2] != 0) || (connPtr->rxBuf[3] != 0) ||
+                (frameLen < 8) || (frameLen > (int) sizeof(connPtr->rxBuf)))
+            {
+               closeConnection(connPtr);
+               return;
+            }
+            if (connPtr->rxLen < frameLen)
+               break;
+            if (connPtr->txLen > TX_BUF_SIZE - (7 + MbusPduProcessor::MAX_PDU_SIZE))
+            {
+               if (flushOutput(connPtr) < 0)
+               {
+                  closeConnection(connPtr);
+                  return;
+               }
+               if (connPtr->txLen > TX_BUF_SIZE - (7 + MbusPduProcessor::MAX_PDU_SIZE))
+                  return;
+            }
+            if (diagnosticsPtr != NULL)
+               diagnosticsPtr->busMessage();
+            if (!MbusPduProcessor::isFunctionAllowed(connPtr->fcMaskPtr,
+                                                     connPtr->rxBuf[7]))
+               stats.unauthorized++;
+            txPtr = &connPtr->txBuf[connPtr->txLen];
+            rspLen = MbusPduProcessor::processPdu(
+                        getDataTable(0, connPtr->rxBuf[6]),
+                        &connPtr->rxBuf[7], frameLen - 7, &txPtr[7],
+                        connPtr->fcMaskPtr, getDiagnostics(connPtr->rxBuf[6]));
+            if (rspLen > 0)
+            {
+               memcpy(txPtr, connPtr->rxBuf, 4);
+               txPtr[4] = (unsigned char) ((rspLen + 1) >> 8);
+               txPtr[5] = (unsigned char) (rspLen + 1);
+               txPtr[6] = connPtr->rxBuf[6];
+               recordLatency(rxTimeNsec);
+               connPtr->txLen += 7 + rspLen;
+            }
+            stats.records++;
+            stats.recordUsec += getTimeUsec() - startTime;
+            startTime = getTimeUsec();
+            connPtr->rxLen -= frameLen;
+            memmove(connPtr->rxBuf, &connPtr->rxBuf[frameLen], connPtr->rxLen);
+         }
+         if (flushOutput(connPtr) < 0)
+         {
+            closeConnection(connPtr);
+            return;
+         }
+         startTime = getTimeUsec();
+         result = SSL_read(connPtr->sslPtr, &connPtr->rxBuf[connPtr->rxLen],
+                           sizeof(connPtr->rxBuf) - connPtr->rxLen);
+         if (result <= 0)
+         {
+            result = SSL_get_error(connPtr->sslPtr, result);
+            if ((result != SSL_ERROR_WANT_READ) && (result != SSL_ERROR_WANT_WRITE))
+            {
+               ERR_clear_error();
+               closeConnection(connPtr);
+            }
+            return;
+         }
+         connPtr->rxLen += result;
+      }
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
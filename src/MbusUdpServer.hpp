@@ -0,0 +1,290 @@
+/**
+ * @file MbusUdpServer.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _MBUSUDPSERVER_H_INCLUDED
+#define _MBUSUDPSERVER_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+// Package header
+#include "MbusSocketServer.hpp"
+
+
+/*****************************************************************************
+ * MbusUdpServer class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Modbus/UDP server.
+ *
+ * Each datagram carries one MBAP framed request, the response is sent back
+ * to the datagram's source. On Linux the socket is drained with recvmmsg()
+ * and the responses of a batch are sent with a single sendmmsg(), so one
+ * pair of system calls serves up to BATCH_SIZE requests.
+ */
+class MbusUdpServer: public MbusSocketServer
+{
+
+public:
+
+   enum
+   {
+      BATCH_SIZE = 32,                              ///< Datagrams per syscall
+      MAX_ADU_SIZE = 7 + MbusPduProcessor::MAX_PDU_SIZE ///< MBAP header + PDU
+   };
+
+
+   MbusUdpServer()
+   {
+      memset(&stats, 0, sizeof(stats));
+   }
+
+
+   ~MbusUdpServer()
+   {
+      shutdownServer();
+   }
+
+
+   /**
+    * Opens the UDP socket.
+    *
+    * @return FTALK_SUCCESS or an FTALK error code
+    */
+   int startupServer()
+   {
+      return openListenSocket(SOCK_DGRAM);
+   }
+
+
+   int preparePoll(struct pollfd pollArr[])
+   {
+      int i;
+
+      for (i = 0; i < portCnt; i++)
+      {
+         pollArr[i].fd = listenFdArr[i];
+         pollArr[i].events = POLLIN;
+      }
+      return portCnt;
+   }
+
+
+   void servePoll(const struct pollfd pollArr[], int pollCnt)
+   {
+      int rxCnt;
+      int i;
+
+      for (i = 0; i < pollCnt; i++)
+      {
+         if (!(pollArr[i].revents & POLLIN))
+            continue;
+         do
+         {
+            rxCnt = receiveBatch(listenFdArr[i]);
+            if (rxCnt > 0)
+               sendBatch(i, rxCnt);
+         } while (rxCnt == BATCH_SIZE);
+      }
+   }
+
+
+   void printStatistics()
+   {
+      printf("UDP statistics: %lu datagrams in %lu receive calls", stats.rxDatagrams,
+             stats.rxCalls);
+      if (stats.rxCalls)
+         printf(" (%.1f per call)", (double) stats.rxDatagrams / stats.rxCalls);
+      printf(", %lu malformed\n", stats.malformed);
+      MbusSocketServer::printStatistics();
+   }
+
+
+  private:
+
+   struct Statistics
+   {
+      unsigned long rxDatagrams;
+      unsigned long rxCalls;
+      unsigned long malformed;
+   };
+
+   unsigned char rxBufArr[BATCH_SIZE][MAX_ADU_SIZE];
+   unsigned char txBufArr[BATCH_SIZE][MAX_ADU_SIZE];
+   int rxLenArr[BATCH_SIZE];
+   long long rxTimeArr[BATCH_SIZE];
+   char ctrlBufArr[BATCH_SIZE][64];
+   struct sockaddr_storage addrArr[BATCH_SIZE];
+   socklen_t addrLenArr[BATCH_SIZE];
+   Statistics stats;
+
+
+   /**
+    * Reads as many pending datagrams as fit into one batch.
+    *
+    * @param fd Socket to read from
+    * @return Number of datagrams received
+    */
+   int receiveBatch(int fd)
+   {
+      int rxCnt;
+      int i;
+
+#ifdef __linux__
+      struct mmsghdr msgArr[BATCH_SIZE];
+      struct iovec iovArr[BATCH_SIZE];
+
+      memset(msgArr, 0, sizeof(msgArr));
+      for (i = 0; i < BATCH_SIZE; i++)
+      {
+         iovArr[i].iov_base = rxBufArr[i];
+         iovArr[i].iov_len = MAX_ADU_SIZE;
+         msgArr[i].msg_hdr.msg_iov = &iovArr[i];
+         msgArr[i].msg_hdr.msg_iovlen = 1;
+         msgArr[i].msg_hdr.msg_name = &addrArr[i];
+         msgArr[i].msg_hdr.msg_namelen = sizeof(addrArr[i]);
+         msgArr[i].msg_hdr.msg_control = ctrlBufArr[i];
+         msgArr[i].msg_hdr.msg_controllen = sizeof(ctrlBufArr[i]);
+      }
+      rxCnt = recvmmsg(fd, msgArr, BATCH_SIZE, MSG_DONTWAIT, NULL);
+      stats.rxCalls++;
+      if (rxCnt <= 0)
+         return 0;
+      for (i = 0; i < rxCnt; i++)
+      {
+         rxLenArr[i] = (int) msgArr[i].msg_len;
+         addrLenArr[i] = msgArr[i].msg_hdr.msg_namelen;
+         rxTimeArr[i] = getRxTimestamp(&msgArr[i].msg_hdr);
+         if (rxTimeArr[i] == 0)
+            rxTimeArr[i] = getRealTimeNsec();
+      }
+#else
+      for (rxCnt = 0; rxCnt < BATCH_SIZE; rxCnt++)
+      {
+         addrLenArr[rxCnt] = sizeof(addrArr[rxCnt]);
+         i = (int) recvfrom(fd, rxBufArr[rxCnt], MAX_ADU_SIZE,
+                            MSG_DONTWAIT, (struct sockaddr *) &addrArr[rxCnt],
+                            &addrLenArr[rxCnt]);
+         stats.rxCalls++;
+         if (i <= 0)
+            break;
+         rxLenArr[rxCnt] = i;
+         rxTimeArr[rxCnt] = getRealTimeNsec();
+      }
+#endif
+      stats.rxDatagrams += rxCnt;
+      return rxCnt;
+   }
+
+
+   /**
+    * Processes a batch of received datagrams and sends the responses.
+    *
+    * @param portIdx Index of the port the batch was received on
+    * @param rxCnt Number of datagrams in the batch
+    */
+   void sendBatch(int portIdx, int rxCnt)
+   {
+      int fd = listenFdArr[portIdx];
+      int txIdxArr[BATCH_SIZE];
+      int txLenArr[BATCH_SIZE];
+      int txCnt = 0;
+      int rspLen;
+      int i;
+
+      for (i = 0; i < rxCnt; i++)
+      {
+         unsigned char *rxPtr = rxBufArr[i];
+         unsigned char *txPtr = txBufArr[txCnt];
+
+         if (diagnosticsPtr != NULL)
+            diagnosticsPtr->busMessage();
+         if ((rxLenArr[i] < 8) || (rxPtr[2] != 0) || (rxPtr[3] != 0) ||
+             (((rxPtr[4] << 8) | rxPtr[5]) != rxLenArr[i] - 6))
+         {
+            stats.malformed++;
+            if (diagnosticsPtr != NULL)
+               diagnosticsPtr->busError();
+            continue;
+         }
+         rspLen = MbusPduProcessor::processPdu(getDataTable(portIdx, rxPtr[6]),
+                                               &rxPtr[7], rxLenArr[i] - 7,
+                                               &txPtr[7], NULL,
+                                               getDiagnostics(rxPtr[6]));
+         if (rspLen <= 0)
+            continue;
+         memcpy(txPtr, rxPtr, 4);
+         txPtr[4] = (unsigned char) ((rspLen + 1) >> 8);
+         txPtr[5] = (unsigned char) (rspLen + 1);
+         txPtr[6] = rxPtr[6];
+         recordLatency(rxTimeArr[i]);
+         txIdxArr[txCnt] = i;
+         txLenArr[txCnt] = 7 + rspLen;
+         txCnt++;
+      }
+
+#ifdef __linux__
+      struct mmsghdr msgArr[BATCH_SIZE];
+      struct iovec iovArr[BATCH_SIZE];
+      int sentCnt = 0;
+
+      memset(msgArr, 0, sizeof(msgArr));
+      for (i = 0; i < txCnt; i++)
+      {
+         iovArr[i].iov_base = txBufArr[i];
+         iovArr[i].iov_len = txLenArr[i];
+         msgArr[i].msg_hdr.msg_iov = &iovArr[i];
+         msgArr[i].msg_hdr.msg_iovlen = 1;
+         msgArr[i].msg_hdr.msg_name = &addrArr[txIdxArr[i]];
+         msgArr[i].msg_hdr.msg_namelen = addrLenArr[txIdxArr[i]];
+      }
+      while (sentCnt < txCnt)
+      {
+         i = sendmmsg(fd, &msgArr[sentCnt], txCnt - sentCnt, 0);
+         if (i <= 0)
+            break;
+         sentCnt += i;
+      }
+#else
+      for (i = 0; i < txCnt; i++)
+      {
+         sendto(fd, txBufArr[i], txLenArr[i], 0,
+                (struct sockaddr *) &addrArr[txIdxArr[i]], addrLenArr[txIdxArr[i]]);
+      }
+#endif
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
@@ -0,0 +1,536 @@
+/**
+ * @file ProfileDataTable.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _PROFILEDATATABLE_H_INCLUDED
+#define _PROFILEDATATABLE_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <string.h>
+
+// Package header
+#include "DiagnosticDataTable.hpp"
+
+
+/*****************************************************************************
+ * Profile access permissions
+ *****************************************************************************/
+
+enum
+{
+   PROFILE_READ_BITS = 0x01,    ///< Read coils and discrete inputs
+   PROFILE_WRITE_BITS = 0x02,   ///< Write coils
+   PROFILE_READ_REGS = 0x04,    ///< Read input and holding registers
+   PROFILE_WRITE_REGS = 0x08,   ///< Write holding registers
+   PROFILE_FILE_RECORDS = 0x10, ///< Read and write file records
+   PROFILE_ALL_ACCESS = 0x1F
+};
+
+
+/*****************************************************************************
+ * Profile instrumentation hooks
+ *****************************************************************************/
+
+enum
+{
+   PROFILE_HOOK_LOGGING = 0x01,      ///< Log data accesses while logging is on
+   PROFILE_HOOK_SERVICE_TIME = 0x02, ///< Feed the service time report (-j)
+   PROFILE_HOOK_ACCESS = 0x04,       ///< Feed the access profiler (-q)
+   PROFILE_HOOK_HISTORY = 0x08,      ///< Feed the register history (-H)
+   PROFILE_HOOK_INSTRUMENTS = 0x0E   ///< All hooks but logging
+};
+
+
+//
+// Hooks of ProfileMbusDataTable, a hook not in HOOKS compiles to nothing
+//
+#ifndef _WIN32
+#  define PROFILE_MEASURE_SERVICE_TIME() \
+      LatencyTimer latencyTimer((HOOKS & PROFILE_HOOK_SERVICE_TIME) ? \
+                                DiagnosticMbusDataTable::serviceTimeHistPtr : NULL)
+#else
+#  define PROFILE_MEASURE_SERVICE_TIME()
+#endif
+#define PROFILE_RECORD_ACCESS(slaveAddr, fc, startAddr, refCnt) \
+   do { \
+      if (HOOKS & PROFILE_HOOK_ACCESS) \
+         PROFILE_ACCESS(slaveAddr, fc, startAddr, refCnt); \
+   } while (0)
+#define PROFILE_RECORD_HISTORY(slaveAddr, startAddr, regArr, refCnt) \
+   do { \
+      if (HOOKS & PROFILE_HOOK_HISTORY) \
+         RECORD_HISTORY(slaveAddr, startAddr, regArr, refCnt); \
+   } while (0)
+#define PROFILE_LOGGING() \
+   ((HOOKS & PROFILE_HOOK_LOGGING) && DiagnosticMbusDataTable::logging)
+
+
+/*****************************************************************************
+ * ProfileMbusDataTable class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Data table of a fixed device model.
+ *
+ * Behaves like DiagnosticMbusDataTable, but the bank sizes, the permitted
+ * accesses and the instrumentation hooks are template parameters. Range
+ * checks compare against constants and callbacks of accesses which are
+ * not permitted reduce to a return of 0. Hooks not selected compile to
+ * nothing, so a table without hooks only checks the range and copies the
+ * data under the sequence lock.
+ *
+ * As in DiagnosticMbusDataTable input and holding registers share one
+ * bank and so do coils and discrete inputs. Data is guarded by a sequence
+ * lock because the TLS listener serves the same tables from its own
+ * thread.
+ *
+ * @param REG_CNT Number of registers, 1 - 0x10000
+ * @param BIT_CNT Number of coils, 0 - 2000
+ * @param ACCESS Permitted accesses, a combination of the PROFILE_xxx flags
+ * @param HOOKS Instrumentation hooks, a combination of the PROFILE_HOOK_xxx
+ * flags
+ */
+template <int REG_CNT, int BIT_CNT, int ACCESS, int HOOKS>
+class ProfileMbusDataTable: public AdminMbusDataTable
+{
+
+public:
+
+   ProfileMbusDataTable(int slaveAddr)
+   {
+      this->slaveAddr = slaveAddr;
+      seq = 0;
+      memset(regData, 0, sizeof(regData));
+      memset(bitData, 0, sizeof(bitData));
+   }
+
+
+   char readExceptionStatus()
+   {
+      PROFILE_MEASURE_SERVICE_TIME();
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: readExceptionStatus\n", slaveAddr);
+      return (char) DiagnosticMbusDataTable::exceptionStatusArr[slaveAddr & 0xFF];
+   }
+
+
+   int readInputDiscretesTable(int startRef,
+                               char bitArr[],
+                               int refCnt)
+   {
+      PROFILE_MEASURE_SERVICE_TIME();
+      PROFILE_RECORD_ACCESS(slaveAddr, 2, startRef - 1, refCnt);
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: readInputDiscretes from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
+      return readBits(startRef, bitArr, refCnt);
+   }
+
+
+   int readCoilsTable(int startRef,
+                      char bitArr[],
+                      int refCnt)
+   {
+      PROFILE_MEASURE_SERVICE_TIME();
+      PROFILE_RECORD_ACCESS(slaveAddr, 1, startRef - 1, refCnt);
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: readCoils from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
+      return readBits(startRef, bitArr, refCnt);
+   }
+
+
+   int writeCoilsTable(int startRef,
+                       const char bitArr[],
+                       int refCnt)
+   {
+      PROFILE_MEASURE_SERVICE_TIME();
+      PROFILE_RECORD_ACCESS(slaveAddr, 15, startRef - 1, refCnt);
+      if (!(ACCESS & PROFILE_WRITE_BITS) || (BIT_CNT == 0))
+         return 0;
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: writeCoils from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
+      startRef--;
+      if (startRef + refCnt > BIT_CNT)
+         return 0;
+      writeData(&bitData[startRef], bitArr, refCnt * sizeof(char));
+      return 1;
+   }
+
+
+   int readInputRegistersTable(int startRef,
+                               short regArr[],
+                               int refCnt)
+   {
+      PROFILE_MEASURE_SERVICE_TIME();
+      PROFILE_RECORD_ACCESS(slaveAddr, 4, startRef - 1, refCnt);
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: readInputRegisters from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
+      return readRegs(startRef - 1, regArr, refCnt);
+   }
+
+
+   int readHoldingRegistersTable(int startRef,
+                                 short regArr[],
+                                 int refCnt)
+   {
+      PROFILE_MEASURE_SERVICE_TIME();
+      PROFILE_RECORD_ACCESS(slaveAddr, 3, startRef - 1, refCnt);
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: readHoldingRegisters from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
+      return readRegs(startRef - 1, regArr, refCnt);
+   }
+
+
+   int writeHoldingRegistersTable(int startRef,
+                                  const short regArr[],
+                                  int refCnt)
+   {
+      PROFILE_MEASURE_SERVICE_TIME();
+      PROFILE_RECORD_ACCESS(slaveAddr, 16, startRef - 1, refCnt);
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: writeHoldingRegisters from %d, %d references\n",
+                slaveAddr, startRef, refCnt);
+      return writeRegs(startRef - 1, regArr, refCnt);
+   }
+
+
+   int readFileRecord(int refType, int fileNo, int startRef,
+                      short regArr[], int refCnt)
+   {
+      PROFILE_MEASURE_SERVICE_TIME();
+      PROFILE_RECORD_ACCESS(slaveAddr, 20, startRef, refCnt);
+      if (!(ACCESS & PROFILE_FILE_RECORDS))
+         return 0;
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: readFileRecord type %d, file %d from %d, %d references\n",
+                slaveAddr, refType, fileNo, startRef, refCnt);
+      if ((refType != 6) || ((fileNo != 3) && (fileNo != 4)))
+         return 0;
+      return readRegs(startRef, regArr, refCnt);
+   }
+
+
+   int writeFileRecord(int refType, int fileNo, int startRef,
+                       short regArr[], int refCnt)
+   {
+      PROFILE_MEASURE_SERVICE_TIME();
+      PROFILE_RECORD_ACCESS(slaveAddr, 21, startRef, refCnt);
+      if (!(ACCESS & PROFILE_FILE_RECORDS))
+         return 0;
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: writeFileRecord type %d, file %d from %d, %d references\n",
+                slaveAddr, refType, fileNo, startRef, refCnt);
+      if ((refType != 6) || ((fileNo != 3) && (fileNo != 4)))
+         return 0;
+      return writeRegs(startRef, regArr, refCnt);
+   }
+
+
+   int getSlaveId(char bufferArr[], int maxBufSize)
+   {
+#ifdef HAS_STRNCPY
+      strncpy(bufferArr, PRODUCT_NAME, maxBufSize);
+#else
+      strcpy(bufferArr, PRODUCT_NAME);
+#endif
+      return strlen(PRODUCT_NAME);
+   }
+
+
+   int getRunIndicatorStatus()
+   {
+      if (PROFILE_LOGGING())
+         printf("\rSlave %3d: reportSlaveId\n", slaveAddr);
+      return 1; // 1 = running
+   }
+
+
+   int getDeviceIdObject(int objId, char bufferArr[], int maxBufSize)
+   {
+      const char *objPtr;
+
+      switch (objId)
+      {
+         case 0: objPtr = VENDOR_NAME; break;
+         case 1: objPtr = PRODUCT_CODE; break;
+         case 2: objPtr = MbusSlaveServer::getPackageVersion(); break;
+         case 3: objPtr = VENDOR_URL; break;
+         case 4: objPtr = PRODUCT_NAME; break;
+         case 5: objPtr = MODEL_NAME; break;
+         case 6: objPtr = USER_APPLICATION_NAME; break;
+         case 128:
+            if (bufferArr)
+               memcpy(bufferArr, CUSTOM_OBJECT, sizeof(CUSTOM_OBJECT));
+         return sizeof(CUSTOM_OBJECT);
+         default:
+         return 0; // Return 0 for object not found
+      }
+      if (bufferArr)
+      {
+         if (PROFILE_LOGGING())
+            printf("\rSlave %3d: getDeviceIdObject %d\n", slaveAddr, objId);
+#ifdef HAS_STRNCPY
+         strncpy(bufferArr, objPtr, maxBufSize);
+#else
+         strcpy(bufferArr, objPtr);
+#endif
+      }
+      return strlen(objPtr);
+   }
+
+
+   int getRegisterCount()
+   {
+      return REG_CNT;
+   }
+
+
+   int getCoilCount()
+   {
+      return BIT_CNT;
+   }
+
+
+   int getRegisters(int startAddr, short regArr[], int refCnt)
+   {
+      if ((startAddr < 0) || (refCnt < 0) || (startAddr + refCnt > REG_CNT))
+         return 0;
+      readData(regArr, &regData[startAddr], refCnt * sizeof(short));
+      return 1;
+   }
+
+
+   int setRegisters(int startAddr, const short regArr[], int refCnt)
+   {
+      if ((startAddr < 0) || (refCnt < 0) || (startAddr + refCnt > REG_CNT))
+         return 0;
+      writeData(&regData[startAddr], regArr, refCnt * sizeof(short));
+      PROFILE_RECORD_HISTORY(slaveAddr, startAddr, regArr, refCnt);
+      return 1;
+   }
+
+
+   int getCoils(int startAddr, char bitArr[], int refCnt)
+   {
+      if ((startAddr < 0) || (refCnt < 0) || (startAddr + refCnt > BIT_CNT))
+         return 0;
+      readData(bitArr, &bitData[startAddr], refCnt);
+      return 1;
+   }
+
+
+   int setCoils(int startAddr, const char bitArr[], int refCnt)
+   {
+      if ((startAddr < 0) || (refCnt < 0) || (startAddr + refCnt > BIT_CNT))
+         return 0;
+      writeData(&bitData[startAddr], bitArr, refCnt);
+      return 1;
+   }
+
+
+   void clear()
+   {
+      diagShmSeqWriteBegin(&seq);
+      memset(regData, 0, sizeof(regData));
+      memset(bitData, 0, sizeof(bitData));
+      diagShmSeqWriteEnd(&seq);
+   }
+
+
+  private:
+
+   int slaveAddr;
+   volatile uint32_t seq;
+   short regData[REG_CNT];
+   char bitData[BIT_CNT > 0 ? BIT_CNT : 1];
+
+
+   int readBits(int startRef, char bitArr[], int refCnt)
+   {
+      if (!(ACCESS & PROFILE_READ_BITS) || (BIT_CNT == 0))
+         return 0;
+      startRef--;
+      if (startRef + refCnt > BIT_CNT)
+         return 0;
+      readData(bitArr, &bitData[startRef], refCnt * sizeof(char));
+      return 1;
+   }
+
+
+   /**
+    * Reads registers, startRef is 0-based.
+    */
+   int readRegs(int startRef, short regArr[], int refCnt)
+   {
+      if (!(ACCESS & PROFILE_READ_REGS))
+         return 0;
+      if (startRef + refCnt > REG_CNT)
+         return 0;
+      readData(regArr, &regData[startRef], refCnt * sizeof(short));
+      return 1;
+   }
+
+
+   /**
+    * Writes registers, startRef is 0-based.
+    */
+   int writeRegs(int startRef, const short regArr[], int refCnt)
+   {
+      if (!(ACCESS & PROFILE_WRITE_REGS))
+         return 0;
+      if (startRef + refCnt > REG_CNT)
+         return 0;
+      writeData(&regData[startRef], regArr, refCnt * sizeof(short));
+      PROFILE_RECORD_HISTORY(slaveAddr, startRef, regArr, refCnt);
+      return 1;
+   }
+
+
+   /**
+    * Copies data out of the table under the sequence lock, see @ref
+    * shmlayout for the protocol.
+    */
+   void readData(void *dstPtr, const void *srcPtr, size_t len)
+   {
+      uint32_t startSeq;
+
+      do
+      {
+         startSeq = diagShmSeqReadBegin(&seq);
+         memcpy(dstPtr, srcPtr, len);
+      } while (diagShmSeqReadRetry(&seq, startSeq));
+   }
+
+
+   void writeData(void *dstPtr, const void *srcPtr, size_t len)
+   {
+      diagShmSeqWriteBegin(&seq);
+      memcpy(dstPtr, srcPtr, len);
+      diagShmSeqWriteEnd(&seq);
+   }
+
+};
+
+
+/*****************************************************************************
+ * Profile registry
+ *****************************************************************************/
+
+/**
+ * Entry of the data table profile registry
+ */
+struct DataTableProfile
+{
+   const char *name;        ///< Name used on the command line
+   const char *description; ///< One line description
+   MbusDataTableInterface *(*createTable)(int slaveAddr); ///< Factory
+   /// Factory of the variant adding PROFILE_HOOK_INSTRUMENTS
+   MbusDataTableInterface *(*createInstrumentedTable)(int slaveAddr);
+};
+
+
+template <int REG_CNT, int BIT_CNT, int ACCESS, int HOOKS>
+MbusDataTableInterface *createProfileTable(int slaveAddr)
+{
+   return new ProfileMbusDataTable<REG_CNT, BIT_CNT, ACCESS, HOOKS>(slaveAddr);
+}
+
+
+/**
+ * Pre-instantiated profiles, terminated by an entry with a NULL name
+ */
+const DataTableProfile dataTableProfileArr[] =
+{
+   {
+      "meter", "Energy meter, 256 read-only registers",
+      createProfileTable<256, 0, PROFILE_READ_REGS, 0>,
+      createProfileTable<256, 0, PROFILE_READ_REGS, PROFILE_HOOK_INSTRUMENTS>
+   },
+   {
+      "io", "I/O module, 32 registers and 64 coils",
+      createProfileTable<32, 64, PROFILE_READ_BITS | PROFILE_WRITE_BITS |
+                                 PROFILE_READ_REGS | PROFILE_WRITE_REGS, 0>,
+      createProfileTable<32, 64, PROFILE_READ_BITS | PROFILE_WRITE_BITS |
+                                 PROFILE_READ_REGS | PROFILE_WRITE_REGS,
+                         PROFILE_HOOK_INSTRUMENTS>
+   },
+   {
+      "plc", "PLC, 4096 registers and 2000 coils",
+      createProfileTable<4096, 2000, PROFILE_ALL_ACCESS, 0>,
+      createProfileTable<4096, 2000, PROFILE_ALL_ACCESS, PROFILE_HOOK_INSTRUMENTS>
+   },
+   {
+      "full", "Full address space like the default table, without logging",
+      createProfileTable<0x10000, 2000, PROFILE_ALL_ACCESS, 0>,
+      createProfileTable<0x10000, 2000, PROFILE_ALL_ACCESS, PROFILE_HOOK_INSTRUMENTS>
+   },
+   {
+      "full-log", "Full address space like the default table, with logging",
+      createProfileTable<0x10000, 2000, PROFILE_ALL_ACCESS, PROFILE_HOOK_LOGGING>,
+      createProfileTable<0x10000, 2000, PROFILE_ALL_ACCESS,
+                         PROFILE_HOOK_LOGGING | PROFILE_HOOK_INSTRUMENTS>
+   },
+   { NULL, NULL, NULL, NULL }
+};
+
+
+/**
+ * Looks up a profile by name.
+ *
+ * @return Profile or NULL if not found
+ */
+inline const DataTableProfile *findDataTableProfile(const char *name)
+{
+   const DataTableProfile *profilePtr;
+
+   for (profilePtr = dataTableProfileArr; profilePtr->name != NULL; profilePtr++)
+   {
+      if (strcmp(profilePtr->name, name) == 0)
+         return profilePtr;
+   }
+   return NULL;
+}
+
+
+/**
+ * Prints the names and descriptions of all profiles on stdout.
+ */
+inline void printDataTableProfiles()
+{
+   const DataTableProfile *profilePtr;
+
+   for (profilePtr = dataTableProfileArr; profilePtr->name != NULL; profilePtr++)
+      printf("%-13s %s\n", profilePtr->name, profilePtr->description);
+}
+
+
+#endif // ifdef ..._H_INCLUDED
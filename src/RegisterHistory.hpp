@@ -0,0 +1,717 @@
+/**
+ * @file RegisterHistory.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _REGISTERHISTORY_H_INCLUDED
+#define _REGISTERHISTORY_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+
+/*****************************************************************************
+ * RegisterHistory class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Records the values holding registers of selected ranges took
+ * over time.
+ *
+ * Every change written by a master is recorded as a sample of time and
+ * value. The samples of a register are compressed into fixed size blocks
+ * in the style of Gorilla time series encoding: a block starts with the
+ * uncompressed time and value, then each sample stores the delta of the
+ * time delta in a variable length code. The value is stored either as
+ * difference to its predecessor, which suits process values, or as XOR
+ * with its predecessor reusing the previous window of meaningful bits,
+ * which suits bit fields, whichever is shorter. Samples of a slowly
+ * changing value written at a regular period thus take 5 bits of payload,
+ * about 6.5 bits including block headers and partly filled blocks.
+ *
+ * 1000 registers changing every 100 ms therefore need about 22 MiB per
+ * hour. The encoding is lossless and a random change of -2 to 2 already
+ * carries 2 bits, so hours of such changes in a few MiB are out of reach.
+ * That budget covers hours of registers changing every few seconds, or
+ * minutes of thousands changing at 100 ms.
+ *
+ * Blocks are taken from a ring of fixed size, so memory is bounded and the
+ * oldest blocks are overwritten once the ring is full. Each block can be
+ * decoded on its own.
+ */
+class RegisterHistory
+{
+
+public:
+
+   enum
+   {
+      MAX_RANGES = 16,      ///< Max number of recorded ranges
+      MAX_REGS = 0x40000,   ///< Max number of recorded registers in total
+      BLOCK_SIZE = 128      ///< Size of a block in bytes
+   };
+
+
+   /**
+    * Constructs an empty history, ranges are added with addRange() and
+    * memory is assigned with allocate().
+    */
+   RegisterHistory()
+   {
+      struct timespec now;
+
+      rangeCnt = 0;
+      regCnt = 0;
+      streamArr = NULL;
+      blockArr = NULL;
+      blockCnt = 0;
+      nextBlock = 0;
+      wrapped = 0;
+      sampleCnt = 0;
+      droppedCnt = 0;
+      clock_gettime(CLOCK_REALTIME, &now);
+      startMs = (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+      pthread_mutex_init(&mutex, NULL);
+   }
+
+
+   ~RegisterHistory()
+   {
+      free(streamArr);
+      free(blockArr);
+      pthread_mutex_destroy(&mutex);
+   }
+
+
+   /**
+    * Adds a range of holding registers to record. Must be called before
+    * recording starts.
+    *
+    * @param slaveAddr Slave address
+    * @param startAddr First register, 0-based as on the wire
+    * @param endAddr Last register, 0-based as on the wire
+    * @return 0 on success, -1 if the range is invalid or limits are
+    * exceeded
+    */
+   int addRange(int slaveAddr, int startAddr, int endAddr)
+   {
+      int cnt = endAddr - startAddr + 1;
+      Stream *newArr;
+      int i;
+
+      if ((slaveAddr < 0) || (slaveAddr > 255) || (startAddr < 0) ||
+          (endAddr > 0xFFFF) || (cnt <= 0) || (rangeCnt >= MAX_RANGES) ||
+          (regCnt + cnt > MAX_REGS))
+         return -1;
+      newArr = (Stream *) realloc(streamArr, (regCnt + cnt) * sizeof(Stream));
+      if (newArr == NULL)
+         return -1;
+      streamArr = newArr;
+      for (i = regCnt; i < regCnt + cnt; i++)
+         streamArr[i].curBlock = -1;
+      rangeArr[rangeCnt].slaveAddr = slaveAddr;
+      rangeArr[rangeCnt].startAddr = startAddr;
+      rangeArr[rangeCnt].endAddr = endAddr;
+      rangeArr[rangeCnt].baseIdx = regCnt;
+      rangeCnt++;
+      regCnt += cnt;
+      return 0;
+   }
+
+
+   /**
+    * Allocates the block ring. Must be called once before recording
+    * starts.
+    *
+    * @param memSize Memory for blocks in bytes
+    * @return 0 on success, -1 if out of memory
+    */
+   int allocate(size_t memSize)
+   {
+      blockCnt = (int) (memSize / BLOCK_SIZE);
+      if (blockCnt < 2)
+         blockCnt = 2;
+      blockArr = (Block *) calloc(blockCnt, sizeof(Block));
+      return blockArr != NULL ? 0 : -1;
+   }
+
+
+   /**
+    * Records a write to holding registers, registers outside the recorded
+    * ranges and unchanged values are ignored.
+    *
+    * @param slaveAddr Slave address
+    * @param startAddr Start address, 0-based as on the wire
+    * @param regArr Written values
+    * @param refCnt Number of registers
+    */
+   void record(int slaveAddr, int startAddr, const short regArr[], int refCnt)
+   {
+      int endAddr = startAddr + refCnt - 1;
+      uint32_t timeMs = 0;
+      int from;
+      int to;
+      int i;
+      int j;
+
+      for (i = 0; i < rangeCnt; i++)
+      {
+         if ((rangeArr[i].slaveAddr != slaveAddr) || (rangeArr[i].startAddr > endAddr) ||
+             (rangeArr[i].endAddr < startAddr))
+            continue;
+         from = startAddr > rangeArr[i].startAddr ? startAddr : rangeArr[i].startAddr;
+         to = endAddr < rangeArr[i].endAddr ? endAddr : rangeArr[i].endAddr;
+         pthread_mutex_lock(&mutex);
+         if (timeMs == 0)
+            timeMs = currentTime();
+         for (j = from; j <= to; j++)
+            addSample(rangeArr[i].baseIdx + j - rangeArr[i].startAddr, timeMs,
+                      (uint16_t) regArr[j - startAddr]);
+         pthread_mutex_unlock(&mutex);
+      }
+   }
+
+
+   /**
+    * Writes the recorded samples as CSV, ordered by time. Each line holds
+    * the time in seconds since the epoch, slave address, register address
+    * (0-based) and value. Recording continues while exporting.
+    *
+    * @param filePtr Output stream
+    * @param slaveAddr Slave address or -1 for all
+    * @param startAddr First register to export, 0-based
+    * @param endAddr Last register to export, 0-based
+    * @return Number of samples written or -1 on error
+    */
+   long exportCsv(FILE *filePtr, int slaveAddr = -1, int startAddr = 0,
+                  int endAddr = 0xFFFF)
+   {
+      Block *copyArr;
+      Sample *sampleArr;
+      long sampleTotal = 0;
+      long cnt = 0;
+      long i;
+      int first;
+      int b;
+
+      //
+      // Decode a copy of the ring, so writers are only blocked for the copy
+      //
+      copyArr = (Block *) malloc(blockCnt * sizeof(Block));
+      if (copyArr == NULL)
+         return -1;
+      pthread_mutex_lock(&mutex);
+      memcpy(copyArr, blockArr, blockCnt * sizeof(Block));
+      first = wrapped ? nextBlock : 0;
+      pthread_mutex_unlock(&mutex);
+      for (b = 0; b < blockCnt; b++)
+         sampleTotal += copyArr[b].sampleCnt;
+      sampleArr = (Sample *) malloc((sampleTotal + 1) * sizeof(Sample));
+      if (sampleArr == NULL)
+      {
+         free(copyArr);
+         return -1;
+      }
+      for (b = 0; b < blockCnt; b++)
+      {
+         Block *blockPtr = &copyArr[(first + b) % blockCnt];
+
+         if ((blockPtr->sampleCnt > 0) && isSelected(blockPtr->regIdx, slaveAddr,
+                                                     startAddr, endAddr))
+            cnt += decodeBlock(blockPtr, &sampleArr[cnt]);
+      }
+      free(copyArr);
+      for (i = 0; i < cnt; i++)
+         sampleArr[i].seq = (uint32_t) i;
+      qsort(sampleArr, cnt, sizeof(Sample), compareSamples);
+
+      fprintf(filePtr, "time,slave,register,value\n");
+      for (i = 0; i < cnt; i++)
+      {
+         uint64_t ms = startMs + sampleArr[i].timeMs;
+
+         fprintf(filePtr, "%llu.%03u,%d,%d,%u\n", (unsigned long long) (ms / 1000),
+                 (unsigned int) (ms % 1000), getSlaveAddr(sampleArr[i].regIdx),
+                 getRegAddr(sampleArr[i].regIdx), (unsigned int) sampleArr[i].value);
+      }
+      free(sampleArr);
+      return ferror(filePtr) ? -1 : cnt;
+   }
+
+
+   /**
+    * Writes the recorded samples to a CSV file.
+    *
+    * @param fileName Name of the file to write
+    * @return 0 on success, -1 on error
+    */
+   int writeCsv(const char *fileName)
+   {
+      FILE *filePtr;
+      long cnt;
+
+      filePtr = fopen(fileName, "w");
+      if (filePtr == NULL)
+         return -1;
+      cnt = exportCsv(filePtr);
+      if (fclose(filePtr) != 0)
+         cnt = -1;
+      return cnt < 0 ? -1 : 0;
+   }
+
+
+   /**
+    * Prints sample and memory statistics on stdout.
+    */
+   void printStatistics()
+   {
+      int usedCnt;
+
+      pthread_mutex_lock(&mutex);
+      usedCnt = wrapped ? blockCnt : nextBlock;
+      printf("Register history: %d registers, %llu samples, %llu dropped, "
+             "%d of %d blocks used",
+             regCnt, sampleCnt, droppedCnt, usedCnt, blockCnt);
+      if (sampleCnt > droppedCnt)
+         printf(", %.1f bits per sample", usedCnt * BLOCK_SIZE * 8.0 /
+                (double) (sampleCnt - droppedCnt));
+      printf("\n");
+      pthread_mutex_unlock(&mutex);
+   }
+
+
+  private:
+
+   enum
+   {
+      HEADER_SIZE = 16,
+      PAYLOAD_BITS = (BLOCK_SIZE - HEADER_SIZE) * 8
+   };
+
+   /**
+    * Block of samples of one register. The first sample is stored in the
+    * header, the others in the payload bit stream, most significant bit
+    * first.
+    */
+   struct Block
+   {
+      uint32_t regIdx;
+      uint32_t startTime;   ///< Time of the first sample in ms since startMs
+      uint16_t firstValue;
+      uint16_t sampleCnt;   ///< 0 if unused
+      uint16_t bitCnt;      ///< Bits used in payloadArr
+      uint16_t reserved;
+      uint8_t payloadArr[BLOCK_SIZE - HEADER_SIZE];
+   };
+
+   /**
+    * Encoder state of a register.
+    */
+   struct Stream
+   {
+      int curBlock;         ///< Block receiving samples, -1 if none
+      uint32_t prevTime;
+      int32_t prevDelta;
+      uint16_t prevValue;
+      uint8_t winLead;      ///< Leading zeros of the value window
+      uint8_t winLen;       ///< Length of the value window, 0 if none
+   };
+
+   struct Range
+   {
+      int slaveAddr;
+      int startAddr;
+      int endAddr;
+      int baseIdx;          ///< Index of the first register in streamArr
+   };
+
+   struct Sample
+   {
+      uint32_t timeMs;
+      uint32_t regIdx;
+      uint32_t seq;         ///< Ring order, keeps equal times stable
+      uint16_t value;
+   };
+
+   Range rangeArr[MAX_RANGES];
+   int rangeCnt;
+   Stream *streamArr;
+   int regCnt;
+   Block *blockArr;
+   int blockCnt;
+   int nextBlock;
+   int wrapped;
+   unsigned long long sampleCnt;
+   unsigned long long droppedCnt;
+   uint64_t startMs;
+   pthread_mutex_t mutex;
+
+
+   uint32_t currentTime()
+   {
+      struct timespec now;
+      uint64_t ms;
+
+      clock_gettime(CLOCK_REALTIME, &now);
+      ms = (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+      // Clamp at 0 and the 49 day range of the ms offset
+      if (ms < startMs)
+         return 0;
+      if (ms - startMs > 0xFFFFFFFFULL)
+         return 0xFFFFFFFF;
+      return (uint32_t) (ms - startMs);
+   }
+
+
+   int getSlaveAddr(uint32_t regIdx)
+   {
+      int i;
+
+      for (i = rangeCnt - 1; i > 0; i--)
+         if ((int) regIdx >= rangeArr[i].baseIdx)
+            break;
+      return rangeArr[i].slaveAddr;
+   }
+
+
+   int getRegAddr(uint32_t regIdx)
+   {
+      int i;
+
+      for (i = rangeCnt - 1; i > 0; i--)
+         if ((int) regIdx >= rangeArr[i].baseIdx)
+            break;
+      return rangeArr[i].startAddr + (int) regIdx - rangeArr[i].baseIdx;
+   }
+
+
+   int isSelected(uint32_t regIdx, int slaveAddr, int startAddr, int endAddr)
+   {
+      int regAddr;
+
+      if ((int) regIdx >= regCnt)
+         return 0;
+      regAddr = getRegAddr(regIdx);
+      return ((slaveAddr < 0) || (getSlaveAddr(regIdx) == slaveAddr)) &&
+             (regAddr >= startAddr) && (regAddr <= endAddr);
+   }
+
+
+   static int compareSamples(const void *aPtr, const void *bPtr)
+   {
+      const Sample *a = (const Sample *) aPtr;
+      const Sample *b = (const Sample *) bPtr;
+
+      if (a->timeMs != b->timeMs)
+         return a->timeMs < b->timeMs ? -1 : 1;
+      if (a->regIdx != b->regIdx)
+         return a->regIdx < b->regIdx ? -1 : 1;
+      return a->seq < b->seq ? -1 : (a->seq > b->seq ? 1 : 0);
+   }
+
+
+   /**
+    * Takes the next block of the ring for a register. A block still in use
+    * by another register is dropped together with its samples.
+    */
+   Block *allocBlock(int regIdx)
+   {
+      Block *blockPtr = &blockArr[nextBlock];
+
+      if (blockPtr->sampleCnt > 0)
+      {
+         droppedCnt += blockPtr->sampleCnt;
+         if (streamArr[blockPtr->regIdx].curBlock == nextBlock)
+            streamArr[blockPtr->regIdx].curBlock = -1;
+      }
+      memset(blockPtr, 0, sizeof(*blockPtr));
+      blockPtr->regIdx = regIdx;
+      streamArr[regIdx].curBlock = nextBlock;
+      nextBlock++;
+      if (nextBlock == blockCnt)
+      {
+         nextBlock = 0;
+         wrapped = 1;
+      }
+      return blockPtr;
+   }
+
+
+   /**
+    * Encodes the time delta (Gorilla style prefix code on the delta of
+    * deltas, extended by multiples of the period for values which did not
+    * change on every poll):
+    *   '0'                   same delta as before
+    *   '10' + 2 bits         2 to 5 times the previous delta, which is
+    *                         kept as period
+    *   '110' + 4 bits        delta of deltas of -8 to 7, receive jitter
+    *   '1110' + 12 bits      delta of deltas of -2048 to 2047
+    *   '1111' + 32 bits      delta of deltas
+    *
+    * @return Number of bits, *keepPeriodPtr is set if the previous delta
+    * remains the reference
+    */
+   static int encodeTime(int32_t delta, int32_t prevDelta, uint64_t *codePtr,
+                         int *keepPeriodPtr)
+   {
+      int32_t dod = delta - prevDelta;
+
+      *keepPeriodPtr = 0;
+      if (dod == 0)
+      {
+         *codePtr = 0;
+         return 1;
+      }
+      if ((prevDelta > 0) && (delta % prevDelta == 0) && (delta / prevDelta >= 2) &&
+          (delta / prevDelta <= 5))
+      {
+         *codePtr = (0x2ULL << 2) | (uint32_t) (delta / prevDelta - 2);
+         *keepPeriodPtr = 1;
+         return 4;
+      }
+      if ((dod >= -8) && (dod < 8))
+      {
+         *codePtr = (0x6ULL << 4) | ((uint32_t) dod & 0xF);
+         return 7;
+      }
+      if ((dod >= -2048) && (dod < 2048))
+      {
+         *codePtr = (0xEULL << 12) | ((uint32_t) dod & 0xFFF);
+         return 16;
+      }
+      *codePtr = (0xFULL << 32) | (uint32_t) dod;
+      return 36;
+   }
+
+
+   /**
+    * Encodes a value change, choosing the shortest of:
+    *   '00' + 2 bits         difference of -2, -1, 1 or 2
+    *   '010' + 5 bits        difference of -16 to 15
+    *   '011' + 16 bits       difference
+    *   '10' + window bits    XOR fits into the current window
+    *   '11' + 4 + 4 + bits   XOR with leading zeros, length - 1 and the
+    *                         meaningful bits, which become the new window
+    */
+   static int encodeValue(uint16_t prevValue, uint16_t value, Stream *streamPtr,
+                          uint64_t *codePtr)
+   {
+      int16_t diff = (int16_t) (value - prevValue);
+      uint16_t xorVal = prevValue ^ value;
+      int lead = __builtin_clz((unsigned int) xorVal) - 16;
+      int trail = __builtin_ctz((unsigned int) xorVal);
+      int len = 16 - lead - trail;
+      int winShift = 16 - streamPtr->winLead - streamPtr->winLen;
+
+      if ((diff >= -2) && (diff <= 2))
+      {
+         *codePtr = diff < 0 ? diff + 2 : diff + 1;
+         return 4;
+      }
+      if ((streamPtr->winLen > 0) && (streamPtr->winLen < 6) &&
+          (lead >= streamPtr->winLead) && (trail >= winShift))
+      {
+         *codePtr = (0x2ULL << streamPtr->winLen) | (xorVal >> winShift);
+         return 2 + streamPtr->winLen;
+      }
+      if ((diff >= -16) && (diff < 16))
+      {
+         *codePtr = (0x2ULL << 5) | ((uint16_t) diff & 0x1F);
+         return 8;
+      }
+      if ((streamPtr->winLen > 0) && (streamPtr->winLen < 17) &&
+          (lead >= streamPtr->winLead) && (trail >= winShift))
+      {
+         *codePtr = (0x2ULL << streamPtr->winLen) | (xorVal >> winShift);
+         return 2 + streamPtr->winLen;
+      }
+      if (len < 10)
+      {
+         streamPtr->winLead = (uint8_t) lead;
+         streamPtr->winLen = (uint8_t) len;
+         *codePtr = (0x3ULL << (8 + len)) | ((uint64_t) lead << (4 + len)) |
+                    ((uint64_t) (len - 1) << len) | (xorVal >> trail);
+         return 10 + len;
+      }
+      *codePtr = (0x3ULL << 16) | (uint16_t) diff;
+      return 19;
+   }
+
+
+   static void putBits(Block *blockPtr, uint64_t code, int bitCnt)
+   {
+      int pos = blockPtr->bitCnt;
+      int i;
+
+      for (i = bitCnt - 1; i >= 0; i--, pos++)
+      {
+         if ((code >> i) & 1)
+            blockPtr->payloadArr[pos >> 3] |= (uint8_t) (0x80 >> (pos & 7));
+      }
+      blockPtr->bitCnt = (uint16_t) pos;
+   }
+
+
+   static uint32_t getBits(const Block *blockPtr, int *posPtr, int bitCnt)
+   {
+      uint32_t val = 0;
+      int i;
+
+      for (i = 0; i < bitCnt; i++, (*posPtr)++)
+         val = (val << 1) | ((blockPtr->payloadArr[*posPtr >> 3] >> (7 - (*posPtr & 7))) & 1);
+      return val;
+   }
+
+
+   static int32_t signExtend(uint32_t val, int bitCnt)
+   {
+      return (int32_t) (val << (32 - bitCnt)) >> (32 - bitCnt);
+   }
+
+
+   void addSample(int regIdx, uint32_t timeMs, uint16_t value)
+   {
+      Stream *streamPtr = &streamArr[regIdx];
+      Stream newState;
+      Block *blockPtr;
+      uint64_t timeCode;
+      uint64_t valueCode;
+      int timeBits;
+      int valueBits;
+      int32_t delta;
+      int keepPeriod;
+
+      if (streamPtr->curBlock >= 0)
+      {
+         if (value == streamPtr->prevValue)
+            return;
+         blockPtr = &blockArr[streamPtr->curBlock];
+         newState = *streamPtr;
+         delta = (int32_t) (timeMs - streamPtr->prevTime);
+         timeBits = encodeTime(delta, streamPtr->prevDelta, &timeCode, &keepPeriod);
+         valueBits = encodeValue(streamPtr->prevValue, value, &newState, &valueCode);
+         if ((blockPtr->bitCnt + timeBits + valueBits <= PAYLOAD_BITS) &&
+             (blockPtr->sampleCnt < 0xFFFF))
+         {
+            putBits(blockPtr, timeCode, timeBits);
+            putBits(blockPtr, valueCode, valueBits);
+            blockPtr->sampleCnt++;
+            *streamPtr = newState;
+            if (!keepPeriod)
+               streamPtr->prevDelta = delta;
+            streamPtr->prevTime = timeMs;
+            streamPtr->prevValue = value;
+            sampleCnt++;
+            return;
+         }
+      }
+
+      // Start a new block with an uncompressed sample
+      blockPtr = allocBlock(regIdx);
+      blockPtr->startTime = timeMs;
+      blockPtr->firstValue = value;
+      blockPtr->sampleCnt = 1;
+      streamPtr->prevTime = timeMs;
+      streamPtr->prevDelta = 0;
+      streamPtr->prevValue = value;
+      streamPtr->winLead = 0;
+      streamPtr->winLen = 0;
+      sampleCnt++;
+   }
+
+
+   /**
+    * Decodes a block.
+    *
+    * @return Number of samples stored in sampleArr
+    */
+   int decodeBlock(const Block *blockPtr, Sample sampleArr[])
+   {
+      uint32_t timeMs = blockPtr->startTime;
+      uint16_t value = blockPtr->firstValue;
+      int32_t delta = 0;
+      int winLead = 0;
+      int winLen = 0;
+      int pos = 0;
+      int i;
+
+      for (i = 0; i < blockPtr->sampleCnt; i++)
+      {
+         if (i > 0)
+         {
+            if (getBits(blockPtr, &pos, 1) == 0)
+               timeMs += delta;
+            else if (getBits(blockPtr, &pos, 1) == 0)
+               timeMs += delta * (int32_t) (getBits(blockPtr, &pos, 2) + 2);
+            else
+            {
+               if (getBits(blockPtr, &pos, 1) == 0)
+                  delta += signExtend(getBits(blockPtr, &pos, 4), 4);
+               else if (getBits(blockPtr, &pos, 1) == 0)
+                  delta += signExtend(getBits(blockPtr, &pos, 12), 12);
+               else
+                  delta += (int32_t) getBits(blockPtr, &pos, 32);
+               timeMs += delta;
+            }
+            if (getBits(blockPtr, &pos, 1) == 0)
+            {
+               if (getBits(blockPtr, &pos, 1) == 0)
+               {
+                  uint32_t idx = getBits(blockPtr, &pos, 2);
+
+                  value += (uint16_t) (idx < 2 ? (int) idx - 2 : (int) idx - 1);
+               }
+               else if (getBits(blockPtr, &pos, 1) == 0)
+                  value += (uint16_t) signExtend(getBits(blockPtr, &pos, 5), 5);
+               else
+                  value += (uint16_t) getBits(blockPtr, &pos, 16);
+            }
+            else
+            {
+               if (getBits(blockPtr, &pos, 1) != 0)
+               {
+                  winLead = (int) getBits(blockPtr, &pos, 4);
+                  winLen = (int) getBits(blockPtr, &pos, 4) + 1;
+               }
+               value ^= (uint16_t) (getBits(blockPtr, &pos, winLen) << (16 - winLead - winLen));
+            }
+         }
+         sampleArr[i].timeMs = timeMs;
+         sampleArr[i].regIdx = blockPtr->regIdx;
+         sampleArr[i].value = value;
+      }
+      return blockPtr->sampleCnt;
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
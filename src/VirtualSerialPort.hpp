@@ -0,0 +1,429 @@
+/**
+ * @file VirtualSerialPort.hpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+#ifndef _VIRTUALSERIALPORT_H_INCLUDED
+#define _VIRTUALSERIALPORT_H_INCLUDED
+
+
+// Platform header
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <pthread.h>
+
+// Package header
+#include "MbusSlaveServer.hpp"
+
+
+/*****************************************************************************
+ * VirtualSerialPort class declaration
+ *****************************************************************************/
+
+/**
+ * @brief Null-modem cable made of two pseudo-terminals.
+ *
+ * The server side pty is handed to the FieldTalk RTU or ASCII protocol
+ * like a real serial port, the master side pty is opened by the Modbus
+ * master under test. A relay thread copies bytes between the two.
+ *
+ * The relay can emulate the timing of a real line: with pacing enabled
+ * every character is delayed by its transmission time at the configured
+ * baud rate and an additional inter-character gap can be inserted. The
+ * relay also measures the slave's turnaround time, from the last byte of
+ * a request to the first byte of the response.
+ */
+class VirtualSerialPort
+{
+
+public:
+
+   VirtualSerialPort()
+   {
+      int i;
+
+      for (i = 0; i < 2; i++)
+      {
+         ptyMasterFdArr[i] = -1;
+         ptySlaveFdArr[i] = -1;
+         ptyNameArr[i][0] = '\0';
+      }
+      charTimeNsec = 0;
+      gapNsec = 0;
+      threadStarted = 0;
+      stopFlag = 0;
+      memset(&stats, 0, sizeof(stats));
+   }
+
+
+   ~VirtualSerialPort()
+   {
+      shutdown();
+   }
+
+
+   /**
+    * Creates both pseudo-terminal pairs.
+    *
+    * @return FTALK_SUCCESS or FTALK_OPEN_ERR
+    */
+   int openPorts()
+   {
+      struct termios tios;
+      int i;
+
+      for (i = 0; i < 2; i++)
+      {
+         ptyMasterFdArr[i] = posix_openpt(O_RDWR | O_NOCTTY);
+         if (ptyMasterFdArr[i] < 0)
+            return FTALK_OPEN_ERR;
+         if ((grantpt(ptyMasterFdArr[i]) < 0) || (unlockpt(ptyMasterFdArr[i]) < 0))
+            return FTALK_OPEN_ERR;
+         strncpy(ptyNameArr[i], ptsname(ptyMasterFdArr[i]), sizeof(ptyNameArr[i]) - 1);
+         ptyNameArr[i][sizeof(ptyNameArr[i]) - 1] = '\0';
+
+         //
+         // Keep the slave side open ourselves, otherwise the master side
+         // reports EIO whenever no application has the device open
+         //
+         ptySlaveFdArr[i] = open(ptyNameArr[i], O_RDWR | O_NOCTTY);
+         if (ptySlaveFdArr[i] < 0)
+            return FTALK_OPEN_ERR;
+         tcgetattr(ptySlaveFdArr[i], &tios);
+         cfmakeraw(&tios);
+         tcsetattr(ptySlaveFdArr[i], TCSANOW, &tios);
+         fcntl(ptyMasterFdArr[i], F_SETFL, fcntl(ptyMasterFdArr[i], F_GETFL) | O_NONBLOCK);
+      }
+      return FTALK_SUCCESS;
+   }
+
+
+   /**
+    * Returns the device to be opened by the slave protocol.
+    */
+   const char *getServerPortName()
+   {
+      return ptyNameArr[SERVER_SIDE];
+   }
+
+
+   /**
+    * Returns the device to be opened by the master under test.
+    */
+   const char *getMasterPortName()
+   {
+      return ptyNameArr[MASTER_SIDE];
+   }
+
+
+   /**
+    * Enables emulation of line timing.
+    *
+    * @param baudRate Baud rate, 0 disables pacing
+    * @param charBits Bits per character including start, parity and stop bits
+    * @param gapUsec Additional gap between characters in microseconds
+    */
+   void setPacing(long baudRate, int charBits, long gapUsec)
+   {
+      if (baudRate > 0)
+         charTimeNsec = (long) (charBits * 1000000000LL / baudRate);
+      else
+         charTimeNsec = 0;
+      gapNsec = gapUsec * 1000L;
+   }
+
+
+   /**
+    * Starts the relay thread.
+    *
+    * @return FTALK_SUCCESS or FTALK_ILLEGAL_STATE_ERROR
+    */
+   int startup()
+   {
+      if (ptyMasterFdArr[MASTER_SIDE] < 0)
+         return FTALK_ILLEGAL_STATE_ERROR;
+      stopFlag = 0;
+      if (pthread_create(&relayThread, NULL, relayThreadFunc, this) != 0)
+         return FTALK_ILLEGAL_STATE_ERROR;
+      threadStarted = 1;
+      return FTALK_SUCCESS;
+   }
+
+
+   /**
+    * Returns the relay thread, valid after startup() succeeded.
+    */
+   pthread_t getRelayThread()
+   {
+      return relayThread;
+   }
+
+
+   /**
+    * Stops the relay thread and closes the pseudo-terminals.
+    */
+   void shutdown()
+   {
+      int i;
+
+      if (threadStarted)
+      {
+         stopFlag = 1;
+         pthread_join(relayThread, NULL);
+         threadStarted = 0;
+      }
+      for (i = 0; i < 2; i++)
+      {
+         if (ptySlaveFdArr[i] >= 0)
+            close(ptySlaveFdArr[i]);
+         if (ptyMasterFdArr[i] >= 0)
+            close(ptyMasterFdArr[i]);
+         ptySlaveFdArr[i] = -1;
+         ptyMasterFdArr[i] = -1;
+      }
+   }
+
+
+   /**
+    * Prints relay and turnaround statistics on stdout.
+    */
+   void printStatistics()
+   {
+      printf("Virtual serial port statistics: ");
+      printf("%lu bytes to slave, %lu bytes to master", stats.rxBytes, stats.txBytes);
+      if (stats.droppedBytes)
+         printf(", %lu bytes dropped", stats.droppedBytes);
+      if (stats.turnarounds)
+      {
+         printf(", turnaround min/avg/max = %.3f/%.3f/%.3f ms",
+                stats.minTurnaroundNsec / 1e6,
+                (double) stats.sumTurnaroundNsec / stats.turnarounds / 1e6,
+                stats.maxTurnaroundNsec / 1e6);
+      }
+      printf("\n");
+   }
+
+
+  private:
+
+   enum
+   {
+      SERVER_SIDE = 0,
+      MASTER_SIDE = 1
+   };
+
+   enum
+   {
+      DROP_TIMEOUT_MSEC = 200 ///< Time a full pty may stay unread
+   };
+
+   struct Statistics
+   {
+      unsigned long rxBytes;
+      unsigned long txBytes;
+      unsigned long droppedBytes;
+      unsigned long turnarounds;
+      long long minTurnaroundNsec;
+      long long maxTurnaroundNsec;
+      long long sumTurnaroundNsec;
+   };
+
+   int ptyMasterFdArr[2];
+   int ptySlaveFdArr[2];
+   char ptyNameArr[2][64];
+   long charTimeNsec;
+   long gapNsec;
+   pthread_t relayThread;
+   int threadStarted;
+   volatile int stopFlag;
+   long long lineFreeNsec;
+   long long requestEndNsec;
+   int awaitingResponse;
+   Statistics stats;
+
+
+   static long long getTimeNsec()
+   {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+   }
+
+
+   static void sleepUntil(long long deadlineNsec)
+   {
+      struct timespec ts;
+
+      ts.tv_sec = (time_t) (deadlineNsec / 1000000000LL);
+      ts.tv_nsec = (long) (deadlineNsec % 1000000000LL);
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+         ;
+   }
+
+
+   static void *relayThreadFunc(void *argPtr)
+   {
+      ((VirtualSerialPort *) argPtr)->relay();
+      return NULL;
+   }
+
+
+   void relay()
+   {
+      struct pollfd pollArr[2];
+      int i;
+
+      lineFreeNsec = 0;
+      awaitingResponse = 0;
+      while (!stopFlag)
+      {
+         for (i = 0; i < 2; i++)
+         {
+            pollArr[i].fd = ptyMasterFdArr[i];
+            pollArr[i].events = POLLIN;
+         }
+         if (poll(pollArr, 2, 200) <= 0)
+            continue;
+         if (pollArr[MASTER_SIDE].revents & POLLIN)
+            transfer(MASTER_SIDE, SERVER_SIDE);
+         if (pollArr[SERVER_SIDE].revents & POLLIN)
+            transfer(SERVER_SIDE, MASTER_SIDE);
+      }
+   }
+
+
+   /**
+    * Writes bytes to a pty. While its buffer is full the write waits for
+    * the other side to read. The bytes are only dropped, as on a real line,
+    * if nobody has read for DROP_TIMEOUT_MSEC or the pty failed.
+    *
+    * @return 0 if all bytes were delivered, -1 if they were dropped
+    */
+   int deliver(int toSide, const unsigned char *bufPtr, int len)
+   {
+      struct pollfd pollFd;
+      int result;
+
+      while (len > 0)
+      {
+         result = (int) write(ptyMasterFdArr[toSide], bufPtr, len);
+         if (result > 0)
+         {
+            bufPtr += result;
+            len -= result;
+            continue;
+         }
+         if ((result < 0) && (errno == EINTR))
+            continue;
+         if ((result < 0) && (errno == EAGAIN) && !stopFlag)
+         {
+            pollFd.fd = ptyMasterFdArr[toSide];
+            pollFd.events = POLLOUT;
+            if (poll(&pollFd, 1, DROP_TIMEOUT_MSEC) > 0)
+               continue;
+         }
+         stats.droppedBytes += len;
+         return -1;
+      }
+      return 0;
+   }
+
+
+   /**
+    * Copies pending bytes from one pty to the other.
+    */
+   void transfer(int fromSide, int toSide)
+   {
+      unsigned char buf[256];
+      long long now;
+      long long turnaroundNsec;
+      int len;
+      int i;
+
+      len = (int) read(ptyMasterFdArr[fromSide], buf, sizeof(buf));
+      if (len <= 0)
+         return;
+      now = getTimeNsec();
+      if (fromSide == SERVER_SIDE)
+      {
+         stats.txBytes += len;
+         if (awaitingResponse)
+         {
+            turnaroundNsec = now - requestEndNsec;
+            if ((stats.turnarounds == 0) || (turnaroundNsec < stats.minTurnaroundNsec))
+               stats.minTurnaroundNsec = turnaroundNsec;
+            if (turnaroundNsec > stats.maxTurnaroundNsec)
+               stats.maxTurnaroundNsec = turnaroundNsec;
+            stats.sumTurnaroundNsec += turnaroundNsec;
+            stats.turnarounds++;
+            awaitingResponse = 0;
+         }
+      }
+      else
+         stats.rxBytes += len;
+
+      if ((charTimeNsec == 0) && (gapNsec == 0))
+      {
+         if (deliver(toSide, buf, len) < 0)
+            return;
+      }
+      else
+      {
+         //
+         // Deliver character by character at line speed
+         //
+         if (lineFreeNsec < now)
+            lineFreeNsec = now;
+         for (i = 0; i < len; i++)
+         {
+            lineFreeNsec += charTimeNsec;
+            sleepUntil(lineFreeNsec);
+            if (deliver(toSide, &buf[i], 1) < 0)
+            {
+               stats.droppedBytes += len - i - 1;
+               return;
+            }
+            lineFreeNsec += gapNsec;
+         }
+      }
+      if (toSide == SERVER_SIDE)
+      {
+         requestEndNsec = getTimeNsec();
+         awaitingResponse = 1;
+      }
+   }
+
+};
+
+
+#endif // ifdef ..._H_INCLUDED
@@ -0,0 +1,207 @@
+/**
+ * @file diagadmin.cpp
+ *
+ * @if NOTICE
+ *
+ * Copyright (c) proconX Pty Ltd. All rights reserved.
+ *
+ * The following source file constitutes example program code and is
+ * intended merely to illustrate useful programming techniques.  The user
+ * is responsible for applying the code correctly.
+ *
+ * THIS SOFTWARE IS PROVIDED BY PROCONX AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PROCONX OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @endif
+ */
+
+
+// Platform header
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+/*****************************************************************************
+ * String constants
+ *****************************************************************************/
+
+const char versionStr[]= "2.12";
+const char progName[] = "diagadmin";
+const char bannerStr[] =
+"%s %s - FieldTalk(tm) Modbus(R) Diagnostic Slave Admin Client\n"
+"Copyright (c) 2002-2012 proconX Pty Ltd\n"
+"Visit http://www.modbusdriver.com for Modbus libraries and tools.\n"
+"\n";
+
+const char usageStr[] =
+"%s [-U path] COMMAND [ARGUMENTS]\n"
+"Sends a command to the admin interface of a running diagslave.\n"
+"An argument - is replaced by the whitespace separated words read from\n"
+"standard input, e.g. to set many registers in one request.\n"
+"Run '%s help' for the list of commands.\n"
+"Options:\n"
+"-U path     Admin socket (default /tmp/diagslave.sock)\n"
+"-h          Print this help\n";
+
+
+/*****************************************************************************
+ * Request buffer
+ *****************************************************************************/
+
+char *reqPtr = NULL;
+size_t reqLen = 0;
+size_t reqSize = 0;
+
+
+/**
+ * Appends a word to the request line.
+ */
+void appendWord(const char *wordPtr, size_t len)
+{
+   if (reqLen + len + 2 > reqSize)
+   {
+      reqSize = (reqLen + len + 2) * 2;
+      reqPtr = (char *) realloc(reqPtr, reqSize);
+      if (reqPtr == NULL)
+      {
+         fprintf(stderr, "Out of memory!\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   if (reqLen > 0)
+      reqPtr[reqLen++] = ' ';
+   memcpy(reqPtr + reqLen, wordPtr, len);
+   reqLen += len;
+}
+
+
+/**
+ * Appends the words read from standard input to the request line.
+ */
+void appendStdin()
+{
+   char wordArr[64];
+   size_t len = 0;
+   int c;
+
+   while ((c = getchar()) != EOF)
+   {
+      if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == ','))
+      {
+         if (len > 0)
+            appendWord(wordArr, len);
+         len = 0;
+      }
+      else if (len < sizeof(wordArr))
+         wordArr[len++] = (char) c;
+   }
+   if (len > 0)
+      appendWord(wordArr, len);
+}
+
+
+/**
+ * Main function
+ *
+ * @param argc Command line argument count
+ * @param argv Command line argument value string array
+ * @return Error code: 0 = OK, else error
+ */
+int main(int argc, char **argv)
+{
+   const char *socketName = "/tmp/diagslave.sock";
+   struct sockaddr_un sockAddr;
+   FILE *rspFilePtr;
+   char lineArr[4096];
+   size_t sent;
+   ssize_t txLen;
+   int fd;
+   int c;
+   int i;
+
+   while ((c = getopt(argc, argv, "+U:h")) != -1)
+   {
+      switch (c)
+      {
+         case 'U':
+            socketName = optarg;
+         break;
+         case 'h':
+            printf(bannerStr, progName, versionStr);
+            printf(usageStr, progName, progName);
+            exit(EXIT_SUCCESS);
+         default:
+            fprintf(stderr, usageStr, progName, progName);
+            exit(EXIT_FAILURE);
+      }
+   }
+   if (optind >= argc)
+   {
+      fprintf(stderr, "Missing command!\n");
+      fprintf(stderr, usageStr, progName, progName);
+      exit(EXIT_FAILURE);
+   }
+   for (i = optind; i < argc; i++)
+   {
+      if (strcmp(argv[i], "-") == 0)
+         appendStdin();
+      else
+         appendWord(argv[i], strlen(argv[i]));
+   }
+   reqPtr[reqLen++] = '\n';
+
+   memset(&sockAddr, 0, sizeof(sockAddr));
+   sockAddr.sun_family = AF_UNIX;
+   if (strlen(socketName) >= sizeof(sockAddr.sun_path))
+   {
+      fprintf(stderr, "Socket path too long!\n");
+      exit(EXIT_FAILURE);
+   }
+   strcpy(sockAddr.sun_path, socketName);
+   fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if ((fd < 0) || (connect(fd, (struct sockaddr *) &sockAddr, sizeof(sockAddr)) < 0))
+   {
+      fprintf(stderr, "Cannot connect to %s: %s!\n", socketName, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+   for (sent = 0; sent < reqLen; sent += txLen)
+   {
+      txLen = write(fd, reqPtr + sent, reqLen - sent);
+      if (txLen <= 0)
+      {
+         fprintf(stderr, "Cannot send request: %s!\n", strerror(errno));
+         exit(EXIT_FAILURE);
+      }
+   }
+   shutdown(fd, SHUT_WR);
+
+   // Print the response lines up to the status line
+   rspFilePtr = fdopen(fd, "r");
+   while ((rspFilePtr != NULL) && (fgets(lineArr, sizeof(lineArr), rspFilePtr) != NULL))
+   {
+      if (strcmp(lineArr, "OK\n") == 0)
+         return EXIT_SUCCESS;
+      if (strncmp(lineArr, "ERR ", 4) == 0)
+      {
+         fprintf(stderr, "%s", lineArr + 4);
+         return EXIT_FAILURE;
+      }
+      fputs(lineArr, stdout);
+   }
+   fprintf(stderr, "Connection closed without response!\n");
+   return EXIT_FAILURE;
+}
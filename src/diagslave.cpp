@@ -29,10 +29,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <time.h>
 #ifdef _WIN32
 #  include "getopt.h"
 #else
 #  include <unistd.h>
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <sys/wait.h>
+#  include <sched.h>
 #endif
 
 // Include FieldTalk package header
@@ -40,6 +48,20 @@
 #include "MbusAsciiSlaveProtocol.hpp"
 #include "MbusTcpSlaveProtocol.hpp"
 #include "DiagnosticDataTable.hpp"
+#include "ProfileDataTable.hpp"
+#include "DiagslaveSnapshot.h"
+#ifndef _WIN32
+#  include <pthread.h>
+#  include "MbusRtuOverTcpServer.hpp"
+#  include "MbusUdpServer.hpp"
+#  include "VirtualSerialPort.hpp"
+#  include "AdminServer.hpp"
+#  include "EpochReclaimer.hpp"
+#  include "MbusServerGroup.hpp"
+#endif
+#ifdef HAS_OPENSSL
+#  include "MbusTlsServer.hpp"
+#endif
 
 
 /*****************************************************************************
@@ -61,15 +83,35 @@ const char usageStr[] =
 "              COM1, COM2 ...                on Windows \n"
 "              /dev/ttyS0, /dev/ttyS1 ...    on Linux \n"
 "              /dev/ser1, /dev/ser2 ...      on QNX \n"
+#ifndef _WIN32
+"              pty    Virtual serial port, creates a pseudo-terminal pair and\n"
+"                     prints the device the master shall open\n"
+#endif
 "General options:\n"
 "-m ascii      Modbus ASCII protocol\n"
 "-m rtu        Modbus RTU protocol (default)\n"
 "-m tcp        MODBUS/TCP protocol\n"
+#ifndef _WIN32
+"-m rtutcp     Modbus RTU over TCP protocol (encapsulated RTU)\n"
+"-m udp        Modbus/UDP protocol\n"
+#endif
 "-o #          Master activity time-out in seconds (1.0 - 100, 3 s is default)\n"
 "-c #          Connection time-out in seconds (1.0 - 3600, 60 s is default)\n"
 "-a #          Slave address (1-255 for RTU/ASCII, 0-255 for TCP)\n"
-"Options for MODBUS/TCP:\n"
+"-P name       Data table profile of a fixed device model, -P list shows all\n"
+"-X #:#        Exception status returned by function 7 for slave #, repeatable\n"
+"              (0x55 is default)\n"
+#ifndef _WIN32
+"-M /name      Place data tables in POSIX shared memory segment /name\n"
+#endif
+"Options for MODBUS/TCP, RTU over TCP and Modbus/UDP:\n"
 "-p #          TCP port number (502 is default)\n"
+#ifndef _WIN32
+"-N #          RTU over TCP and UDP: simulate virtual devices on # consecutive\n"
+"              ports starting with -p, each port with its own 255 unit IDs\n"
+"-E #          Max resident virtual devices, the least recently used device\n"
+"              is reset when exceeded (unlimited is default)\n"
+#endif
 "Options for Modbus ASCII and Modbus RTU:\n"
 "-b #          Baudrate (e.g. 9600, 19200, ...) (19200 is default)\n"
 "-d #          Databits (7 or 8 for ASCII protocol, 8 for RTU)\n"
@@ -78,8 +120,74 @@ const char usageStr[] =
 "-p even       Even parity (default)\n"
 "-p odd        Odd parity\n"
 "-4 #          RS-Master mode, RTS on while transmitting and another # ms after\n"
+#ifndef _WIN32
+"-e            Virtual serial port: emulate character timing of the baudrate\n"
+"-g #          Virtual serial port: extra inter-character gap in us\n"
+"Real-time options:\n"
+"-x #[,#]      Pin server thread and optionally I/O threads to CPU #\n"
+"-r #          Run server and I/O threads with SCHED_FIFO priority # (1-99)\n"
+"-l            Prefault data tables and lock all memory\n"
+"-y #          Busy poll sockets for # us (RTU over TCP, UDP and TLS)\n"
+"-j            Report response latency and jitter at shutdown\n"
+"Profiling options:\n"
+"-q            Profile register accesses and report hot ranges at shutdown\n"
+"-w file       Write the access profile as workload file, implies -q\n"
+"-H #:#-#      Record the history of holding registers of slave # from\n"
+"              address # to # (0-based), repeatable\n"
+"-k #          Memory for register history in KiB (4096 is default)\n"
+"-z file       Export register history as CSV at shutdown and on SIGUSR1\n"
+"-F #          Coalesce register writes and feed them to the history every\n"
+"              # ms instead of one by one\n"
+"Admin options:\n"
+"-U path       Serve the admin interface on Unix domain socket path, see\n"
+"              diagadmin help\n"
+"Snapshot and cloning options:\n"
+"--snapshot file       Restore tables, identification and configuration from\n"
+"                      a snapshot, other options override the configuration\n"
+"--save-snapshot file  Write a snapshot when terminated with Ctrl-C or SIGTERM\n"
+"--clone #             Fork # servers sharing the initialized tables\n"
+"                      copy-on-write, clone n serves port + n\n"
+"Multi-instance options:\n"
+"--instances file      Serve the instances listed in file from one process,\n"
+"                      one per line: rtutcp|udp PORT *|#[-#][,#[-#]] [private]\n"
+"                      Instances share the tables of equal slave addresses\n"
+"                      unless marked private\n"
+"--threads #           Event loop threads serving the instances (1 is default)\n"
+#endif
+#ifdef HAS_OPENSSL
+"Options for MODBUS/TCP Security (TLS), served alongside any protocol:\n"
+"-S #          TLS port number, enables the TLS listener (802 is standard)\n"
+"-C file       Server certificate chain (PEM)\n"
+"-K file       Server private key (PEM)\n"
+"-A file       CA certificates, requires masters to present a certificate\n"
+"-R role=#,#   Authorize role to use the listed function codes, repeatable.\n"
+"              Requires -A. Without -R all function codes are authorized.\n"
+#endif
 "";
 
+#ifdef HAS_OPENSSL
+#  define TLS_OPTIONS "S:C:K:A:R:"
+#else
+#  define TLS_OPTIONS ""
+#endif
+#ifndef _WIN32
+#  define SHM_OPTIONS "M:"
+#  define PTY_OPTIONS "eg:"
+#  define RT_OPTIONS "x:r:ly:j"
+#  define VDEV_OPTIONS "N:E:"
+#  define PROF_OPTIONS "qw:"
+#  define HIST_OPTIONS "H:k:z:F:"
+#  define ADMIN_OPTIONS "U:"
+#else
+#  define SHM_OPTIONS ""
+#  define PTY_OPTIONS ""
+#  define RT_OPTIONS ""
+#  define VDEV_OPTIONS ""
+#  define PROF_OPTIONS ""
+#  define HIST_OPTIONS ""
+#  define ADMIN_OPTIONS ""
+#endif
+
 
 /*****************************************************************************
  * Enums
@@ -89,7 +197,9 @@ enum
 {
    RTU,   ///< Modbus RTU protocol
    ASCII, ///< Modbus ASCII protocol
-   TCP    ///< MODBUS/TCP protocol
+   TCP,   ///< MODBUS/TCP protocol
+   RTUTCP, ///< Modbus RTU over TCP protocol
+   UDP    ///< Modbus/UDP protocol
 };
 
 
@@ -108,14 +218,91 @@ int protocol = -1;
 char *portName = NULL;
 int port = 502;
 int rs485Mode = 0;
+char *shmName = NULL;
+const DataTableProfile *tableProfilePtr = NULL;
+int ptyPacing = 0;
+long ptyGapUsec = 0;
+#ifndef _WIN32
+int serverCpu = -1;
+int ioCpu = -1;
+int rtPriority = 0;
+int lockMemory = 0;
+int busyPollUsec = 0;
+int jitterReport = 0;
+int virtualPortCnt = 0;
+int maxVirtualDevices = 0;
+int accessProfiling = 0;
+char *workloadFileName = NULL;
+long historyKiB = 4096;
+char *historyFileName = NULL;
+long flushIntervalMs = 0;
+char *adminSocketName = NULL;
+char *snapshotName = NULL;
+char *saveSnapshotName = NULL;
+int cloneCnt = 0;
+char *instanceFileName = NULL;
+int workerThreadCnt = 1;
+#endif
+#ifdef HAS_OPENSSL
+int tlsPort = 0;
+char *tlsCertFileName = NULL;
+char *tlsKeyFileName = NULL;
+char *tlsCaFileName = NULL;
+#endif
 
 
 /*****************************************************************************
  * Protocol and data table
  *****************************************************************************/
 
-DiagnosticMbusDataTable *dataTablePtrArr[256];
+MbusDataTableInterface *dataTablePtrArr[256];
+DiagShmHeader *shmHeaderPtr = NULL;
 MbusSlaveServer *mbusServerPtr = NULL;
+#ifndef _WIN32
+MbusSocketServer *sockServerPtr = NULL;
+MbusDiagnostics busDiagnostics;
+VirtualSerialPort *virtualPortPtr = NULL;
+DeviceDirectory *deviceDirPtr = NULL;
+LatencyHistogram serviceTimeHist;
+AccessProfiler *accessProfilerPtr = NULL;
+RegisterHistory *registerHistoryPtr = NULL;
+DirtyRegisterMap *dirtyRegisterMapPtr = NULL;
+volatile sig_atomic_t historyExportRequested = 0;
+AdminServer *adminServerPtr = NULL;
+EpochReclaimer *reclaimerPtr = NULL;
+int mainEpochSlot = -1;
+int tlsEpochSlot = -1;
+unsigned char slaveServedArr[256];
+volatile int timeOutsChanged = 0;
+
+/**
+ * A logical diagslave of --instances mode: a transport on a port serving
+ * a set of slave addresses.
+ */
+struct DiagslaveInstance
+{
+   int protocol;
+   int port;
+   int privateTables; ///< Tables of its own rather than the shared ones
+   unsigned char servedArr[256];
+   MbusSocketServer *serverPtr;
+   MbusDiagnostics *diagPtr;
+   MbusDataTableInterface **tablePtrArr; ///< Private tables or NULL
+};
+
+DiagslaveInstance *instanceArr = NULL;
+int instanceCnt = 0;
+MbusServerGroup *serverGroupArr = NULL;
+pthread_t *groupThreadArr = NULL;
+int groupThreadCnt = 0;
+volatile int groupStopRequested = 0;
+#endif
+#ifdef HAS_OPENSSL
+MbusTlsServer *tlsServerPtr = NULL;
+pthread_t tlsThread;
+int tlsThreadStarted = 0;
+#endif
+volatile sig_atomic_t stopRequested = 0;
 
 
 /*****************************************************************************
@@ -143,32 +330,111 @@ void printVersion()
 }
 
 
+#ifndef _WIN32
+/**
+ * Prints the instances of --instances mode on stdout
+ */
+void printInstances()
+{
+   int i;
+   int j;
+   int cnt;
+
+   printf("Protocol configuration: %d instances on %d threads\n", instanceCnt,
+          workerThreadCnt);
+   for (i = 0; i < instanceCnt; i++)
+   {
+      cnt = 0;
+      for (j = 0; j < 256; j++)
+         cnt += instanceArr[i].servedArr[j];
+      printf("  %-14s port %5d, %3d slaves%s\n",
+             instanceArr[i].protocol == UDP ? "Modbus/UDP" : "RTU over TCP",
+             instanceArr[i].port, cnt, instanceArr[i].privateTables ? ", private" : "");
+   }
+}
+#endif
+
+
 /**
  * Prints the current configuration on stdout
  */
 void printConfig()
 {
    printf(bannerStr, progName, versionStr);
-   printf("Protocol configuration: ");
-   switch (protocol)
+#ifndef _WIN32
+   if (instanceCnt > 0)
+      printInstances();
+   else
+#endif
    {
-      case RTU:
-         printf("Modbus RTU\n");
-      break;
-      case ASCII:
-         printf("Modbus ASCII\n");
-      break;
-      case TCP:
-         printf("MODBUS/TCP\n");
-      break;
-      default:
-         printf("unknown\n");
-      break;
+      printf("Protocol configuration: ");
+      switch (protocol)
+      {
+         case RTU:
+            printf("Modbus RTU\n");
+         break;
+         case ASCII:
+            printf("Modbus ASCII\n");
+         break;
+         case TCP:
+            printf("MODBUS/TCP\n");
+         break;
+         case RTUTCP:
+            printf("Modbus RTU over TCP\n");
+         break;
+         case UDP:
+            printf("Modbus/UDP\n");
+         break;
+         default:
+            printf("unknown\n");
+         break;
+      }
    }
    printf("Slave configuration: ");
-   printf("address = %d, ", address);
+   if (instanceCnt == 0)
+      printf("address = %d, ", address);
    printf("master activity t/o = %.2f\n", ((float) timeOut) / 1000.0F);
-   if (protocol == TCP)
+   if (shmName != NULL)
+      printf("Data tables in shared memory segment %s\n", shmName);
+   if (tableProfilePtr != NULL)
+      printf("Data table profile: %s (%s)\n", tableProfilePtr->name,
+             tableProfilePtr->description);
+#ifndef _WIN32
+   if (virtualPortCnt > 0)
+   {
+      printf("Virtual devices: ports %d - %d, ", port, port + virtualPortCnt - 1);
+      if (maxVirtualDevices > 0)
+         printf("max %d resident\n", maxVirtualDevices);
+      else
+         printf("unlimited\n");
+   }
+#endif
+#ifndef _WIN32
+   if ((serverCpu >= 0) || (rtPriority > 0) || lockMemory || (busyPollUsec > 0))
+   {
+      printf("Real-time configuration: ");
+      if (serverCpu >= 0)
+         printf("server CPU = %d, ", serverCpu);
+      if (ioCpu >= 0)
+         printf("I/O CPU = %d, ", ioCpu);
+      if (rtPriority > 0)
+         printf("SCHED_FIFO priority = %d, ", rtPriority);
+      if (busyPollUsec > 0)
+         printf("busy poll = %d us, ", busyPollUsec);
+      printf("memory %s\n", lockMemory ? "locked" : "not locked");
+   }
+#endif
+#ifndef _WIN32
+   if (instanceCnt > 0)
+      printf("TCP configuration: connection t/o = %.2f\n", ((float) connectionTo) / 1000.0F);
+   else
+#endif
+   if (protocol == UDP)
+   {
+      printf("UDP configuration: ");
+      printf("port = %d\n", port);
+   }
+   else if ((protocol == TCP) || (protocol == RTUTCP))
    {
       printf("TCP configuration: ");
       printf("port = %d, ", port);
@@ -197,6 +463,15 @@ void printConfig()
          break;
       }
    }
+#ifdef HAS_OPENSSL
+   if (tlsPort != 0)
+   {
+      printf("TLS configuration: ");
+      printf("port = %d, ", tlsPort);
+      printf("client certificate %s\n",
+             tlsCaFileName != NULL ? "required" : "not requested");
+   }
+#endif
    printf("\n");
 }
 
@@ -213,6 +488,192 @@ void exitBadOption(const char *const text)
 }
 
 
+#ifndef _WIN32
+/**
+ * Extracts the long options with a parameter from the command line,
+ * getopt() only handles the short ones.
+ *
+ * @param argcPtr Argument count, updated
+ * @param argv Argument value string array, updated
+ */
+void scanLongOptions(int *argcPtr, char **argv)
+{
+   int c;
+   int i = 1;
+
+   for (c = 1; c < *argcPtr; c++)
+   {
+      if ((strcmp(argv[c], "--snapshot") == 0) && (c + 1 < *argcPtr))
+         snapshotName = argv[++c];
+      else if ((strcmp(argv[c], "--save-snapshot") == 0) && (c + 1 < *argcPtr))
+         saveSnapshotName = argv[++c];
+      else if ((strcmp(argv[c], "--clone") == 0) && (c + 1 < *argcPtr))
+      {
+         cloneCnt = (int) strtol(argv[++c], NULL, 0);
+         if ((cloneCnt <= 0) || (cloneCnt > 1000))
+            exitBadOption("Invalid clone count parameter");
+      }
+      else if ((strcmp(argv[c], "--instances") == 0) && (c + 1 < *argcPtr))
+         instanceFileName = argv[++c];
+      else if ((strcmp(argv[c], "--threads") == 0) && (c + 1 < *argcPtr))
+      {
+         workerThreadCnt = (int) strtol(argv[++c], NULL, 0);
+         if ((workerThreadCnt <= 0) || (workerThreadCnt > 64))
+            exitBadOption("Invalid thread count parameter");
+      }
+      else
+         argv[i++] = argv[c];
+   }
+   *argcPtr = i;
+   argv[i] = NULL;
+}
+
+
+/**
+ * Parses a slave address set of an instance, "*" or a comma separated list
+ * of addresses and address ranges.
+ *
+ * @return 0 on success, -1 on error
+ */
+int parseAddressSet(char *setPtr, int protocol, unsigned char servedArr[256])
+{
+   int firstAddr = protocol == RTUTCP ? 1 : 0;
+   char *endPtr;
+   long startAddr;
+   long endAddr;
+   int i;
+
+   memset(servedArr, 0, 256);
+   if (strcmp(setPtr, "*") == 0)
+   {
+      for (i = firstAddr; i < 255; i++)
+         servedArr[i] = 1;
+      return 0;
+   }
+   for (;;)
+   {
+      startAddr = strtol(setPtr, &endPtr, 0);
+      if (endPtr == setPtr)
+         return -1;
+      endAddr = startAddr;
+      if (*endPtr == '-')
+      {
+         setPtr = endPtr + 1;
+         endAddr = strtol(setPtr, &endPtr, 0);
+         if (endPtr == setPtr)
+            return -1;
+      }
+      if ((startAddr < firstAddr) || (endAddr > 254) || (startAddr > endAddr))
+         return -1;
+      for (i = (int) startAddr; i <= endAddr; i++)
+         servedArr[i] = 1;
+      if (*endPtr == '\0')
+         return 0;
+      if (*endPtr != ',')
+         return -1;
+      setPtr = endPtr + 1;
+   }
+}
+
+
+/**
+ * Reads the instance file of --instances. Exits the program on error.
+ *
+ * @param fileName Instance file
+ */
+void loadInstances(const char *fileName)
+{
+   DiagslaveInstance *instPtr;
+   FILE *filePtr;
+   char lineArr[1024];
+   char *wordArr[5];
+   char *wordPtr;
+   char *savePtr;
+   int lineNo = 0;
+   int wordCnt;
+   const char *errorPtr;
+
+   filePtr = fopen(fileName, "r");
+   if (filePtr == NULL)
+   {
+      fprintf(stderr, "Cannot open instance file %s: %s!\n", fileName, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+   while (fgets(lineArr, sizeof(lineArr), filePtr) != NULL)
+   {
+      lineNo++;
+      if (strchr(lineArr, '#') != NULL)
+         *strchr(lineArr, '#') = '\0';
+      wordCnt = 0;
+      wordPtr = strtok_r(lineArr, " \t\r\n", &savePtr);
+      while ((wordPtr != NULL) && (wordCnt < 5))
+      {
+         wordArr[wordCnt++] = wordPtr;
+         wordPtr = strtok_r(NULL, " \t\r\n", &savePtr);
+      }
+      if (wordCnt == 0)
+         continue;
+
+      instanceArr = (DiagslaveInstance *) realloc(instanceArr,
+                                                  (instanceCnt + 1) * sizeof(*instanceArr));
+      if (instanceArr == NULL)
+      {
+         fprintf(stderr, "Out of memory!\n");
+         exit(EXIT_FAILURE);
+      }
+      instPtr = &instanceArr[instanceCnt];
+      memset(instPtr, 0, sizeof(*instPtr));
+      errorPtr = NULL;
+      if ((wordCnt < 3) || (wordCnt > 4))
+         errorPtr = "Expected protocol, port and addresses";
+      else if (strcmp(wordArr[0], "rtutcp") == 0)
+         instPtr->protocol = RTUTCP;
+      else if (strcmp(wordArr[0], "udp") == 0)
+         instPtr->protocol = UDP;
+      else
+         errorPtr = "Protocol must be rtutcp or udp";
+      if (errorPtr == NULL)
+      {
+         instPtr->port = (int) strtol(wordArr[1], NULL, 0);
+         if ((instPtr->port <= 0) || (instPtr->port > 0xFFFF))
+            errorPtr = "Invalid port";
+         else if (parseAddressSet(wordArr[2], instPtr->protocol, instPtr->servedArr) != 0)
+            errorPtr = "Invalid addresses";
+         else if (wordCnt == 4)
+         {
+            if (strcmp(wordArr[3], "private") == 0)
+               instPtr->privateTables = 1;
+            else
+               errorPtr = "Unknown keyword";
+         }
+      }
+      if ((errorPtr == NULL) && instPtr->privateTables && (shmName != NULL))
+         errorPtr = "Private tables cannot be placed in shared memory";
+      // The history is kept per slave address, it cannot tell the tables
+      // of one address apart
+      if ((errorPtr == NULL) && instPtr->privateTables && (registerHistoryPtr != NULL))
+         errorPtr = "Private tables cannot be combined with register history";
+      if ((errorPtr == NULL) && instPtr->privateTables && (flushIntervalMs > 0))
+         errorPtr = "Private tables cannot be combined with write coalescing";
+      if (errorPtr != NULL)
+      {
+         fprintf(stderr, "%s:%d: %s!\n", fileName, lineNo, errorPtr);
+         exit(EXIT_FAILURE);
+      }
+      instanceCnt++;
+   }
+   fclose(filePtr);
+   if (instanceCnt == 0)
+   {
+      fprintf(stderr, "No instances in %s!\n", fileName);
+      exit(EXIT_FAILURE);
+   }
+   if (workerThreadCnt > instanceCnt)
+      workerThreadCnt = instanceCnt;
+}
+#endif
+
+
 /**
  * Scans and parses the command line options.
  *
@@ -243,7 +704,8 @@ void scanOptions(int argc, char **argv)
    opterr = 0; // Disable getopt's error messages
    for(;;)
    {
-      c = getopt(argc, argv, "h4:a:b:d:s:p:m:o:c:");
+      c = getopt(argc, argv, "h4:a:b:d:s:p:m:o:c:P:X:" TLS_OPTIONS SHM_OPTIONS PTY_OPTIONS
+                 RT_OPTIONS VDEV_OPTIONS PROF_OPTIONS HIST_OPTIONS ADMIN_OPTIONS);
       if (c == -1)
          break;
 
@@ -265,9 +727,42 @@ void scanOptions(int argc, char **argv)
                      protocol = ASCII;
                   }
                   else
-                  {
-                     exitBadOption("Invalid protocol parameter");
-                  }
+#ifndef _WIN32
+                     if (strcmp(optarg, "rtutcp") == 0)
+                     {
+                        protocol = RTUTCP;
+                     }
+                     else
+                        if (strcmp(optarg, "udp") == 0)
+                        {
+                           protocol = UDP;
+                        }
+                        else
+#endif
+                        {
+                           exitBadOption("Invalid protocol parameter");
+                        }
+         break;
+         case 'P':
+            if (strcmp(optarg, "list") == 0)
+            {
+               printDataTableProfiles();
+               exit(EXIT_SUCCESS);
+            }
+            tableProfilePtr = findDataTableProfile(optarg);
+            if (tableProfilePtr == NULL)
+               exitBadOption("Invalid data table profile parameter");
+         break;
+         case 'X':
+         {
+            int slaveAddr;
+            int status;
+
+            if ((sscanf(optarg, "%i:%i", &slaveAddr, &status) != 2) ||
+                (slaveAddr < 0) || (slaveAddr > 255) || (status < 0) || (status > 255))
+               exitBadOption("Invalid exception status parameter");
+            DiagnosticMbusDataTable::exceptionStatusArr[slaveAddr] = (unsigned char) status;
+         }
          break;
          case 'a':
             address = strtol(optarg, NULL, 0);
@@ -326,6 +821,118 @@ void scanOptions(int argc, char **argv)
                         exitBadOption("Invalid parity or port parameter");
                   }
          break;
+#ifndef _WIN32
+         case 'e':
+            ptyPacing = 1;
+         break;
+         case 'g':
+            ptyGapUsec = strtol(optarg, NULL, 0);
+            if ((ptyGapUsec <= 0) || (ptyGapUsec > 1000000))
+               exitBadOption("Invalid inter-character gap parameter");
+         break;
+         case 'M':
+            shmName = optarg;
+            if ((shmName[0] != '/') || (strchr(shmName + 1, '/') != NULL))
+               exitBadOption("Invalid shared memory name parameter");
+         break;
+         case 'x':
+         {
+            char *endPtr;
+
+            serverCpu = (int) strtol(optarg, &endPtr, 0);
+            if (*endPtr == ',')
+               ioCpu = (int) strtol(endPtr + 1, &endPtr, 0);
+            if ((*endPtr != '\0') || (serverCpu < 0) || (serverCpu >= CPU_SETSIZE) ||
+                (ioCpu >= CPU_SETSIZE))
+               exitBadOption("Invalid CPU parameter");
+         }
+         break;
+         case 'r':
+            rtPriority = (int) strtol(optarg, NULL, 0);
+            if ((rtPriority < sched_get_priority_min(SCHED_FIFO)) ||
+                (rtPriority > sched_get_priority_max(SCHED_FIFO)))
+               exitBadOption("Invalid real-time priority parameter");
+         break;
+         case 'l':
+            lockMemory = 1;
+         break;
+         case 'y':
+            busyPollUsec = (int) strtol(optarg, NULL, 0);
+            if ((busyPollUsec <= 0) || (busyPollUsec > 100000))
+               exitBadOption("Invalid busy poll parameter");
+         break;
+         case 'j':
+            jitterReport = 1;
+         break;
+         case 'N':
+            virtualPortCnt = (int) strtol(optarg, NULL, 0);
+            if ((virtualPortCnt <= 0) || (virtualPortCnt > MbusSocketServer::MAX_PORTS))
+               exitBadOption("Invalid virtual device port count parameter");
+         break;
+         case 'E':
+            maxVirtualDevices = (int) strtol(optarg, NULL, 0);
+            if (maxVirtualDevices <= 0)
+               exitBadOption("Invalid max virtual devices parameter");
+         break;
+         case 'q':
+            accessProfiling = 1;
+         break;
+         case 'w':
+            workloadFileName = optarg;
+            accessProfiling = 1;
+         break;
+         case 'H':
+         {
+            int slaveAddr;
+            int startAddr;
+            int endAddr;
+
+            if (registerHistoryPtr == NULL)
+               registerHistoryPtr = new RegisterHistory();
+            if ((sscanf(optarg, "%d:%d-%d", &slaveAddr, &startAddr, &endAddr) != 3) ||
+                (registerHistoryPtr->addRange(slaveAddr, startAddr, endAddr) != 0))
+               exitBadOption("Invalid register history range parameter");
+         }
+         break;
+         case 'k':
+            historyKiB = strtol(optarg, NULL, 0);
+            if ((historyKiB <= 0) || (historyKiB > 4 * 1024 * 1024))
+               exitBadOption("Invalid register history memory parameter");
+         break;
+         case 'z':
+            historyFileName = optarg;
+         break;
+         case 'F':
+            flushIntervalMs = strtol(optarg, NULL, 0);
+            if ((flushIntervalMs <= 0) || (flushIntervalMs > 60000))
+               exitBadOption("Invalid write coalescing interval parameter");
+         break;
+         case 'U':
+            adminSocketName = optarg;
+         break;
+#endif
+#ifdef HAS_OPENSSL
+         case 'S':
+            tlsPort = strtol(optarg, NULL, 0);
+            if ((tlsPort <= 0) || (tlsPort > 0xFFFF))
+               exitBadOption("Invalid TLS port parameter");
+         break;
+         case 'C':
+            tlsCertFileName = optarg;
+         break;
+         case 'K':
+            tlsKeyFileName = optarg;
+         break;
+         case 'A':
+            tlsCaFileName = optarg;
+         break;
+         case 'R':
+            if (tlsServerPtr == NULL)
+               tlsServerPtr = new MbusTlsServer();
+            if (tlsServerPtr->addRole(optarg) != FTALK_SUCCESS)
+               exitBadOption("Invalid role parameter");
+         break;
+#endif
          case 'h':
             printUsage();
          break;
@@ -346,120 +953,1574 @@ void scanOptions(int argc, char **argv)
          protocol = RTU;
    }
 
-   if (protocol == TCP)
+   if ((protocol == TCP) || (protocol == RTUTCP) || (protocol == UDP) ||
+       (instanceFileName != NULL))
    {
       if ((argc - optind) != 0)
          exitBadOption("Invalid number of parameters");
    }
    else
    {
-      if ((argc - optind) != 1)
-         exitBadOption("Invalid number of parameters");
-      else
+      // A restored snapshot may supply the serial port
+      if ((argc - optind) == 1)
          portName = argv[optind];
+      else if (((argc - optind) != 0) || (portName == NULL))
+         exitBadOption("Invalid number of parameters");
+   }
+
+   if ((tableProfilePtr != NULL) && (shmName != NULL))
+      exitBadOption("Data table profiles cannot be placed in shared memory");
+
+#ifndef _WIN32
+   if (virtualPortCnt > 0)
+   {
+      if ((protocol != RTUTCP) && (protocol != UDP))
+         exitBadOption("Virtual devices require RTU over TCP or UDP protocol");
+      if ((address != -1) || (shmName != NULL) || (tableProfilePtr != NULL))
+         exitBadOption("Virtual devices cannot be combined with -a, -M or -P");
+      if (port + virtualPortCnt - 1 > 0xFFFF)
+         exitBadOption("Invalid virtual device port count parameter");
+   }
+   else
+      if (maxVirtualDevices > 0)
+         exitBadOption("Max virtual devices requires virtual devices");
+
+   if ((historyFileName != NULL) && (registerHistoryPtr == NULL))
+      exitBadOption("History export requires a register history range");
+   if ((flushIntervalMs > 0) && (registerHistoryPtr == NULL))
+      exitBadOption("Write coalescing requires a register history range");
+   if ((registerHistoryPtr != NULL) && (virtualPortCnt > 0))
+      exitBadOption("Register history cannot be combined with -N");
+   if ((adminSocketName != NULL) && (virtualPortCnt > 0))
+      exitBadOption("Admin interface cannot be combined with -N");
+
+   if (((snapshotName != NULL) || (saveSnapshotName != NULL)) &&
+       ((tableProfilePtr != NULL) || (virtualPortCnt > 0)))
+      exitBadOption("Snapshots cannot be combined with -P or -N");
+   if ((snapshotName != NULL) && (shmName != NULL))
+      exitBadOption("Snapshots cannot be combined with -M");
+   if (cloneCnt > 0)
+   {
+      if ((saveSnapshotName != NULL) || (historyFileName != NULL) ||
+          (adminSocketName != NULL))
+         exitBadOption("Clones cannot save a snapshot, export history or serve -U");
+      if (((protocol == RTU) || (protocol == ASCII)) && (strcmp(portName, "pty") != 0))
+         exitBadOption("Clones require a network protocol or a virtual serial port");
+      if (port + cloneCnt * (virtualPortCnt > 0 ? virtualPortCnt : 1) - 1 > 0xFFFF)
+         exitBadOption("Invalid clone count parameter");
+   }
+
+   if ((ptyPacing || (ptyGapUsec > 0)) &&
+       ((portName == NULL) || (strcmp(portName, "pty") != 0)))
+      exitBadOption("Line timing emulation requires a virtual serial port");
+
+   if (instanceFileName != NULL)
+   {
+      if ((virtualPortCnt > 0) || (adminSocketName != NULL) || (cloneCnt > 0) ||
+          (address != -1))
+         exitBadOption("Instances cannot be combined with -N, -U, -a or --clone");
+      loadInstances(instanceFileName);
+   }
+   else
+      if (workerThreadCnt != 1)
+         exitBadOption("Event loop threads require instances");
+#endif
+
+#ifdef HAS_OPENSSL
+   if (tlsPort != 0)
+   {
+      if ((tlsCertFileName == NULL) || (tlsKeyFileName == NULL))
+         exitBadOption("TLS requires a certificate and a key file");
+      // Roles are taken from client certificates, which only -A requests
+      if ((tlsServerPtr != NULL) && (tlsCaFileName == NULL))
+         exitBadOption("TLS roles require CA certificates (-A)");
+      if (virtualPortCnt > 0)
+         exitBadOption("TLS cannot be combined with virtual devices");
+   }
+   else
+   {
+      if ((tlsCertFileName != NULL) || (tlsKeyFileName != NULL) ||
+          (tlsCaFileName != NULL) || (tlsServerPtr != NULL))
+         exitBadOption("TLS options require a TLS port");
    }
+#endif
 }
 
 
 
 
+#ifndef _WIN32
 /**
- * Callback function which cecks a master's IP address and
- * either accepts or rejects a master's connection.
- *
- * @param masterIpAddrSz IPv4 Internet host address string
- * in the standard numbers-and-dots notation.
+ * Creates the shared memory segment for the data tables or attaches to an
+ * existing one. Register values in an existing segment are preserved.
+ * Exits the program on error.
  *
- * @return Returns 1 to accept a connection or 0 to reject it.
+ * @param name Name of the POSIX shared memory object
+ * @return Pointer to the mapped segment
  */
-int validateMasterIpAddr(const char* masterIpAddrSz)
+DiagShmHeader *openSharedMemory(const char *name)
 {
-   printf("\nvalidateMasterIpAddr: accepting connection from %s\n",
-          masterIpAddrSz);
-   return 1;
+   DiagShmHeader *headerPtr;
+   struct stat st;
+   int fd;
+
+   fd = shm_open(name, O_RDWR | O_CREAT, 0660);
+   if (fd < 0)
+   {
+      fprintf(stderr, "Cannot open shared memory %s: %s!\n", name, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+   if (fstat(fd, &st) < 0)
+   {
+      fprintf(stderr, "Cannot open shared memory %s: %s!\n", name, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+
+   //
+   // Only a new segment is sized. Resizing an existing one of another
+   // layout would fault its users mapping beyond the new end.
+   //
+   if ((st.st_size != 0) && (st.st_size != (off_t) DIAG_SHM_SIZE))
+   {
+      fprintf(stderr, "Shared memory %s has an incompatible layout!\n", name);
+      exit(EXIT_FAILURE);
+   }
+   if ((st.st_size == 0) && (ftruncate(fd, DIAG_SHM_SIZE) < 0))
+   {
+      fprintf(stderr, "Cannot size shared memory %s: %s!\n", name, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+   headerPtr = (DiagShmHeader *) mmap(NULL, DIAG_SHM_SIZE,
+                                      PROT_READ | PROT_WRITE, MAP_SHARED,
+                                      fd, 0);
+   close(fd);
+   if (headerPtr == MAP_FAILED)
+   {
+      fprintf(stderr, "Cannot map shared memory %s: %s!\n", name, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+
+   //
+   // A new segment is zero filled and just needs a header. An existing
+   // segment must match our layout.
+   //
+   if (headerPtr->magic != DIAG_SHM_MAGIC)
+   {
+      headerPtr->version = DIAG_SHM_VERSION;
+      headerPtr->headerSize = sizeof(DiagShmHeader);
+      headerPtr->slaveSize = sizeof(DiagShmSlave);
+      headerPtr->slaveCnt = DIAG_SHM_SLAVE_CNT;
+      headerPtr->regCnt = DIAG_SHM_REG_CNT;
+      headerPtr->bitCnt = DIAG_SHM_BIT_CNT;
+      headerPtr->magic = DIAG_SHM_MAGIC;
+   }
+   else
+      if ((headerPtr->version != DIAG_SHM_VERSION) ||
+          (headerPtr->headerSize != sizeof(DiagShmHeader)) ||
+          (headerPtr->slaveSize != sizeof(DiagShmSlave)))
+      {
+         fprintf(stderr, "Shared memory %s has an incompatible layout!\n", name);
+         exit(EXIT_FAILURE);
+      }
+   headerPtr->serverPid = (uint32_t) getpid();
+   return headerPtr;
 }
 
 
 /**
- * Starts up server
+ * Maps a snapshot privately and restores configuration and
+ * identification objects from it. The data tables are later constructed
+ * on the mapped image, so restoring copies no register data. Exits the
+ * program on error.
+ *
+ * @param fileName Snapshot file
  */
-void startupServer()
+void loadSnapshot(const char *fileName)
 {
-   int i;
-   int result = -1;
+   DiagSnapshotInfo *infoPtr;
+   struct stat fileStat;
+   void *mapPtr;
+   int fd;
 
-   switch (protocol)
+   fd = open(fileName, O_RDONLY);
+   if (fd < 0)
    {
-      case RTU:
-         mbusServerPtr = new MbusRtuSlaveProtocol();
-         if (address == -1)
-         {
-            for (i = 1; i < 255; i++)
-            mbusServerPtr->addDataTable(i, dataTablePtrArr[i]);
-         }
-         else
-            mbusServerPtr->addDataTable(address, dataTablePtrArr[address]);
-         mbusServerPtr->setTimeout(timeOut);
-         if (rs485Mode > 0)
-            ((MbusRtuSlaveProtocol *) mbusServerPtr)->enableRs485Mode(rs485Mode);
-         result = ((MbusRtuSlaveProtocol *) mbusServerPtr)->startupServer(
-                    portName, baudRate, dataBits, stopBits, parity);
-      break;
-      case ASCII:
-         mbusServerPtr = new MbusAsciiSlaveProtocol();
-         if (address == -1)
-         {
-            for (i = 1; i < 255; i++)
+      fprintf(stderr, "Cannot open snapshot %s: %s!\n", fileName, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+   if ((fstat(fd, &fileStat) < 0) || (fileStat.st_size != (off_t) DIAG_SNAP_SIZE))
+   {
+      fprintf(stderr, "Snapshot %s has an incompatible size!\n", fileName);
+      exit(EXIT_FAILURE);
+   }
+   mapPtr = mmap(NULL, DIAG_SNAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (mapPtr == MAP_FAILED)
+   {
+      fprintf(stderr, "Cannot map snapshot %s: %s!\n", fileName, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+   shmHeaderPtr = (DiagShmHeader *) mapPtr;
+   infoPtr = DIAG_SNAP_INFO(shmHeaderPtr);
+   if ((shmHeaderPtr->magic != DIAG_SHM_MAGIC) ||
+       (shmHeaderPtr->version != DIAG_SHM_VERSION) ||
+       (shmHeaderPtr->headerSize != sizeof(DiagShmHeader)) ||
+       (shmHeaderPtr->slaveSize != sizeof(DiagShmSlave)) ||
+       (shmHeaderPtr->slaveCnt != DIAG_SHM_SLAVE_CNT) ||
+       (shmHeaderPtr->regCnt != DIAG_SHM_REG_CNT) ||
+       (shmHeaderPtr->bitCnt != DIAG_SHM_BIT_CNT) ||
+       (infoPtr->magic != DIAG_SNAP_MAGIC) ||
+       (infoPtr->version != DIAG_SNAP_VERSION) ||
+       (infoPtr->infoSize != sizeof(DiagSnapshotInfo)))
+   {
+      fprintf(stderr, "Snapshot %s has an incompatible layout!\n", fileName);
+      exit(EXIT_FAILURE);
+   }
+
+   //
+   // The configuration is used to index tables and open ports, apply the
+   // limits of the corresponding command line options
+   //
+   if ((infoPtr->protocol < RTU) || (infoPtr->protocol > UDP) ||
+       (infoPtr->address < -1) || (infoPtr->address > 255) ||
+       (infoPtr->port <= 0) || (infoPtr->port > 0xFFFF) ||
+       (infoPtr->timeOut < 1000) || (infoPtr->timeOut > 100000) ||
+       (infoPtr->connectionTo < 10000) || (infoPtr->connectionTo > 3600000) ||
+       (infoPtr->baudRate <= 0) ||
+       ((infoPtr->dataBits != 7) && (infoPtr->dataBits != 8)) ||
+       ((infoPtr->stopBits != 1) && (infoPtr->stopBits != 2)) ||
+       ((infoPtr->parity != MbusSerialSlaveProtocol::SER_PARITY_NONE) &&
+        (infoPtr->parity != MbusSerialSlaveProtocol::SER_PARITY_ODD) &&
+        (infoPtr->parity != MbusSerialSlaveProtocol::SER_PARITY_EVEN)))
+   {
+      fprintf(stderr, "Snapshot %s has an invalid configuration!\n", fileName);
+      exit(EXIT_FAILURE);
+   }
+
+   protocol = infoPtr->protocol;
+   address = infoPtr->address;
+   port = infoPtr->port;
+   timeOut = infoPtr->timeOut;
+   connectionTo = infoPtr->connectionTo;
+   baudRate = infoPtr->baudRate;
+   dataBits = infoPtr->dataBits;
+   stopBits = infoPtr->stopBits;
+   parity = infoPtr->parity;
+   infoPtr->portName[sizeof(infoPtr->portName) - 1] = '\0';
+   if (infoPtr->portName[0] != '\0')
+      portName = infoPtr->portName;
+
+   //
+   // The mapping is private, so terminating the strings in place does not
+   // modify the file
+   //
+   infoPtr->vendorName[sizeof(infoPtr->vendorName) - 1] = '\0';
+   infoPtr->productCode[sizeof(infoPtr->productCode) - 1] = '\0';
+   infoPtr->vendorUrl[sizeof(infoPtr->vendorUrl) - 1] = '\0';
+   infoPtr->productName[sizeof(infoPtr->productName) - 1] = '\0';
+   infoPtr->modelName[sizeof(infoPtr->modelName) - 1] = '\0';
+   infoPtr->userApplicationName[sizeof(infoPtr->userApplicationName) - 1] = '\0';
+   VENDOR_NAME = infoPtr->vendorName;
+   PRODUCT_CODE = infoPtr->productCode;
+   VENDOR_URL = infoPtr->vendorUrl;
+   PRODUCT_NAME = infoPtr->productName;
+   MODEL_NAME = infoPtr->modelName;
+   USER_APPLICATION_NAME = infoPtr->userApplicationName;
+   memcpy(CUSTOM_OBJECT, infoPtr->customObject, sizeof(CUSTOM_OBJECT));
+}
+
+
+/**
+ * Writes a snapshot of the data tables, identification objects and
+ * configuration. The file is written under a temporary name and renamed,
+ * so an existing snapshot is replaced atomically.
+ *
+ * @param fileName Snapshot file
+ * @return 0 on success, -1 on error
+ */
+int saveSnapshot(const char *fileName)
+{
+   DiagShmHeader header;
+   DiagShmSlave *slavePtr;
+   DiagSnapshotInfo info;
+   char tmpName[1024];
+   FILE *filePtr;
+   int result = 0;
+   int i;
+
+   snprintf(tmpName, sizeof(tmpName), "%s.tmp", fileName);
+   filePtr = fopen(tmpName, "wb");
+   if (filePtr == NULL)
+      return -1;
+   slavePtr = new DiagShmSlave;
+
+   memset(&header, 0, sizeof(header));
+   header.magic = DIAG_SHM_MAGIC;
+   header.version = DIAG_SHM_VERSION;
+   header.headerSize = sizeof(DiagShmHeader);
+   header.slaveSize = sizeof(DiagShmSlave);
+   header.slaveCnt = DIAG_SHM_SLAVE_CNT;
+   header.regCnt = DIAG_SHM_REG_CNT;
+   header.bitCnt = DIAG_SHM_BIT_CNT;
+   if (fwrite(&header, sizeof(header), 1, filePtr) != 1)
+      result = -1;
+   for (i = 0; (i < DIAG_SHM_SLAVE_CNT) && (result == 0); i++)
+   {
+      if ((i < 255) && (dataTablePtrArr[i] != NULL))
+         ((DiagnosticMbusDataTable *) dataTablePtrArr[i])->copyData(slavePtr);
+      else
+         memset(slavePtr, 0, sizeof(*slavePtr));
+      if (fwrite(slavePtr, sizeof(*slavePtr), 1, filePtr) != 1)
+         result = -1;
+   }
+
+   memset(&info, 0, sizeof(info));
+   info.magic = DIAG_SNAP_MAGIC;
+   info.version = DIAG_SNAP_VERSION;
+   info.infoSize = sizeof(DiagSnapshotInfo);
+   info.protocol = protocol;
+   info.address = address;
+   info.port = port;
+   info.timeOut = timeOut;
+   info.connectionTo = connectionTo;
+   info.baudRate = baudRate;
+   info.dataBits = dataBits;
+   info.stopBits = stopBits;
+   info.parity = parity;
+   if ((portName != NULL) && (virtualPortPtr == NULL))
+      strncpy(info.portName, portName, sizeof(info.portName) - 1);
+   else if (virtualPortPtr != NULL)
+      strcpy(info.portName, "pty");
+   strncpy(info.vendorName, VENDOR_NAME, sizeof(info.vendorName) - 1);
+   strncpy(info.productCode, PRODUCT_CODE, sizeof(info.productCode) - 1);
+   strncpy(info.vendorUrl, VENDOR_URL, sizeof(info.vendorUrl) - 1);
+   strncpy(info.productName, PRODUCT_NAME, sizeof(info.productName) - 1);
+   strncpy(info.modelName, MODEL_NAME, sizeof(info.modelName) - 1);
+   strncpy(info.userApplicationName, USER_APPLICATION_NAME,
+           sizeof(info.userApplicationName) - 1);
+   memcpy(info.customObject, CUSTOM_OBJECT, sizeof(info.customObject));
+   if ((result == 0) && (fwrite(&info, sizeof(info), 1, filePtr) != 1))
+      result = -1;
+
+   delete slavePtr;
+   if (fclose(filePtr) != 0)
+      result = -1;
+   if ((result == 0) && (rename(tmpName, fileName) != 0))
+      result = -1;
+   if (result != 0)
+      remove(tmpName);
+   return result;
+}
+
+
+/**
+ * Forks the clones and supervises them. Returns only in the clones, with
+ * the port numbers advanced by the clone's index. The clones share the
+ * data table pages copy-on-write. The supervisor forwards termination
+ * signals to the clones and exits when all have terminated. The signal
+ * handlers must be installed before.
+ */
+void forkClones()
+{
+   pid_t *pidArr;
+   pid_t pid;
+   int portStep = virtualPortCnt > 0 ? virtualPortCnt : 1;
+   int runningCnt = 0;
+   int terminated = 0;
+   int failed = 0;
+   int status;
+   int i;
+
+   pidArr = new pid_t[cloneCnt];
+   fflush(stdout);
+   for (i = 0; i < cloneCnt; i++)
+   {
+      pidArr[i] = fork();
+      if (pidArr[i] == 0)
+      {
+         delete[] pidArr;
+         // Memory locks are not inherited. Locking breaks the copy-on-write
+         // sharing of the tables, a clone then owns its copy like any
+         // process started with -l.
+         if (lockMemory && (mlockall(MCL_CURRENT | MCL_FUTURE) < 0))
+         {
+            fprintf(stderr, "Cannot lock memory of clone %d: %s!\n", i, strerror(errno));
+            exit(EXIT_FAILURE);
+         }
+         port += i * portStep;
+#ifdef HAS_OPENSSL
+         if (tlsPort != 0)
+            tlsPort += i;
+#endif
+         return;
+      }
+      if (pidArr[i] < 0)
+      {
+         fprintf(stderr, "Cannot fork clone %d: %s!\n", i, strerror(errno));
+         failed = 1;
+         break;
+      }
+      runningCnt++;
+   }
+   if ((protocol == RTU) || (protocol == ASCII))
+      printf("%d clones started\n", runningCnt);
+   else
+      printf("%d clones started on ports %d - %d\n", runningCnt, port,
+             port + runningCnt * portStep - 1);
+   fflush(stdout);
+
+   if (failed)
+      stopRequested = 1;
+   while (runningCnt > 0)
+   {
+      if (stopRequested && !terminated)
+      {
+         for (i = 0; i < runningCnt; i++)
+            kill(pidArr[i], SIGTERM);
+         terminated = 1;
+      }
+      pid = waitpid(-1, &status, 0);
+      if (pid < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+      for (i = 0; i < runningCnt; i++)
+      {
+         if (pidArr[i] == pid)
+            pidArr[i] = pidArr[--runningCnt];
+      }
+      if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+         failed = 1;
+   }
+   delete[] pidArr;
+   exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+#endif
+
+
+/**
+ * Callback function which cecks a master's IP address and
+ * either accepts or rejects a master's connection.
+ *
+ * @param masterIpAddrSz IPv4 Internet host address string
+ * in the standard numbers-and-dots notation.
+ *
+ * @return Returns 1 to accept a connection or 0 to reject it.
+ */
+int validateMasterIpAddr(const char* masterIpAddrSz)
+{
+   printf("\nvalidateMasterIpAddr: accepting connection from %s\n",
+          masterIpAddrSz);
+   return 1;
+}
+
+
+#ifndef _WIN32
+/**
+ * Blocks the termination signals in the calling thread. Helper threads are
+ * created with these signals blocked so that the signals are always
+ * delivered to the main thread and interrupt its serverLoop().
+ *
+ * @param oldSigSetPtr Receives the previous signal mask
+ */
+void blockTerminationSignals(sigset_t *oldSigSetPtr)
+{
+   sigset_t sigSet;
+
+   sigemptyset(&sigSet);
+   sigaddset(&sigSet, SIGINT);
+   sigaddset(&sigSet, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &sigSet, oldSigSetPtr);
+}
+
+
+/**
+ * Applies the configured CPU affinity and real-time priority to a thread.
+ * Exits the program on error.
+ *
+ * @param thread Thread to tune
+ * @param cpu CPU to pin the thread to or -1 to leave it unpinned
+ */
+void tuneThread(pthread_t thread, int cpu)
+{
+   int result;
+
+#ifdef __linux__
+   if (cpu >= 0)
+   {
+      cpu_set_t cpuSet;
+
+      CPU_ZERO(&cpuSet);
+      CPU_SET(cpu, &cpuSet);
+      result = pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet);
+      if (result != 0)
+      {
+         fprintf(stderr, "Cannot pin thread to CPU %d: %s!\n", cpu, strerror(result));
+         exit(EXIT_FAILURE);
+      }
+   }
+#endif
+   if (rtPriority > 0)
+   {
+      struct sched_param schedParam;
+
+      memset(&schedParam, 0, sizeof(schedParam));
+      schedParam.sched_priority = rtPriority;
+      result = pthread_setschedparam(thread, SCHED_FIFO, &schedParam);
+      if (result != 0)
+      {
+         fprintf(stderr, "Cannot set real-time priority: %s!\n", strerror(result));
+         exit(EXIT_FAILURE);
+      }
+   }
+}
+
+
+/**
+ * Touches all data table pages and locks the process memory so serving a
+ * request never waits for a page fault. Profile tables are already touched
+ * when cleared by their constructor. Exits the program on error.
+ */
+void lockDataTables()
+{
+   int i;
+
+   if ((tableProfilePtr == NULL) && (deviceDirPtr == NULL))
+   {
+      for (i = 0; i < 255; i++)
+      {
+         if (dataTablePtrArr[i] != NULL)
+            ((DiagnosticMbusDataTable *) dataTablePtrArr[i])->prefault();
+      }
+   }
+   if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+   {
+      fprintf(stderr, "Cannot lock memory: %s!\n", strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+}
+
+
+/**
+ * Applies the busy poll and latency report options to a socket server.
+ * Must be called before the server is started up.
+ */
+void configureSocketServer(MbusSocketServer *serverPtr)
+{
+   serverPtr->setDiagnostics(&busDiagnostics);
+   if (busyPollUsec > 0)
+      serverPtr->setBusyPoll(busyPollUsec);
+   if (jitterReport)
+      serverPtr->enableLatencyReport();
+}
+
+
+/**
+ * Creates the virtual serial port and starts its relay thread. The
+ * protocol is then started on the server side pseudo-terminal.
+ */
+void startupVirtualPort()
+{
+   sigset_t oldSigSet;
+   int charBits;
+
+   virtualPortPtr = new VirtualSerialPort();
+   if (virtualPortPtr->openPorts() != FTALK_SUCCESS)
+   {
+      fprintf(stderr, "Cannot create pseudo-terminal: %s!\n", strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+   charBits = 1 + dataBits + stopBits;
+   if (parity != MbusSerialSlaveProtocol::SER_PARITY_NONE)
+      charBits++;
+   virtualPortPtr->setPacing(ptyPacing ? baudRate : 0, charBits, ptyGapUsec);
+   blockTerminationSignals(&oldSigSet);
+   if (virtualPortPtr->startup() != FTALK_SUCCESS)
+   {
+      fprintf(stderr, "Cannot create relay thread!\n");
+      exit(EXIT_FAILURE);
+   }
+   pthread_sigmask(SIG_SETMASK, &oldSigSet, NULL);
+   tuneThread(virtualPortPtr->getRelayThread(), ioCpu);
+   portName = (char *) virtualPortPtr->getServerPortName();
+   printf("Virtual serial port created, connect master to %s\n",
+          virtualPortPtr->getMasterPortName());
+}
+#endif
+
+
+#ifdef HAS_OPENSSL
+/**
+ * Thread function serving the TLS listener
+ */
+void *tlsServerThread(void *)
+{
+   int result;
+
+   while (!stopRequested)
+   {
+      result = tlsServerPtr->serverLoop();
+      if (result != FTALK_SUCCESS)
+      {
+         fprintf(stderr, "TLS: %s!\n", getBusProtocolErrorText(result));
+         break;
+      }
+      if (reclaimerPtr != NULL)
+         reclaimerPtr->quiescent(tlsEpochSlot);
+   }
+   return NULL;
+}
+
+
+/**
+ * Starts up the TLS listener in its own thread
+ */
+void startupTlsServer()
+{
+   int i;
+   int result;
+   sigset_t oldSigSet;
+
+   if (tlsServerPtr == NULL)
+      tlsServerPtr = new MbusTlsServer();
+#ifndef _WIN32
+   if (reclaimerPtr != NULL)
+      tlsEpochSlot = reclaimerPtr->registerThread();
+#endif
+   if (address == -1)
+   {
+      for (i = 0; i < 255; i++)
+         tlsServerPtr->addDataTable(i, dataTablePtrArr[i]);
+   }
+   else
+      tlsServerPtr->addDataTable(address, dataTablePtrArr[address]);
+   tlsServerPtr->setPort((unsigned short) tlsPort);
+   tlsServerPtr->setConnectionTimeOut(connectionTo);
+   configureSocketServer(tlsServerPtr);
+   result = tlsServerPtr->startupServer(tlsCertFileName, tlsKeyFileName,
+                                        tlsCaFileName);
+   if (result != FTALK_SUCCESS)
+   {
+      fprintf(stderr, "TLS: %s!\n", getBusProtocolErrorText(result));
+      exit(EXIT_FAILURE);
+   }
+
+   blockTerminationSignals(&oldSigSet);
+   if (pthread_create(&tlsThread, NULL, tlsServerThread, NULL) != 0)
+   {
+      fprintf(stderr, "TLS: Cannot create thread!\n");
+      exit(EXIT_FAILURE);
+   }
+   pthread_sigmask(SIG_SETMASK, &oldSigSet, NULL);
+   tlsThreadStarted = 1;
+   tuneThread(tlsThread, ioCpu);
+   printf("TLS server started up successfully.\n");
+}
+#endif
+
+
+/**
+ * Constructs a data table of the selected profile. The instrumented
+ * variant is only used if service times, accesses or register writes are
+ * recorded, otherwise the hooks are not compiled into the table.
+ *
+ * @param slaveAddr Slave address
+ * @return Data table
+ */
+MbusDataTableInterface *createProfileDataTable(int slaveAddr)
+{
+#ifndef _WIN32
+   if (jitterReport || accessProfiling || (registerHistoryPtr != NULL))
+      return tableProfilePtr->createInstrumentedTable(slaveAddr);
+#endif
+   return tableProfilePtr->createTable(slaveAddr);
+}
+
+
+/**
+ * Constructs the data table of a slave address as configured.
+ *
+ * @param slaveAddr Slave address
+ * @return Data table
+ */
+MbusDataTableInterface *createDataTable(int slaveAddr)
+{
+   if (tableProfilePtr != NULL)
+      return createProfileDataTable(slaveAddr);
+   if (shmHeaderPtr != NULL)
+      return new DiagnosticMbusDataTable(slaveAddr, DIAG_SHM_SLAVE(shmHeaderPtr, slaveAddr));
+   return new DiagnosticMbusDataTable(slaveAddr);
+}
+
+
+/**
+ * Starts up server
+ */
+void startupServer()
+{
+   int i;
+   int result = -1;
+
+#ifndef _WIN32
+   if (((protocol == RTU) || (protocol == ASCII)) &&
+       (strcmp(portName, "pty") == 0))
+      startupVirtualPort();
+#endif
+   switch (protocol)
+   {
+      case RTU:
+         mbusServerPtr = new MbusRtuSlaveProtocol();
+         if (address == -1)
+         {
+            for (i = 1; i < 255; i++)
             mbusServerPtr->addDataTable(i, dataTablePtrArr[i]);
          }
          else
-            mbusServerPtr->addDataTable(address, dataTablePtrArr[address]);
-         mbusServerPtr->setTimeout(timeOut);
-         if (rs485Mode > 0)
-            ((MbusAsciiSlaveProtocol *) mbusServerPtr)->enableRs485Mode(rs485Mode);
-         result = ((MbusAsciiSlaveProtocol *) mbusServerPtr)->startupServer(
-                   portName, baudRate, dataBits, stopBits, parity);
-      break;
-      case TCP:
-         mbusServerPtr = new MbusTcpSlaveProtocol();
-         if (address == -1)
+            mbusServerPtr->addDataTable(address, dataTablePtrArr[address]);
+         mbusServerPtr->setTimeout(timeOut);
+         if (rs485Mode > 0)
+            ((MbusRtuSlaveProtocol *) mbusServerPtr)->enableRs485Mode(rs485Mode);
+         result = ((MbusRtuSlaveProtocol *) mbusServerPtr)->startupServer(
+                    portName, baudRate, dataBits, stopBits, parity);
+      break;
+      case ASCII:
+         mbusServerPtr = new MbusAsciiSlaveProtocol();
+         if (address == -1)
+         {
+            for (i = 1; i < 255; i++)
+            mbusServerPtr->addDataTable(i, dataTablePtrArr[i]);
+         }
+         else
+            mbusServerPtr->addDataTable(address, dataTablePtrArr[address]);
+         mbusServerPtr->setTimeout(timeOut);
+         if (rs485Mode > 0)
+            ((MbusAsciiSlaveProtocol *) mbusServerPtr)->enableRs485Mode(rs485Mode);
+         result = ((MbusAsciiSlaveProtocol *) mbusServerPtr)->startupServer(
+                   portName, baudRate, dataBits, stopBits, parity);
+      break;
+      case TCP:
+         mbusServerPtr = new MbusTcpSlaveProtocol();
+         if (address == -1)
+         {
+            for (i = 0; i < 255; i++) // Note: TCP support slave addres of 0
+               mbusServerPtr->addDataTable(i, dataTablePtrArr[i]);
+         }
+         else
+            mbusServerPtr->addDataTable(address, dataTablePtrArr[address]);
+         mbusServerPtr->setTimeout(timeOut);
+         ((MbusTcpSlaveProtocol *) mbusServerPtr)->installIpAddrValidationCallBack(validateMasterIpAddr);
+         ((MbusTcpSlaveProtocol *) mbusServerPtr)->setPort((unsigned short) port);
+         ((MbusTcpSlaveProtocol *) mbusServerPtr)->setConnectionTimeOut(connectionTo);
+         result = ((MbusTcpSlaveProtocol *) mbusServerPtr)->startupServer();
+      break;
+#ifndef _WIN32
+      case RTUTCP:
+         sockServerPtr = new MbusRtuOverTcpServer();
+         if (deviceDirPtr != NULL)
+            sockServerPtr->setDeviceDirectory(deviceDirPtr, virtualPortCnt);
+         else if (address == -1)
+         {
+            for (i = 1; i < 255; i++)
+               sockServerPtr->addDataTable(i, dataTablePtrArr[i]);
+         }
+         else
+            sockServerPtr->addDataTable(address, dataTablePtrArr[address]);
+         sockServerPtr->setPort((unsigned short) port);
+         sockServerPtr->setConnectionTimeOut(connectionTo);
+         configureSocketServer(sockServerPtr);
+         result = ((MbusRtuOverTcpServer *) sockServerPtr)->startupServer();
+      break;
+      case UDP:
+         sockServerPtr = new MbusUdpServer();
+         if (deviceDirPtr != NULL)
+            sockServerPtr->setDeviceDirectory(deviceDirPtr, virtualPortCnt);
+         else if (address == -1)
+         {
+            for (i = 0; i < 255; i++)
+               sockServerPtr->addDataTable(i, dataTablePtrArr[i]);
+         }
+         else
+            sockServerPtr->addDataTable(address, dataTablePtrArr[address]);
+         sockServerPtr->setPort((unsigned short) port);
+         configureSocketServer(sockServerPtr);
+         result = ((MbusUdpServer *) sockServerPtr)->startupServer();
+      break;
+#endif
+   }
+   switch (result)
+   {
+      case FTALK_SUCCESS:
+         printf("Server started up successfully.\n");
+      break;
+      case FTALK_ILLEGAL_ARGUMENT_ERROR:
+         fprintf(stderr, "Configuration setting not supported!\n");
+         exit(EXIT_FAILURE);
+      break;
+      default:
+         fprintf(stderr, "%s!\n", getBusProtocolErrorText(result));
+         exit(EXIT_FAILURE);
+      break;
+   }
+#ifdef HAS_OPENSSL
+   if (tlsPort != 0)
+      startupTlsServer();
+#endif
+#ifndef _WIN32
+   tuneThread(pthread_self(), serverCpu);
+#endif
+}
+
+
+#ifndef _WIN32
+/**
+ * Constructs the data tables of --instances mode: a shared table for each
+ * address served by a shared instance and the tables of private
+ * instances. Addresses no instance serves get no table.
+ */
+void createInstanceTables()
+{
+   DiagslaveInstance *instPtr;
+   int i;
+   int j;
+
+   for (i = 0; i < instanceCnt; i++)
+   {
+      instPtr = &instanceArr[i];
+      if (instPtr->privateTables)
+      {
+         instPtr->tablePtrArr = new MbusDataTableInterface *[256];
+         memset(instPtr->tablePtrArr, 0, 256 * sizeof(MbusDataTableInterface *));
+      }
+      for (j = 0; j < 255; j++)
+      {
+         if (!instPtr->servedArr[j])
+            continue;
+         if (!instPtr->privateTables)
+         {
+            if (dataTablePtrArr[j] == NULL)
+               dataTablePtrArr[j] = createDataTable(j);
+         }
+         else if (tableProfilePtr != NULL)
+            instPtr->tablePtrArr[j] = createProfileDataTable(j);
+         else
+            instPtr->tablePtrArr[j] = new DiagnosticMbusDataTable(j);
+      }
+   }
+}
+
+
+/**
+ * Thread function serving a group of instances
+ *
+ * @param groupPtr Server group
+ */
+void *serverGroupThread(void *groupPtr)
+{
+   int result;
+
+   while (!stopRequested && !groupStopRequested)
+   {
+      result = ((MbusServerGroup *) groupPtr)->serverLoop();
+      if (result != FTALK_SUCCESS)
+      {
+         fprintf(stderr, "%s!\n", getBusProtocolErrorText(result));
+         break;
+      }
+   }
+   return NULL;
+}
+
+
+/**
+ * Starts up the servers of all instances. They are spread over the event
+ * loop threads, the main thread serves the first group. Exits the program
+ * on error.
+ */
+void startupInstances()
+{
+   DiagslaveInstance *instPtr;
+   sigset_t oldSigSet;
+   int result;
+   int i;
+   int j;
+
+   serverGroupArr = new MbusServerGroup[workerThreadCnt];
+   for (i = 0; i < instanceCnt; i++)
+   {
+      instPtr = &instanceArr[i];
+      if (instPtr->protocol == RTUTCP)
+         instPtr->serverPtr = new MbusRtuOverTcpServer();
+      else
+         instPtr->serverPtr = new MbusUdpServer();
+      for (j = 0; j < 255; j++)
+      {
+         if (instPtr->servedArr[j])
+            instPtr->serverPtr->addDataTable(j, instPtr->privateTables ?
+                                             instPtr->tablePtrArr[j] : dataTablePtrArr[j]);
+      }
+      instPtr->serverPtr->setPort((unsigned short) instPtr->port);
+      instPtr->serverPtr->setConnectionTimeOut(connectionTo);
+      configureSocketServer(instPtr->serverPtr);
+      // Each instance is a bus of its own
+      instPtr->diagPtr = new MbusDiagnostics();
+      instPtr->serverPtr->setDiagnostics(instPtr->diagPtr);
+      if (instPtr->protocol == RTUTCP)
+         result = ((MbusRtuOverTcpServer *) instPtr->serverPtr)->startupServer();
+      else
+         result = ((MbusUdpServer *) instPtr->serverPtr)->startupServer();
+      if (result != FTALK_SUCCESS)
+      {
+         fprintf(stderr, "Instance on port %d: %s!\n", instPtr->port,
+                 getBusProtocolErrorText(result));
+         exit(EXIT_FAILURE);
+      }
+      if (serverGroupArr[i % workerThreadCnt].addServer(instPtr->serverPtr) != 0)
+      {
+         fprintf(stderr, "Out of memory!\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   printf("%d instances started up successfully.\n", instanceCnt);
+#ifdef HAS_OPENSSL
+   if (tlsPort != 0)
+      startupTlsServer();
+#endif
+   tuneThread(pthread_self(), serverCpu);
+
+   groupThreadArr = new pthread_t[workerThreadCnt];
+   blockTerminationSignals(&oldSigSet);
+   for (i = 1; i < workerThreadCnt; i++)
+   {
+      if (pthread_create(&groupThreadArr[i], NULL, serverGroupThread,
+                         &serverGroupArr[i]) != 0)
+      {
+         fprintf(stderr, "Cannot create event loop thread!\n");
+         exit(EXIT_FAILURE);
+      }
+      groupThreadCnt++;
+      tuneThread(groupThreadArr[i], -1);
+   }
+   pthread_sigmask(SIG_SETMASK, &oldSigSet, NULL);
+}
+
+
+/**
+ * Stops the event loop threads, prints the statistics of all instances
+ * and their totals and deletes the servers.
+ */
+void shutdownInstances()
+{
+   DiagslaveInstance *instPtr;
+   unsigned long msgCnt = 0;
+   unsigned long errorCnt = 0;
+   int tableCnt = 0;
+   int i;
+   int j;
+
+   groupStopRequested = 1;
+   for (i = 1; i <= groupThreadCnt; i++)
+      pthread_join(groupThreadArr[i], NULL);
+   groupThreadCnt = 0;
+   for (i = 0; i < instanceCnt; i++)
+   {
+      instPtr = &instanceArr[i];
+      if (instPtr->serverPtr == NULL)
+         continue;
+      printf("Instance %s port %d: %u messages, %u errors\n",
+             instPtr->protocol == UDP ? "udp" : "rtutcp", instPtr->port,
+             instPtr->diagPtr->getMessageCount(), instPtr->diagPtr->getErrorCount());
+      instPtr->serverPtr->printStatistics();
+      msgCnt += instPtr->diagPtr->getMessageCount();
+      errorCnt += instPtr->diagPtr->getErrorCount();
+      delete instPtr->serverPtr;
+      delete instPtr->diagPtr;
+      instPtr->serverPtr = NULL;
+      instPtr->diagPtr = NULL;
+   }
+   for (i = 0; i < 255; i++)
+   {
+      if (dataTablePtrArr[i] != NULL)
+         tableCnt++;
+      for (j = 0; j < instanceCnt; j++)
+      {
+         if ((instanceArr[j].tablePtrArr != NULL) && (instanceArr[j].tablePtrArr[i] != NULL))
+            tableCnt++;
+      }
+   }
+   printf("Total: %d instances on %d threads, %d data tables, %lu messages, %lu errors\n",
+          instanceCnt, workerThreadCnt, tableCnt, msgCnt, errorCnt);
+   delete[] serverGroupArr;
+   delete[] groupThreadArr;
+   serverGroupArr = NULL;
+   groupThreadArr = NULL;
+}
+#endif
+
+
+#ifndef _WIN32
+/**
+ * Serializes flushes of the main thread and the admin history command.
+ */
+pthread_mutex_t flushMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Feeds a range of coalesced register writes to the register history.
+ * Called under flushMutex by the main thread and by the admin history
+ * command. Tables removed by the admin interface are deleted by the
+ * admin thread once the main thread passed a quiescent state, so neither
+ * reads a deleted table. The map is keyed by slave address, which names
+ * exactly one table as private instances are rejected together with -H
+ * and so with -F.
+ */
+void flushDirtyRange(int slaveAddr, int startAddr, int regCnt)
+{
+   static short regArr[0x10000];
+   AdminMbusDataTable *tablePtr = (AdminMbusDataTable *)
+      __atomic_load_n(&dataTablePtrArr[slaveAddr], __ATOMIC_ACQUIRE);
+
+   if ((tablePtr != NULL) && tablePtr->getRegisters(startAddr, regArr, regCnt))
+      registerHistoryPtr->record(slaveAddr, startAddr, regArr, regCnt);
+}
+
+
+/**
+ * Ends the current write coalescing epoch, if enabled.
+ */
+void flushDirtyRegisters()
+{
+   if (dirtyRegisterMapPtr == NULL)
+      return;
+   pthread_mutex_lock(&flushMutex);
+   dirtyRegisterMapPtr->flush(flushDirtyRange);
+   pthread_mutex_unlock(&flushMutex);
+}
+
+
+/**
+ * Writes the register history to the export file, if one is configured.
+ */
+void exportHistory()
+{
+   if (historyFileName == NULL)
+      return;
+   flushDirtyRegisters();
+   if (registerHistoryPtr->writeCsv(historyFileName) == 0)
+      printf("\rRegister history exported to %s.\n", historyFileName);
+   else
+      fprintf(stderr, "Cannot write register history file %s!\n", historyFileName);
+}
+
+
+/**
+ * Signal handler for SIGUSR1, requests the server loop to export the
+ * register history.
+ *
+ * @param sig Signal number
+ */
+void exportSignalHandler(int sig)
+{
+   (void) sig;
+   historyExportRequested = 1;
+}
+#endif
+
+
+#ifndef _WIN32
+/*****************************************************************************
+ * Admin interface
+ *****************************************************************************/
+
+/**
+ * Deletes a data table retired by the admin interface.
+ */
+void deleteDataTable(void *objPtr)
+{
+   delete (AdminMbusDataTable *) objPtr;
+}
+
+
+/**
+ * Parses a number argument of an admin command.
+ *
+ * @return 0 on success, -1 if not a number within minVal and maxVal
+ */
+int parseAdminNumber(const char *argPtr, long minVal, long maxVal, long *valPtr)
+{
+   char *endPtr;
+
+   *valPtr = strtol(argPtr, &endPtr, 0);
+   if ((endPtr == argPtr) || (*endPtr != '\0') || (*valPtr < minVal) || (*valPtr > maxVal))
+      return -1;
+   return 0;
+}
+
+
+/**
+ * Applies time-outs changed by the admin interface. Called by the main
+ * thread, which owns the protocol servers.
+ */
+void applyTimeOuts()
+{
+   if (mbusServerPtr != NULL)
+      mbusServerPtr->setTimeout(timeOut);
+   if (protocol == TCP)
+      ((MbusTcpSlaveProtocol *) mbusServerPtr)->setConnectionTimeOut(connectionTo);
+   if (sockServerPtr != NULL)
+      sockServerPtr->setConnectionTimeOut(connectionTo);
+#ifdef HAS_OPENSSL
+   if (tlsServerPtr != NULL)
+      tlsServerPtr->setConnectionTimeOut(connectionTo);
+#endif
+}
+
+
+/**
+ * Adds or removes a slave address while the server runs. The protocol
+ * servers read their table pointers without locks, a replaced table is
+ * handed to the reclaimer. dataTablePtrArr is likewise updated with
+ * release stores, the main thread reads it when flushing coalesced writes.
+ *
+ * @return NULL on success, else an error message
+ */
+const char *changeSlave(int slaveAddr, int add)
+{
+   MbusDataTableInterface *tablePtr;
+
+   if (sockServerPtr == NULL)
+      return "Adding and removing slaves requires RTU over TCP or UDP protocol";
+   if (add)
+   {
+      if (slaveServedArr[slaveAddr])
+         return "Slave already present";
+      if ((slaveAddr == 0) && (protocol == RTUTCP))
+         return "Address 0 is the broadcast address";
+      if (dataTablePtrArr[slaveAddr] == NULL)
+         __atomic_store_n(&dataTablePtrArr[slaveAddr], createDataTable(slaveAddr),
+                          __ATOMIC_RELEASE);
+      tablePtr = dataTablePtrArr[slaveAddr];
+   }
+   else
+   {
+      if (!slaveServedArr[slaveAddr])
+         return "Slave not present";
+      tablePtr = NULL;
+   }
+   slaveServedArr[slaveAddr] = (unsigned char) add;
+   sockServerPtr->addDataTable(slaveAddr, tablePtr);
+#ifdef HAS_OPENSSL
+   if (tlsThreadStarted)
+      tlsServerPtr->addDataTable(slaveAddr, tablePtr);
+#endif
+   if (!add)
+   {
+      tablePtr = dataTablePtrArr[slaveAddr];
+      if (reclaimerPtr->retire(tablePtr, deleteDataTable) != 0)
+         return "Slave removed, its table is kept as too many await deletion";
+      __atomic_store_n(&dataTablePtrArr[slaveAddr], (MbusDataTableInterface *) NULL,
+                       __ATOMIC_RELEASE);
+   }
+   return NULL;
+}
+
+
+/**
+ * Executes an admin command, see printAdminHelp() for the commands.
+ * Called by the admin thread.
+ */
+const char *executeAdminCommand(int argc, char *argv[], FILE *rspFilePtr)
+{
+   AdminMbusDataTable *tablePtr = NULL;
+   const char *errorPtr = NULL;
+   long slaveAddr = -1;
+   long startAddr;
+   long cnt;
+   long val;
+   int isCoil = 0;
+   int i;
+
+   reclaimerPtr->reclaim();
+   if (strcmp(argv[0], "help") == 0)
+   {
+      fprintf(rspFilePtr,
+              "slaves                      List served slave addresses\n"
+              "get SLAVE reg|coil ADDR [N] Read N registers or coils from ADDR (0-based)\n"
+              "set SLAVE reg|coil ADDR V.. Write registers or coils from ADDR\n"
+              "dump SLAVE                  List all non-zero registers and coils\n"
+              "reset SLAVE                 Clear all registers and coils\n"
+              "add SLAVE                   Serve a slave address (RTU over TCP, UDP)\n"
+              "remove SLAVE                Stop serving a slave address (RTU over TCP, UDP)\n"
+              "status SLAVE [VALUE]        Show or set the exception status (function 7)\n"
+              "counters SLAVE [clear]      Show or clear the diagnostics counters\n"
+              "history SLAVE [ADDR [N]]    Export the recorded register history as CSV\n"
+              "log on|off                  Log every data access\n"
+              "timeout SECONDS             Set the master activity time-out\n"
+              "conntimeout SECONDS         Set the connection time-out\n");
+      return NULL;
+   }
+   if (strcmp(argv[0], "slaves") == 0)
+   {
+      for (i = 0; i < 255; i++)
+      {
+         if (slaveServedArr[i])
+            fprintf(rspFilePtr, "%d ", i);
+      }
+      fprintf(rspFilePtr, "\n");
+      return NULL;
+   }
+   if (strcmp(argv[0], "log") == 0)
+   {
+      if ((argc != 2) || ((strcmp(argv[1], "on") != 0) && (strcmp(argv[1], "off") != 0)))
+         return "Usage: log on|off";
+      DiagnosticMbusDataTable::logging = strcmp(argv[1], "on") == 0;
+      return NULL;
+   }
+   if ((strcmp(argv[0], "timeout") == 0) || (strcmp(argv[0], "conntimeout") == 0))
+   {
+      double seconds;
+
+      if (argc != 2)
+         return "Usage: timeout|conntimeout SECONDS";
+      seconds = strtod(argv[1], NULL);
+      if (argv[0][0] == 't')
+      {
+         if ((seconds < 1.0) || (seconds > 100.0))
+            return "Invalid time-out";
+         timeOut = (long) (seconds * 1000.0);
+      }
+      else
+      {
+         if ((seconds < 10.0) || (seconds > 3600.0))
+            return "Invalid connection time-out";
+         connectionTo = (long) (seconds * 1000.0);
+      }
+      __atomic_store_n(&timeOutsChanged, 1, __ATOMIC_RELEASE);
+      return NULL;
+   }
+
+   //
+   // The remaining commands address a slave
+   //
+   if ((strcmp(argv[0], "status") != 0) && (strcmp(argv[0], "counters") != 0) &&
+       (strcmp(argv[0], "add") != 0) && (strcmp(argv[0], "remove") != 0) &&
+       (strcmp(argv[0], "reset") != 0) && (strcmp(argv[0], "dump") != 0) &&
+       (strcmp(argv[0], "get") != 0) && (strcmp(argv[0], "set") != 0) &&
+       (strcmp(argv[0], "history") != 0))
+      return "Unknown command, try help";
+   if ((argc < 2) || (parseAdminNumber(argv[1], 0, 254, &slaveAddr) != 0))
+      return "Missing or invalid slave address";
+   if (strcmp(argv[0], "status") == 0)
+   {
+      if (argc == 2)
+         fprintf(rspFilePtr, "0x%02X\n",
+                 DiagnosticMbusDataTable::exceptionStatusArr[slaveAddr]);
+      else if (parseAdminNumber(argv[2], 0, 255, &val) == 0)
+         DiagnosticMbusDataTable::exceptionStatusArr[slaveAddr] = (unsigned char) val;
+      else
+         return "Invalid exception status";
+      return NULL;
+   }
+   if (strcmp(argv[0], "counters") == 0)
+   {
+      if (argc == 2)
+         busDiagnostics.getSlave((int) slaveAddr)->printCounters(rspFilePtr);
+      else if (strcmp(argv[2], "clear") == 0)
+         busDiagnostics.getSlave((int) slaveAddr)->clearCounters();
+      else
+         return "Usage: counters SLAVE [clear]";
+      return NULL;
+   }
+   if (strcmp(argv[0], "history") == 0)
+   {
+      startAddr = 0;
+      cnt = 0x10000;
+      if ((argc > 2) && (parseAdminNumber(argv[2], 0, 0xFFFF, &startAddr) != 0))
+         return "Invalid address";
+      if (argc > 2)
+         cnt = 1;
+      if ((argc > 3) && (parseAdminNumber(argv[3], 1, 0x10000 - startAddr, &cnt) != 0))
+         return "Invalid count";
+      if (registerHistoryPtr == NULL)
+         return "Register history not enabled, see -H";
+      flushDirtyRegisters();
+      if (registerHistoryPtr->exportCsv(rspFilePtr, (int) slaveAddr, (int) startAddr,
+                                        (int) (startAddr + cnt - 1)) < 0)
+         return "Cannot export register history";
+      return NULL;
+   }
+   if (strcmp(argv[0], "add") == 0)
+      return changeSlave((int) slaveAddr, 1);
+   if (strcmp(argv[0], "remove") == 0)
+      return changeSlave((int) slaveAddr, 0);
+   tablePtr = (AdminMbusDataTable *) dataTablePtrArr[slaveAddr];
+   if (tablePtr == NULL)
+      return "Slave not present";
+   if (strcmp(argv[0], "reset") == 0)
+   {
+      tablePtr->clear();
+      return NULL;
+   }
+   if (strcmp(argv[0], "dump") == 0)
+   {
+      short *regArr = new short[tablePtr->getRegisterCount()];
+      char *bitArr = new char[tablePtr->getCoilCount() + 1];
+
+      tablePtr->getRegisters(0, regArr, tablePtr->getRegisterCount());
+      tablePtr->getCoils(0, bitArr, tablePtr->getCoilCount());
+      for (i = 0; i < tablePtr->getRegisterCount(); i++)
+      {
+         if (regArr[i] != 0)
+            fprintf(rspFilePtr, "reg %d %u\n", i, (unsigned short) regArr[i]);
+      }
+      for (i = 0; i < tablePtr->getCoilCount(); i++)
+      {
+         if (bitArr[i] != 0)
+            fprintf(rspFilePtr, "coil %d 1\n", i);
+      }
+      delete[] regArr;
+      delete[] bitArr;
+      return NULL;
+   }
+
+   //
+   // get and set
+   //
+   if (argc < 4)
+      return "Missing arguments";
+   if (strcmp(argv[2], "coil") == 0)
+      isCoil = 1;
+   else if (strcmp(argv[2], "reg") != 0)
+      return "Data type must be reg or coil";
+   if (parseAdminNumber(argv[3], 0, 0xFFFF, &startAddr) != 0)
+      return "Invalid address";
+   if (argv[0][0] == 'g')
+   {
+      cnt = 1;
+      if ((argc > 4) && (parseAdminNumber(argv[4], 1, 0x10000, &cnt) != 0))
+         return "Invalid count";
+   }
+   else
+      cnt = argc - 4;
+   if (cnt <= 0)
+      return "Missing values";
+
+   if (isCoil)
+   {
+      char *bitArr = new char[cnt];
+
+      if (argv[0][0] == 'g')
+      {
+         if (tablePtr->getCoils((int) startAddr, bitArr, (int) cnt))
+         {
+            for (i = 0; i < cnt; i++)
+               fprintf(rspFilePtr, i + 1 < cnt ? "%d " : "%d\n", bitArr[i] ? 1 : 0);
+         }
+         else
+            errorPtr = "Invalid range";
+      }
+      else
+      {
+         for (i = 0; (i < cnt) && (errorPtr == NULL); i++)
          {
-            for (i = 0; i < 255; i++) // Note: TCP support slave addres of 0
-               mbusServerPtr->addDataTable(i, dataTablePtrArr[i]);
+            if (parseAdminNumber(argv[4 + i], 0, 1, &val) != 0)
+               errorPtr = "Invalid coil value";
+            bitArr[i] = (char) val;
+         }
+         if ((errorPtr == NULL) && !tablePtr->setCoils((int) startAddr, bitArr, (int) cnt))
+            errorPtr = "Invalid range";
+      }
+      delete[] bitArr;
+   }
+   else
+   {
+      short *regArr = new short[cnt];
+
+      if (argv[0][0] == 'g')
+      {
+         if (tablePtr->getRegisters((int) startAddr, regArr, (int) cnt))
+         {
+            for (i = 0; i < cnt; i++)
+               fprintf(rspFilePtr, i + 1 < cnt ? "%u " : "%u\n", (unsigned short) regArr[i]);
          }
          else
-            mbusServerPtr->addDataTable(address, dataTablePtrArr[address]);
-         mbusServerPtr->setTimeout(timeOut);
-         ((MbusTcpSlaveProtocol *) mbusServerPtr)->installIpAddrValidationCallBack(validateMasterIpAddr);
-         ((MbusTcpSlaveProtocol *) mbusServerPtr)->setPort((unsigned short) port);
-         ((MbusTcpSlaveProtocol *) mbusServerPtr)->setConnectionTimeOut(connectionTo);
-         result = ((MbusTcpSlaveProtocol *) mbusServerPtr)->startupServer();
-      break;
+            errorPtr = "Invalid range";
+      }
+      else
+      {
+         for (i = 0; (i < cnt) && (errorPtr == NULL); i++)
+         {
+            if (parseAdminNumber(argv[4 + i], -32768, 0xFFFF, &val) != 0)
+               errorPtr = "Invalid register value";
+            regArr[i] = (short) val;
+         }
+         if ((errorPtr == NULL) && !tablePtr->setRegisters((int) startAddr, regArr, (int) cnt))
+            errorPtr = "Invalid range";
+      }
+      delete[] regArr;
    }
-   switch (result)
+   return errorPtr;
+}
+
+
+/**
+ * Starts the admin interface. Exits the program on error.
+ */
+void startupAdminServer()
+{
+   int i;
+
+   for (i = 0; i < 255; i++)
    {
-      case FTALK_SUCCESS:
-         printf("Server started up successfully.\n");
-      break;
-      case FTALK_ILLEGAL_ARGUMENT_ERROR:
-         fprintf(stderr, "Configuration setting not supported!\n");
-         exit(EXIT_FAILURE);
-      break;
-      default:
-         fprintf(stderr, "%s!\n", getBusProtocolErrorText(result));
-         exit(EXIT_FAILURE);
-      break;
+      slaveServedArr[i] = (unsigned char) ((address == -1) || (address == i));
+      // Serial protocols and RTU over TCP do not serve the broadcast address
+      if ((i == 0) && (protocol != TCP) && (protocol != UDP))
+         slaveServedArr[i] = 0;
+   }
+   adminServerPtr = new AdminServer(executeAdminCommand);
+   if (adminServerPtr->startup(adminSocketName) != 0)
+   {
+      fprintf(stderr, "Cannot serve admin interface on %s: %s!\n", adminSocketName,
+              strerror(errno));
+      exit(EXIT_FAILURE);
    }
+   tuneThread(adminServerPtr->getThread(), -1);
+   printf("Admin interface listening on %s.\n", adminSocketName);
 }
 
 
+#endif
+
+
 /**
  * Shutdown server
  */
 void shutdownServer()
 {
    printf("Shutting down server.\n");
+#ifndef _WIN32
+   delete adminServerPtr;
+   adminServerPtr = NULL;
+   if (serverGroupArr != NULL)
+      shutdownInstances();
+#endif
    delete mbusServerPtr;
+#ifndef _WIN32
+   if (sockServerPtr != NULL)
+      sockServerPtr->printStatistics();
+   delete sockServerPtr;
+   delete deviceDirPtr;
+   if (virtualPortPtr != NULL)
+   {
+      virtualPortPtr->shutdown();
+      virtualPortPtr->printStatistics();
+   }
+   delete virtualPortPtr;
+   if (jitterReport)
+      serviceTimeHist.print("Data table service time");
+#endif
+#ifdef HAS_OPENSSL
+   if (tlsThreadStarted)
+   {
+      stopRequested = 1;
+      pthread_join(tlsThread, NULL);
+      tlsThreadStarted = 0;
+      tlsServerPtr->printStatistics();
+   }
+#endif
+#ifndef _WIN32
+   if (accessProfilerPtr != NULL)
+   {
+      DiagnosticMbusDataTable::accessProfilerPtr = NULL;
+      accessProfilerPtr->merge();
+      accessProfilerPtr->printReport(20);
+      if ((workloadFileName != NULL) &&
+          (accessProfilerPtr->writeWorkload(workloadFileName) != 0))
+         fprintf(stderr, "Cannot write workload file %s!\n", workloadFileName);
+      delete accessProfilerPtr;
+   }
+   if (dirtyRegisterMapPtr != NULL)
+   {
+      DiagnosticMbusDataTable::dirtyRegisterMapPtr = NULL;
+      flushDirtyRegisters();
+      dirtyRegisterMapPtr->printStatistics();
+      delete dirtyRegisterMapPtr;
+      dirtyRegisterMapPtr = NULL;
+   }
+   if (registerHistoryPtr != NULL)
+   {
+      DiagnosticMbusDataTable::registerHistoryPtr = NULL;
+      registerHistoryPtr->printStatistics();
+      exportHistory();
+      delete registerHistoryPtr;
+   }
+   // Only a regular shutdown leaves consistent tables to save
+   if ((saveSnapshotName != NULL) && stopRequested)
+   {
+      if (saveSnapshot(saveSnapshotName) == 0)
+         printf("Snapshot saved to %s.\n", saveSnapshotName);
+      else
+         fprintf(stderr, "Cannot save snapshot %s!\n", saveSnapshotName);
+   }
+#endif
+#ifdef HAS_OPENSSL
+   delete tlsServerPtr;
+#endif
+#ifndef _WIN32
+   delete reclaimerPtr;
+   reclaimerPtr = NULL;
+#endif
+}
+
+
+/**
+ * Signal handler for SIGINT and SIGTERM, requests the server loop to stop.
+ * The handler is installed for one shot, a second signal terminates
+ * immediately.
+ *
+ * @param sig Signal number
+ */
+void signalHandler(int sig)
+{
+   stopRequested = 1;
+#ifdef _WIN32
+   signal(sig, SIG_DFL);
+#else
+   (void) sig;
+#endif
+}
+
+
+/**
+ * Installs the termination signal handlers
+ */
+void installSignalHandlers()
+{
+#ifdef _WIN32
+   signal(SIGINT, signalHandler);
+   signal(SIGTERM, signalHandler);
+#else
+   struct sigaction sigAction;
+
+   memset(&sigAction, 0, sizeof(sigAction));
+   sigAction.sa_handler = signalHandler;
+   sigAction.sa_flags = SA_RESETHAND;
+   sigemptyset(&sigAction.sa_mask);
+   sigaction(SIGINT, &sigAction, NULL);
+   sigaction(SIGTERM, &sigAction, NULL);
+   // A master resetting its connection while a response is written must
+   // only close that connection, the write then fails with EPIPE
+   sigAction.sa_handler = SIG_IGN;
+   sigAction.sa_flags = 0;
+   sigaction(SIGPIPE, &sigAction, NULL);
+   if (historyFileName != NULL)
+   {
+      sigAction.sa_handler = exportSignalHandler;
+      sigAction.sa_flags = SA_RESTART;
+      sigaction(SIGUSR1, &sigAction, NULL);
+   }
+#endif
 }
 
 
@@ -469,11 +2530,53 @@ void shutdownServer()
 void runServer()
 {
    int result = FTALK_SUCCESS;
+#ifndef _WIN32
+   time_t lastMergeTime = time(NULL);
+   struct timespec now;
+   long lastFlushMs = 0;
+#endif
 
    printf("Listening to network (Ctrl-C to stop)\n");
-   while (result == FTALK_SUCCESS)
+   while ((result == FTALK_SUCCESS) && !stopRequested)
    {
-      result = mbusServerPtr->serverLoop();
+#ifndef _WIN32
+      if (serverGroupArr != NULL)
+         result = serverGroupArr[0].serverLoop();
+      else if (sockServerPtr != NULL)
+         result = sockServerPtr->serverLoop();
+      else
+#endif
+         result = mbusServerPtr->serverLoop();
+      if (stopRequested)
+         break;
+#ifndef _WIN32
+      // Keep the merged access profile reasonably current
+      if ((accessProfilerPtr != NULL) && (time(NULL) - lastMergeTime >= 10))
+      {
+         accessProfilerPtr->merge();
+         lastMergeTime = time(NULL);
+      }
+      if (historyExportRequested)
+      {
+         historyExportRequested = 0;
+         exportHistory();
+      }
+      if (dirtyRegisterMapPtr != NULL)
+      {
+         clock_gettime(CLOCK_MONOTONIC, &now);
+         if (now.tv_sec * 1000L + now.tv_nsec / 1000000L - lastFlushMs >= flushIntervalMs)
+         {
+            flushDirtyRegisters();
+            lastFlushMs = now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+         }
+      }
+      if (reclaimerPtr != NULL)
+      {
+         reclaimerPtr->quiescent(mainEpochSlot);
+         if (__atomic_exchange_n(&timeOutsChanged, 0, __ATOMIC_ACQUIRE))
+            applyTimeOuts();
+      }
+#endif
       if (result != FTALK_SUCCESS)
          fprintf(stderr, "%s!\n", getBusProtocolErrorText(result));\
       else
@@ -496,16 +2599,82 @@ int main(int argc, char **argv)
 {
    int i;
 
+   memset(DiagnosticMbusDataTable::exceptionStatusArr, 0x55,
+          sizeof(DiagnosticMbusDataTable::exceptionStatusArr));
+#ifndef _WIN32
+   scanLongOptions(&argc, argv);
+   if (snapshotName != NULL)
+      loadSnapshot(snapshotName);
+#endif
+   scanOptions(argc, argv);
+
    // Construct data tables
+#ifndef _WIN32
+   if (shmName != NULL)
+      shmHeaderPtr = openSharedMemory(shmName);
+   if (virtualPortCnt > 0)
+      deviceDirPtr = new DeviceDirectory(maxVirtualDevices);
+   else if (instanceCnt > 0)
+      createInstanceTables();
+   else
+#endif
    for (i = 0; i < 255; i++)
+      dataTablePtrArr[i] = createDataTable(i);
+#ifndef _WIN32
+   if (jitterReport)
+      DiagnosticMbusDataTable::serviceTimeHistPtr = &serviceTimeHist;
+   if (accessProfiling)
    {
-      dataTablePtrArr[i] = new DiagnosticMbusDataTable(i);
+      // Event loop threads, the main thread and the TLS thread record
+      accessProfilerPtr = new AccessProfiler(workerThreadCnt + 2);
+      DiagnosticMbusDataTable::accessProfilerPtr = accessProfilerPtr;
    }
-
-   scanOptions(argc, argv);
+   if (registerHistoryPtr != NULL)
+   {
+      if (registerHistoryPtr->allocate((size_t) historyKiB * 1024) != 0)
+      {
+         fprintf(stderr, "Cannot allocate register history!\n");
+         exit(EXIT_FAILURE);
+      }
+      DiagnosticMbusDataTable::registerHistoryPtr = registerHistoryPtr;
+   }
+   if (flushIntervalMs > 0)
+   {
+      dirtyRegisterMapPtr = new DirtyRegisterMap();
+      if (!dirtyRegisterMapPtr->isValid())
+      {
+         fprintf(stderr, "Cannot allocate write coalescing map!\n");
+         exit(EXIT_FAILURE);
+      }
+      DiagnosticMbusDataTable::dirtyRegisterMapPtr = dirtyRegisterMapPtr;
+   }
+   if (lockMemory)
+      lockDataTables();
+#endif
    printConfig();
+   installSignalHandlers();
+#ifndef _WIN32
+   if (cloneCnt > 0)
+      forkClones();
+#endif
+#ifndef _WIN32
+   if (adminSocketName != NULL)
+   {
+      reclaimerPtr = new EpochReclaimer();
+      mainEpochSlot = reclaimerPtr->registerThread();
+   }
+#endif
    atexit(shutdownServer);
+#ifndef _WIN32
+   if (instanceCnt > 0)
+      startupInstances();
+   else
+#endif
    startupServer();
+#ifndef _WIN32
+   if (adminSocketName != NULL)
+      startupAdminServer();
+#endif
    runServer();
-   return EXIT_FAILURE;
+   return stopRequested ? EXIT_SUCCESS : EXIT_FAILURE;
 }